@@ -3,10 +3,132 @@
 #ifndef __FFTW2D_CPP__HH__
 #define __FFTW2D_CPP__HH__
 
+#include <map>
+#include <mutex>
+#include <tuple>
 #include <vector>
 #include <complex>
+#include <cstring>
 #include <fftw3.h>
 
+/**
+ * Process wide cache of FFTW plans, keyed by size, direction, placement and planner flags.
+ * Plans are only made once per key and never destroyed; the planner is not thread safe, so
+ * planning is serialized, while executing a plan on new arrays is.
+ */
+class FFTPlans
+{
+public:
+    /**
+     * Plan for a 2D transform, made on first use
+     * @param n1          Number of datapoints in first dim.
+     * @param n2          Number of datapoints in second dim.
+     * @param sign        FFTW_FORWARD or FFTW_BACKWARD
+     * @param b_in_place  The plan is executed with in == out
+     * @param b_aligned   The arrays it is executed on are SIMD aligned (fftwf_alignment_of == 0)
+     * @param flags       Planner flags, e.g. FFTW_MEASURE
+     * @param b_real      Real to half spectrum (forward) or half spectrum to real (backward),
+     *                    never in place
+     */
+    static fftwf_plan get(int n1, int n2, int sign, bool b_in_place, bool b_aligned, unsigned flags, bool b_real = false)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        init();
+        // Threads only pay off for large transforms
+        int nt = (static_cast<size_t>(n1) * n2 >= min_threaded) ? n_threads : 1;
+        b_in_place = b_in_place && !b_real;
+        Key key{n1, n2, sign, b_in_place, b_aligned, flags, nt, b_real};
+        auto it = plans.find(key);
+        if (it != plans.end())
+        {
+            return it->second;
+        }
+
+        // Measuring overwrites the arrays, so plans are made on scratch buffers
+        size_t n = static_cast<size_t>(n1) * n2;
+        fftwf_complex *in = static_cast<fftwf_complex *>(fftwf_malloc(sizeof(fftwf_complex) * n));
+        fftwf_complex *out = b_in_place ? in : static_cast<fftwf_complex *>(fftwf_malloc(sizeof(fftwf_complex) * n));
+        flags |= b_aligned ? 0 : FFTW_UNALIGNED;
+        fftwf_plan_with_nthreads(nt);
+        fftwf_plan plan;
+        if (!b_real)
+        {
+            plan = fftwf_plan_dft_2d(n1, n2, in, out, sign, flags);
+        }
+        else if (sign == FFTW_FORWARD)
+        {
+            plan = fftwf_plan_dft_r2c_2d(n1, n2, reinterpret_cast<float *>(in), out, flags);
+        }
+        else
+        {
+            plan = fftwf_plan_dft_c2r_2d(n1, n2, in, reinterpret_cast<float *>(out), flags);
+        }
+        if (out != in)
+        {
+            fftwf_free(out);
+        }
+        fftwf_free(in);
+        plans[key] = plan;
+        return plan;
+    }
+
+    /**
+     * Threads used by plans made from now on
+     * @param n   Number of threads
+     */
+    static void set_threads(int n)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        n_threads = (n > 1) ? n : 1;
+    }
+
+    /**
+     * Wisdom of earlier sessions, so that measured plans are made without measuring again
+     * @param path   File written by save_wisdom()
+     */
+    static bool load_wisdom(const char *path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        init();
+        return fftwf_import_wisdom_from_filename(path) != 0;
+    }
+
+    static bool save_wisdom(const char *path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        init();
+        return fftwf_export_wisdom_to_filename(path) != 0;
+    }
+
+    /**
+     * True if data has the alignment of the buffers plans are made on
+     */
+    static bool aligned(const void *data)
+    {
+        return fftwf_alignment_of(reinterpret_cast<float *>(const_cast<void *>(data))) == 0;
+    }
+
+private:
+    typedef std::tuple<int, int, int, bool, bool, unsigned, int, bool> Key;
+    static const size_t min_threaded = 1 << 16;
+    static constexpr double time_limit = 2.0; // Seconds a plan may be measured for
+
+    inline static std::mutex mutex;
+    inline static std::map<Key, fftwf_plan> plans;
+    inline static int n_threads = 1;
+    inline static bool b_init = false;
+
+    static void init()
+    {
+        if (!b_init)
+        {
+            fftwf_init_threads();
+            fftwf_set_timelimit(time_limit);
+            b_init = true;
+        }
+    }
+};
+
 /**
  * Class representing a 2D Fourier transform
  */
@@ -18,29 +140,111 @@ public:
     const size_t N;  // Total number of data points = N1*N2
 
 private:
-    fftwf_plan plan_fw;
-    fftwf_plan plan_bw;
+    unsigned flags;
+    std::vector<std::complex<float>> spectrum; // Scratch for the magnitudes of the spectrum
+
+    inline fftwf_plan plan(int sign, std::vector<std::complex<float>> &data)
+    {
+        return FFTPlans::get(N1, N2, sign, true, FFTPlans::aligned(data.data()), flags);
+    }
+
+    /**
+     * Magnitudes of a spectrum with the zero frequency at N1 / 2, N2 / 2 (as numpy.fft.fftshift),
+     * normalized. The shift is an index remap, read from the half spectrum for real data.
+     * @param spec  Spectrum, N1 x w
+     * @param w     N2 for a full spectrum, N2 / 2 + 1 for the half spectrum of real data
+     * @param out   Output, N1 x N2
+     */
+    inline void shifted_abs(const std::vector<std::complex<float>> &spec, size_t w, std::vector<float> &out)
+    {
+        const float scale = 1.0f / N;
+        const size_t c1 = N1 / 2;
+        const size_t c2 = N2 / 2;
+        out.resize(N);
+        for (size_t y = 0; y < N1; y++)
+        {
+            size_t ky = (y >= c1) ? y - c1 : y + N1 - c1;
+            // The missing half of a real spectrum is the conjugate of the mirrored frequencies
+            const std::complex<float> *row = &spec[ky * w];
+            const std::complex<float> *row_neg = &spec[((N1 - ky) % N1) * w];
+            float *dst = &out[y * N2];
+            for (size_t x = 0; x < N2; x++)
+            {
+                size_t kx = (x >= c2) ? x - c2 : x + N2 - c2;
+                dst[x] = ((kx < w) ? std::abs(row[kx]) : std::abs(row_neg[N2 - kx])) * scale;
+            }
+        }
+    }
 
 public:
     /**
-     * Setup Fourier transform
+     * Setup Fourier transform, the plans are taken from the FFTPlans cache
      * @param N1       Number of datapoints in first dim.
      * @param N2       Number of datapoints in second dim.
+     * @param flags    Planner flags, FFTW_ESTIMATE for sizes which change too often to measure
      */
-    FFT2D(int N1, int N2) : N1(N1), N2(N2), N(N1 * N2)
+    FFT2D(int N1, int N2, unsigned flags = FFTW_MEASURE) : N1(N1), N2(N2), N(N1 * N2), flags(flags)
     {
-        plan_fw = fftwf_plan_dft_2d(
-            N1, N2, 0, 0, FFTW_FORWARD, FFTW_ESTIMATE);
-        plan_bw = fftwf_plan_dft_2d(
-            N1, N2, 0, 0, FFTW_BACKWARD, FFTW_ESTIMATE);
     }
+
+    /**
+     * Half spectrum of real data, unnormalized
+     * @param in    Input data, N1 x N2
+     * @param out   Output, N1 x (N2 / 2 + 1)
+     */
+    inline void fft_r2c(const std::vector<float> &in, std::vector<std::complex<float>> &out)
+    {
+        out.resize(N1 * (N2 / 2 + 1));
+        bool b_aligned = FFTPlans::aligned(in.data()) && FFTPlans::aligned(out.data());
+        fftwf_execute_dft_r2c(FFTPlans::get(N1, N2, FFTW_FORWARD, false, b_aligned, flags, true),
+                              const_cast<float *>(in.data()),
+                              reinterpret_cast<fftwf_complex *>(out.data()));
+    }
+
+    /**
+     * Real data of a half spectrum, unnormalized
+     * @param in    Input, N1 x (N2 / 2 + 1), overwritten
+     * @param out   Output data, N1 x N2
+     */
+    inline void ifft_c2r(std::vector<std::complex<float>> &in, std::vector<float> &out)
+    {
+        out.resize(N);
+        bool b_aligned = FFTPlans::aligned(in.data()) && FFTPlans::aligned(out.data());
+        fftwf_execute_dft_c2r(FFTPlans::get(N1, N2, FFTW_BACKWARD, false, b_aligned, flags, true),
+                              reinterpret_cast<fftwf_complex *>(in.data()), out.data());
+    }
+
+    /**
+     * Magnitudes of the centered, normalized spectrum of real data, from its half spectrum
+     * @param in    Input data
+     * @param out   Output, zero frequency at N1 / 2, N2 / 2
+     */
+    inline void abs_spectrum(const std::vector<float> &in, std::vector<float> &out)
+    {
+        fft_r2c(in, spectrum);
+        shifted_abs(spectrum, N2 / 2 + 1, out);
+    }
+
+    /**
+     * Magnitudes of the centered, normalized spectrum of complex data
+     * @param in    Input data
+     * @param out   Output, zero frequency at N1 / 2, N2 / 2
+     */
+    inline void abs_spectrum(const std::vector<std::complex<float>> &in, std::vector<float> &out)
+    {
+        spectrum = in;
+        fftwf_execute_dft(plan(FFTW_FORWARD, spectrum),
+                          reinterpret_cast<fftwf_complex *>(spectrum.data()),
+                          reinterpret_cast<fftwf_complex *>(spectrum.data()));
+        shifted_abs(spectrum, N2, out);
+    }
+
     /**
-     * Clean up
+     * Signed frequency of index k of a transform of length n
      */
-    ~FFT2D()
+    static int freq(size_t k, size_t n)
     {
-        fftwf_destroy_plan(plan_fw);
-        fftwf_destroy_plan(plan_bw);
+        return (k <= n / 2) ? static_cast<int>(k) : static_cast<int>(k) - static_cast<int>(n);
     }
 
     /**
@@ -57,7 +261,7 @@ public:
             memcpy(out.data(), in.data(), N * sizeof(std::complex<float>));
         }
         fftshift2D(out);
-        fftwf_execute_dft(plan_fw,
+        fftwf_execute_dft(plan(FFTW_FORWARD, out),
                           reinterpret_cast<fftwf_complex *>(out.data()),
                           reinterpret_cast<fftwf_complex *>(out.data()));
 
@@ -85,7 +289,7 @@ public:
             memcpy(out.data(), in.data(), N * sizeof(std::complex<float>));
         }
         fftshift2D(out);
-        fftwf_execute_dft(plan_bw,
+        fftwf_execute_dft(plan(FFTW_BACKWARD, out),
                           reinterpret_cast<fftwf_complex *>(out.data()),
                           reinterpret_cast<fftwf_complex *>(out.data()));
         ifftshift2D(out);
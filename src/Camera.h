@@ -15,8 +15,10 @@
 #define CAMERA_H
 
 #include <vector>
+#include <string>
 #include <atomic>
 #include <array>
+#include <cstdint>
 #include <stdlib.h>
 
 // Only forward declaration for Ricom class
@@ -28,6 +30,7 @@ namespace CAMERA
     {
         MERLIN,
         TIMEPIX,
+        ARRAY,
         MODELS_COUNT
     };
 
@@ -47,6 +50,8 @@ namespace CAMERA
         bool swap_endian;
         int depth;
         int dwell_time;
+        std::string dtype;  // Element type of array files (numpy style, e.g. "<u2")
+        size_t header_size; // Bytes before the first frame in array files
         std::vector<int> u;
         std::vector<int> v;
         void init_uv_default();
@@ -57,7 +62,9 @@ namespace CAMERA
                         ny_cam(256),
                         swap_endian(true),
                         depth(1),
-                        dwell_time(1000){};
+                        dwell_time(1000),
+                        dtype("<u2"),
+                        header_size(0){};
     };
 
     // primary template
@@ -76,6 +83,9 @@ namespace CAMERA
         void run(Ricom *ricom);
         template <typename T>
         void read_frame(std::vector<T> &data, bool b_first);
+        // Pointer to the next frame, either read into data or in memory held by the interface
+        template <typename T>
+        const T *next_frame(std::vector<T> &data, bool b_first);
     };
 
     // specialization for event based camera
@@ -86,13 +96,13 @@ namespace CAMERA
         Camera();
         explicit Camera(Camera_BASE &cam);
         void run(Ricom *ricom);
-        void read_frame_com(std::atomic<size_t> &idx, std::vector<size_t> &dose_map,
-                            std::vector<size_t> &sumx_map, std::vector<size_t> &sumy_map,
+        void read_frame_com(std::atomic<size_t> &idx, std::vector<uint32_t> &dose_map,
+                            std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
                             std::vector<float> &stem_map, bool b_stem,
                             std::array<float, 2> &offset, std::array<float, 2> &radius,
                             size_t first_frame, size_t end_frame);
-        void read_frame_com_cbed(std::atomic<size_t> &idx, std::vector<size_t> &dose_map,
-                                 std::vector<size_t> &sumx_map, std::vector<size_t> &sumy_map,
+        void read_frame_com_cbed(std::atomic<size_t> &idx, std::vector<uint32_t> &dose_map,
+                                 std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
                                  std::vector<float> &stem_map, bool b_stem,
                                  std::array<float, 2> &offset, std::array<float, 2> &radius,
                                  std::vector<uint16_t> &frame, size_t frame_id,
@@ -0,0 +1,398 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <zstd.h>
+
+#include "ChunkedFile.h"
+
+// Transpose an 8x8 bit matrix (byte i, bit j) -> (byte j, bit i)
+static inline uint64_t transpose8(uint64_t x)
+{
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+// Bit plane p = 8 * byte + bit holds that bit of all elements; bytes after the
+// last complete block of 8 elements are copied unchanged
+void CHUNKED::bitshuffle(const char *in, char *out, size_t size, size_t elem_size)
+{
+    size_t n_blocks = size / (8 * elem_size);
+    for (size_t g = 0; g < n_blocks; g++)
+    {
+        const unsigned char *src = reinterpret_cast<const unsigned char *>(in) + g * 8 * elem_size;
+        for (size_t k = 0; k < elem_size; k++)
+        {
+            uint64_t x = 0;
+            for (size_t j = 0; j < 8; j++)
+            {
+                x |= static_cast<uint64_t>(src[j * elem_size + k]) << (8 * j);
+            }
+            x = transpose8(x);
+            for (size_t b = 0; b < 8; b++)
+            {
+                out[(k * 8 + b) * n_blocks + g] = static_cast<char>(x >> (8 * b));
+            }
+        }
+    }
+    size_t done = n_blocks * 8 * elem_size;
+    memcpy(out + done, in + done, size - done);
+}
+
+void CHUNKED::bitunshuffle(const char *in, char *out, size_t size, size_t elem_size)
+{
+    size_t n_blocks = size / (8 * elem_size);
+    const unsigned char *src = reinterpret_cast<const unsigned char *>(in);
+    for (size_t g = 0; g < n_blocks; g++)
+    {
+        char *dst = out + g * 8 * elem_size;
+        for (size_t k = 0; k < elem_size; k++)
+        {
+            uint64_t x = 0;
+            for (size_t b = 0; b < 8; b++)
+            {
+                x |= static_cast<uint64_t>(src[(k * 8 + b) * n_blocks + g]) << (8 * b);
+            }
+            x = transpose8(x);
+            for (size_t j = 0; j < 8; j++)
+            {
+                dst[j * elem_size + k] = static_cast<char>(x >> (8 * j));
+            }
+        }
+    }
+    size_t done = n_blocks * 8 * elem_size;
+    memcpy(out + done, in + done, size - done);
+}
+
+// ChunkedFileWriter
+bool ChunkedFileWriter::open(const std::filesystem::path &path, size_t frame_size, size_t head_size,
+                             size_t frames_per_chunk, size_t elem_size, int level)
+{
+    if (head_size > frame_size || frames_per_chunk == 0 || elem_size == 0)
+    {
+        std::cout << "ChunkedFileWriter::open(): Invalid frame layout!" << std::endl;
+        return false;
+    }
+    stream.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!stream.is_open())
+    {
+        std::cout << "ChunkedFileWriter::open(): Error opening file " << path << "!" << std::endl;
+        return false;
+    }
+    memcpy(header.magic, CHUNKED::magic, sizeof(header.magic));
+    header.version = CHUNKED::version;
+    header.frame_size = frame_size;
+    header.head_size = head_size;
+    header.n_frames = 0;
+    header.frames_per_chunk = static_cast<uint32_t>(frames_per_chunk);
+    header.elem_size = static_cast<uint32_t>(elem_size);
+    header.n_chunks = 0;
+    header.index_offset = 0;
+    this->level = level;
+    heads.resize(frames_per_chunk * head_size);
+    payload.resize(frames_per_chunk * (frame_size - head_size));
+    raw.resize(frames_per_chunk * frame_size);
+    compressed.resize(ZSTD_compressBound(raw.size()));
+    index.clear();
+    n_in_chunk = 0;
+    // Header is written again with the final values on close()
+    stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    pos = sizeof(header);
+    return true;
+}
+
+void ChunkedFileWriter::write_frame(const char *frame)
+{
+    size_t l_payload = header.frame_size - header.head_size;
+    memcpy(&heads[n_in_chunk * header.head_size], frame, header.head_size);
+    memcpy(&payload[n_in_chunk * l_payload], frame + header.head_size, l_payload);
+    n_in_chunk++;
+    header.n_frames++;
+    if (n_in_chunk == header.frames_per_chunk)
+    {
+        flush_chunk();
+    }
+}
+
+void ChunkedFileWriter::flush_chunk()
+{
+    if (n_in_chunk == 0)
+    {
+        return;
+    }
+    size_t l_heads = n_in_chunk * header.head_size;
+    size_t l_payload = n_in_chunk * (header.frame_size - header.head_size);
+    memcpy(&raw[0], &heads[0], l_heads);
+    CHUNKED::bitshuffle(&payload[0], &raw[l_heads], l_payload, header.elem_size);
+
+    size_t l = ZSTD_compress(&compressed[0], compressed.size(), &raw[0], l_heads + l_payload, level);
+    if (ZSTD_isError(l))
+    {
+        std::cout << "ChunkedFileWriter: Compression failed (" << ZSTD_getErrorName(l) << ")!" << std::endl;
+        l = 0;
+    }
+    stream.write(&compressed[0], l);
+    index.push_back(pos);
+    index.push_back(l);
+    pos += l;
+    header.n_chunks++;
+    n_in_chunk = 0;
+}
+
+bool ChunkedFileWriter::close()
+{
+    if (!stream.is_open())
+    {
+        return false;
+    }
+    flush_chunk();
+    header.index_offset = pos;
+    stream.write(reinterpret_cast<const char *>(&index[0]), index.size() * sizeof(uint64_t));
+    pos += index.size() * sizeof(uint64_t);
+    stream.seekp(0, std::ios::beg);
+    stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    bool b_ok = stream.good();
+    stream.close();
+    return b_ok;
+}
+
+// ChunkedFileReader
+bool ChunkedFileReader::open(const std::filesystem::path &path, int n_threads)
+{
+    close();
+    stream.open(path, std::ios::in | std::ios::binary);
+    if (!stream.is_open())
+    {
+        std::cout << "ChunkedFileReader::open(): Error opening file " << path << "!" << std::endl;
+        return false;
+    }
+    stream.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!stream || memcmp(header.magic, CHUNKED::magic, sizeof(header.magic)) != 0 ||
+        header.version != CHUNKED::version || header.frames_per_chunk == 0 || header.n_chunks == 0)
+    {
+        std::cout << "ChunkedFileReader::open(): " << path << " is not a valid .mibz file!" << std::endl;
+        stream.close();
+        return false;
+    }
+    std::vector<uint64_t> index(2 * header.n_chunks);
+    stream.seekg(header.index_offset, std::ios::beg);
+    stream.read(reinterpret_cast<char *>(&index[0]), index.size() * sizeof(uint64_t));
+    if (!stream)
+    {
+        std::cout << "ChunkedFileReader::open(): Chunk index of " << path << " is incomplete!" << std::endl;
+        stream.close();
+        return false;
+    }
+    offsets.resize(header.n_chunks);
+    sizes.resize(header.n_chunks);
+    for (size_t i = 0; i < header.n_chunks; i++)
+    {
+        offsets[i] = index[2 * i];
+        sizes[i] = index[2 * i + 1];
+    }
+
+    if (n_threads < 1)
+    {
+        n_threads = (std::max)(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    }
+    // Two chunks in flight per thread keep all threads busy while one chunk is read
+    size_t n_slots = (std::min)(static_cast<size_t>(2 * n_threads), static_cast<size_t>(header.n_chunks));
+    slots.resize(n_slots);
+    for (auto &slot : slots)
+    {
+        slot.chunk = UINT64_MAX;
+        slot.b_ready = false;
+    }
+    queue.clear();
+    n_busy = 0;
+    next_chunk = 0;
+    cur_chunk = 0;
+    cur_pos = 0;
+    b_running = true;
+    for (int i = 0; i < n_threads; i++)
+    {
+        workers.push_back(std::thread(&ChunkedFileReader::worker, this));
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    schedule();
+    return true;
+}
+
+void ChunkedFileReader::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        b_running = false;
+    }
+    cnd_work.notify_all();
+    for (auto &w : workers)
+    {
+        w.join();
+    }
+    workers.clear();
+    slots.clear();
+    queue.clear();
+    if (stream.is_open())
+    {
+        stream.close();
+    }
+}
+
+// Assign the chunks ahead of the read position to free slots (mtx must be held)
+void ChunkedFileReader::schedule()
+{
+    while (next_chunk < header.n_chunks && next_chunk < cur_chunk + slots.size())
+    {
+        Slot &slot = slots[next_chunk % slots.size()];
+        // Still holds this chunk from the previous pass (after rewind)
+        if (!(slot.chunk == next_chunk && slot.b_ready))
+        {
+            slot.chunk = next_chunk;
+            slot.b_ready = false;
+            queue.push_back(next_chunk);
+            cnd_work.notify_one();
+        }
+        next_chunk++;
+    }
+}
+
+void ChunkedFileReader::worker()
+{
+    std::vector<char> compressed;
+    std::vector<char> raw;
+    while (true)
+    {
+        uint64_t chunk;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cnd_work.wait(lock, [this]
+                          { return !queue.empty() || !b_running; });
+            if (!b_running)
+            {
+                return;
+            }
+            chunk = queue.front();
+            queue.pop_front();
+            n_busy++;
+        }
+        // The slot belongs to this worker until it is marked ready
+        Slot &slot = slots[chunk % slots.size()];
+        if (!decode_chunk(chunk, slot.data, compressed, raw))
+        {
+            std::fill(slot.data.begin(), slot.data.end(), 0);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            slot.b_ready = true;
+            n_busy--;
+        }
+        cnd_ready.notify_all();
+    }
+}
+
+bool ChunkedFileReader::decode_chunk(uint64_t chunk, std::vector<char> &out, std::vector<char> &compressed, std::vector<char> &raw)
+{
+    size_t n = (std::min)(static_cast<uint64_t>(header.frames_per_chunk), header.n_frames - chunk * header.frames_per_chunk);
+    size_t l_heads = n * header.head_size;
+    size_t l_frame_data = header.frame_size - header.head_size;
+    out.resize(n * header.frame_size);
+    raw.resize(out.size());
+    compressed.resize(sizes[chunk]);
+    {
+        std::lock_guard<std::mutex> lock(mtx_stream);
+        stream.seekg(offsets[chunk], std::ios::beg);
+        stream.read(&compressed[0], compressed.size());
+        if (!stream)
+        {
+            stream.clear();
+            std::cout << "ChunkedFileReader: Error reading chunk " << chunk << "!" << std::endl;
+            return false;
+        }
+    }
+    size_t l = ZSTD_decompress(&raw[0], raw.size(), &compressed[0], compressed.size());
+    if (ZSTD_isError(l) || l != raw.size())
+    {
+        std::cout << "ChunkedFileReader: Chunk " << chunk << " is corrupt!" << std::endl;
+        return false;
+    }
+
+    // Restore the .mib frame sequence: header followed by the pixel data
+    std::vector<char> &payload = compressed;
+    payload.resize(n * l_frame_data);
+    CHUNKED::bitunshuffle(&raw[l_heads], &payload[0], payload.size(), header.elem_size);
+    for (size_t i = 0; i < n; i++)
+    {
+        char *frame = &out[i * header.frame_size];
+        memcpy(frame, &raw[i * header.head_size], header.head_size);
+        memcpy(frame + header.head_size, &payload[i * l_frame_data], l_frame_data);
+    }
+    return true;
+}
+
+void ChunkedFileReader::read(char *buffer, size_t size)
+{
+    while (size > 0)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (cur_chunk >= header.n_chunks)
+        {
+            memset(buffer, 0, size);
+            return;
+        }
+        Slot &slot = slots[cur_chunk % slots.size()];
+        cnd_ready.wait(lock, [this, &slot]
+                       { return slot.b_ready && slot.chunk == cur_chunk; });
+        lock.unlock();
+
+        size_t n = (std::min)(size, slot.data.size() - cur_pos);
+        memcpy(buffer, &slot.data[cur_pos], n);
+        buffer += n;
+        size -= n;
+        cur_pos += n;
+        if (cur_pos == slot.data.size())
+        {
+            lock.lock();
+            cur_chunk++;
+            cur_pos = 0;
+            schedule();
+        }
+    }
+}
+
+// Back to the first frame; waits for chunks in flight, since they own their slots
+void ChunkedFileReader::rewind()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    queue.clear();
+    cnd_ready.wait(lock, [this]
+                   { return n_busy == 0; });
+    for (auto &slot : slots)
+    {
+        if (!slot.b_ready)
+        {
+            slot.chunk = UINT64_MAX;
+        }
+    }
+    next_chunk = 0;
+    cur_chunk = 0;
+    cur_pos = 0;
+    schedule();
+}
@@ -0,0 +1,120 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef CHUNKED_FILE_H
+#define CHUNKED_FILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+// Compressed container for recorded .mib data (.mibz)
+// Layout: Header | chunk 0 | chunk 1 | ... | index (offset and size of each chunk)
+// A chunk holds frames_per_chunk frames (one scan row by default). The frame headers
+// of a chunk are stored first, followed by the bitshuffled pixel data, and the chunk
+// is compressed with zstd. Decompressed, the file reads like the original .mib file.
+namespace CHUNKED
+{
+    const char magic[4] = {'M', 'I', 'B', 'Z'};
+    const uint32_t version = 1;
+
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t frame_size;       // Bytes per frame, including the frame header
+        uint64_t head_size;        // Bytes of the frame header
+        uint64_t n_frames;         // Number of frames in the file
+        uint32_t frames_per_chunk; // Number of frames per chunk
+        uint32_t elem_size;        // Element size of the bitshuffle filter in bytes
+        uint64_t n_chunks;         // Number of chunks
+        uint64_t index_offset;     // Position of the chunk index in the file
+    };
+
+    // Transpose the bits of blocks of 8 elements, so equal bits of neighbouring pixels
+    // end up next to each other (long runs of zeros for sparse data)
+    void bitshuffle(const char *in, char *out, size_t size, size_t elem_size);
+    void bitunshuffle(const char *in, char *out, size_t size, size_t elem_size);
+}
+
+class ChunkedFileWriter
+{
+public:
+    bool open(const std::filesystem::path &path, size_t frame_size, size_t head_size,
+              size_t frames_per_chunk, size_t elem_size, int level = 3);
+    void write_frame(const char *frame);
+    bool close();
+    size_t compressed_size() const { return pos; };
+    ChunkedFileWriter() : header(), stream(), level(3), n_in_chunk(0), pos(0){};
+
+private:
+    CHUNKED::Header header;
+    std::ofstream stream;
+    int level;
+    std::vector<char> heads;    // Frame headers of the current chunk
+    std::vector<char> payload;  // Pixel data of the current chunk
+    std::vector<char> raw;      // Chunk before compression
+    std::vector<char> compressed;
+    std::vector<uint64_t> index;
+    size_t n_in_chunk;
+    size_t pos;
+    void flush_chunk();
+};
+
+// Reads a .mibz file as a stream of .mib bytes. Worker threads decompress the chunks
+// ahead of the read position into a ring of slots.
+class ChunkedFileReader
+{
+public:
+    CHUNKED::Header header;
+    bool open(const std::filesystem::path &path, int n_threads);
+    void close();
+    void read(char *buffer, size_t size);
+    void rewind();
+    uint64_t raw_size() const { return header.n_frames * header.frame_size; };
+    ChunkedFileReader() : header(), b_running(false), n_busy(0), next_chunk(0), cur_chunk(0), cur_pos(0){};
+    ~ChunkedFileReader() { close(); };
+
+private:
+    struct Slot
+    {
+        std::vector<char> data;
+        uint64_t chunk;
+        bool b_ready;
+    };
+    std::ifstream stream;
+    std::mutex mtx_stream;
+    std::vector<uint64_t> offsets;
+    std::vector<uint64_t> sizes;
+    std::vector<Slot> slots;
+    std::deque<uint64_t> queue;
+    std::vector<std::thread> workers;
+    std::mutex mtx;
+    std::condition_variable cnd_work;
+    std::condition_variable cnd_ready;
+    bool b_running;
+    int n_busy;
+    uint64_t next_chunk; // Next chunk to schedule for decompression
+    uint64_t cur_chunk;  // Chunk at the read position
+    size_t cur_pos;      // Read position within the current chunk
+    void worker();
+    void schedule();
+    bool decode_chunk(uint64_t chunk, std::vector<char> &out, std::vector<char> &compressed, std::vector<char> &raw);
+};
+#endif // CHUNKED_FILE_H
@@ -0,0 +1,87 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef DIRTY_TILES_H
+#define DIRTY_TILES_H
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+// Flags for the tiles of an image which changed since they were last taken. Any thread may
+// mark, one thread takes. A tile is only written when its flag is not set yet, so workers
+// updating the same neighbourhood mostly share the cache line for reading.
+class DirtyTiles
+{
+public:
+    static const int tile_size = 32;
+
+    // Only call while no thread uses the tiles
+    void init(int nx, int ny)
+    {
+        this->nx = nx;
+        this->ny = ny;
+        ntx = (nx + tile_size - 1) / tile_size;
+        nty = (ny + tile_size - 1) / tile_size;
+        flags.reset(new std::atomic<bool>[static_cast<size_t>(ntx) * nty]);
+        mark_all();
+    }
+
+    // Marks the tiles overlapping the pixels x0..x1, y0..y1 (clipped to the image)
+    inline void mark(int x0, int y0, int x1, int y1)
+    {
+        int tx0 = (std::max)(x0, 0) / tile_size;
+        int tx1 = (std::min)(x1, nx - 1) / tile_size;
+        int ty0 = (std::max)(y0, 0) / tile_size;
+        int ty1 = (std::min)(y1, ny - 1) / tile_size;
+        for (int ty = ty0; ty <= ty1; ty++)
+        {
+            for (int tx = tx0; tx <= tx1; tx++)
+            {
+                std::atomic<bool> &f = flags[ty * ntx + tx];
+                if (!f.load(std::memory_order_relaxed))
+                {
+                    f.store(true, std::memory_order_release);
+                }
+            }
+        }
+    }
+
+    void mark_all()
+    {
+        for (int i = 0; i < ntx * nty; i++)
+        {
+            flags[i].store(true, std::memory_order_release);
+        }
+    }
+
+    // Clears the flag of a tile, true if it was set
+    inline bool take(int tx, int ty)
+    {
+        std::atomic<bool> &f = flags[ty * ntx + tx];
+        return f.load(std::memory_order_relaxed) && f.exchange(false, std::memory_order_acquire);
+    }
+
+    int tiles_x() { return ntx; };
+    int tiles_y() { return nty; };
+
+    DirtyTiles() : nx(0), ny(0), ntx(0), nty(0), flags(){};
+
+private:
+    int nx;
+    int ny;
+    int ntx;
+    int nty;
+    std::unique_ptr<std::atomic<bool>[]> flags;
+};
+#endif // DIRTY_TILES_H
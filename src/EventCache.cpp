@@ -0,0 +1,200 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+#include "EventCache.h"
+
+static size_t align4(size_t n)
+{
+    return (n + 3) & ~static_cast<size_t>(3);
+}
+
+bool EventCacheWriter::open(const std::string &path, size_t nx, uint32_t dwell_time, uint32_t cam_nx, uint32_t cam_ny, bool b_tot)
+{
+    if (nx == 0 || dwell_time == 0)
+    {
+        std::cout << "EventCacheWriter::open(): Invalid scan layout!" << std::endl;
+        return false;
+    }
+    stream.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!stream.is_open())
+    {
+        std::cout << "EventCacheWriter::open(): Error opening file " << path << "!" << std::endl;
+        return false;
+    }
+    memcpy(header.magic, EVENT_CACHE::magic, sizeof(header.magic));
+    header.version = EVENT_CACHE::version;
+    header.pixel_bytes = (static_cast<uint64_t>(cam_nx) * cam_ny <= 65536) ? 2 : 4;
+    header.b_tot = b_tot;
+    header.dwell_time = dwell_time;
+    header.cam_nx = cam_nx;
+    header.cam_ny = cam_ny;
+    header.nx = nx;
+    header.n_rows = 0;
+    header.n_events = 0;
+    header.index_offset = 0;
+    index.clear();
+    // Header is written again with the final values on close()
+    stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    pos = sizeof(header);
+    return true;
+}
+
+void EventCacheWriter::write_row(std::vector<EVENT_CACHE::Event> &events)
+{
+    std::sort(events.begin(), events.end(), [](const EVENT_CACHE::Event &a, const EVENT_CACHE::Event &b)
+              { return (a.position != b.position) ? a.position < b.position : a.index < b.index; });
+    size_t n = events.size();
+    size_t pixel_bytes = header.pixel_bytes;
+
+    // Event counts per position
+    buffer.assign(8 + header.nx * 5, 0);
+    uint32_t n32 = static_cast<uint32_t>(n);
+    memcpy(&buffer[0], &n32, 4);
+    size_t o = 8;
+    size_t e = 0;
+    for (size_t p = 0; p < header.nx; p++)
+    {
+        uint32_t count = 0;
+        while (e < n && events[e].position == p)
+        {
+            count++;
+            e++;
+        }
+        do
+        {
+            uint8_t b = count & 0x7F;
+            count >>= 7;
+            buffer[o++] = static_cast<char>(b | (count ? 0x80 : 0));
+        } while (count);
+    }
+    o = align4(o);
+    uint32_t o32 = static_cast<uint32_t>(o);
+    memcpy(&buffer[4], &o32, 4);
+
+    // Pixel and ToT columns
+    size_t o_tot = align4(o + n * pixel_bytes);
+    buffer.resize(header.b_tot ? align4(o_tot + n * 2) : o_tot, 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (pixel_bytes == 2)
+        {
+            uint16_t index = static_cast<uint16_t>(events[i].index);
+            memcpy(&buffer[o + i * 2], &index, 2);
+        }
+        else
+        {
+            memcpy(&buffer[o + i * 4], &events[i].index, 4);
+        }
+        if (header.b_tot)
+        {
+            memcpy(&buffer[o_tot + i * 2], &events[i].tot, 2);
+        }
+    }
+    index.push_back(pos);
+    stream.write(&buffer[0], buffer.size());
+    pos += buffer.size();
+    header.n_rows++;
+    header.n_events += n;
+}
+
+bool EventCacheWriter::close()
+{
+    index.push_back(pos);
+    // The index is read in place from the mapping, align it to its element size
+    size_t pad = (8 - pos % 8) % 8;
+    stream.write("\0\0\0\0\0\0\0", pad);
+    pos += pad;
+    header.index_offset = pos;
+    stream.write(reinterpret_cast<const char *>(&index[0]), index.size() * sizeof(uint64_t));
+    pos += index.size() * sizeof(uint64_t);
+    stream.seekp(0, std::ios::beg);
+    stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    bool b_ok = static_cast<bool>(stream);
+    stream.close();
+    return b_ok;
+}
+
+bool EventCacheReader::read_header(const std::string &path, EVENT_CACHE::Header &header)
+{
+    std::ifstream f(path, std::ios::in | std::ios::binary);
+    if (!f.is_open() || !f.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        memcmp(header.magic, EVENT_CACHE::magic, sizeof(header.magic)) != 0)
+    {
+        std::cout << "EventCacheReader: " << path << " is not an event cache!" << std::endl;
+        return false;
+    }
+    if (header.version != EVENT_CACHE::version || (header.pixel_bytes != 2 && header.pixel_bytes != 4) || header.nx == 0)
+    {
+        std::cout << "EventCacheReader: Unsupported version or layout of " << path << "!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool EventCacheReader::open(const std::string &path)
+{
+    close();
+    if (!read_header(path, header))
+    {
+        return false;
+    }
+    if (!map.open(path))
+    {
+        perror("EventCacheReader::open(): Error mapping file");
+        return false;
+    }
+    if (header.index_offset + (header.n_rows + 1) * sizeof(uint64_t) > map.size())
+    {
+        std::cout << "EventCacheReader: " << path << " is truncated!" << std::endl;
+        map.close();
+        return false;
+    }
+    index = reinterpret_cast<const uint64_t *>(map.data() + header.index_offset);
+    prefetch_row(0);
+    return true;
+}
+
+bool EventCacheReader::row(size_t r, Row &row)
+{
+    if (r >= header.n_rows)
+    {
+        return false;
+    }
+    const char *p = map.data() + index[r];
+    uint32_t n, o;
+    memcpy(&n, p, 4);
+    memcpy(&o, p + 4, 4);
+    row.n_events = n;
+    row.counts = reinterpret_cast<const uint8_t *>(p + 8);
+    row.pixels = p + o;
+    row.tot = header.b_tot ? reinterpret_cast<const uint16_t *>(p + align4(o + n * header.pixel_bytes)) : nullptr;
+    return true;
+}
+
+void EventCacheReader::prefetch_row(size_t r)
+{
+    if (r < header.n_rows)
+    {
+        map.prefetch(index[r], index[r + 1] - index[r]);
+    }
+}
+
+void EventCacheReader::close()
+{
+    map.close();
+    index = nullptr;
+}
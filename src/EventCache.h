@@ -0,0 +1,120 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef EVENT_CACHE_H
+#define EVENT_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "MappedFile.h"
+
+// Compact columnar cache of Timepix events (.t3c), for a fixed dwell time
+// Layout: Header | row 0 | row 1 | ... | index (offset of each row, and the end of the last one)
+// A row holds the events of one scan row, sorted by probe position and pixel index:
+//   uint32 n_events | uint32 offset of the pixel column | varint event count per position |
+//   pixel indices | ToT (optional)
+// The pixel indices are uint16 for detectors up to 65536 pixels, else uint32. The columns
+// start at 4 byte boundaries. The ToA is only kept as the probe position.
+namespace EVENT_CACHE
+{
+    const char magic[8] = {'R', 'I', 'C', 'O', 'M', 'T', '3', 'C'};
+    const uint32_t version = 1;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t pixel_bytes;  // Bytes per pixel index, 2 or 4
+        uint32_t b_tot;        // ToT column present
+        uint32_t dwell_time;   // Dwell time of the probe positions [ns]
+        uint32_t cam_nx;       // Detector size
+        uint32_t cam_ny;
+        uint64_t nx;           // Probe positions per row
+        uint64_t n_rows;       // Number of rows in the file
+        uint64_t n_events;     // Number of events in the file
+        uint64_t index_offset; // Position of the row index in the file
+    };
+
+    struct Event
+    {
+        uint32_t position; // Probe position within the row
+        uint32_t index;    // Pixel index
+        uint16_t tot;
+    };
+
+    // Event count of a position, LEB128 coded (one byte below 128 events)
+    inline uint32_t read_count(const uint8_t *&p)
+    {
+        uint32_t n = *p++;
+        if (n & 0x80)
+        {
+            n &= 0x7F;
+            int shift = 7;
+            uint8_t b;
+            do
+            {
+                b = *p++;
+                n |= static_cast<uint32_t>(b & 0x7F) << shift;
+                shift += 7;
+            } while (b & 0x80);
+        }
+        return n;
+    }
+}
+
+class EventCacheWriter
+{
+public:
+    bool open(const std::string &path, size_t nx, uint32_t dwell_time, uint32_t cam_nx, uint32_t cam_ny, bool b_tot);
+    void write_row(std::vector<EVENT_CACHE::Event> &events); // Sorts events
+    bool close();
+    size_t size() const { return pos; };
+    EventCacheWriter() : header(), stream(), index(), buffer(), pos(0){};
+
+private:
+    EVENT_CACHE::Header header;
+    std::ofstream stream;
+    std::vector<uint64_t> index;
+    std::vector<char> buffer;
+    size_t pos;
+};
+
+// Mapped .t3c file, the rows are accessed in place
+class EventCacheReader
+{
+public:
+    struct Row
+    {
+        const uint8_t *counts; // Varint event count per position
+        const char *pixels;    // Pixel indices of pixel_bytes each
+        const uint16_t *tot;   // nullptr without ToT column
+        size_t n_events;
+    };
+    EVENT_CACHE::Header header;
+
+    static bool read_header(const std::string &path, EVENT_CACHE::Header &header);
+    bool open(const std::string &path);
+    bool row(size_t r, Row &row);
+    void prefetch_row(size_t r);
+    bool is_open() { return map.is_open(); };
+    void close();
+    EventCacheReader() : header(), map(), index(nullptr){};
+
+private:
+    MappedFile map;
+    const uint64_t *index;
+};
+#endif // EVENT_CACHE_H
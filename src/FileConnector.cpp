@@ -11,12 +11,75 @@
  *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
  */
 
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#include <cstring>
+#include <algorithm>
+
 #include "FileConnector.h"
 
+// Pipes are read in large blocks, frames are served from the buffer
+static const size_t pipe_buffer_size = 4 << 20;
+
+// stdin, named pipes and shared memory rings have no size and cannot be rewound
+bool FileConnector::is_stream(const std::string &path)
+{
+    if (path == "-" || path.rfind("shm:", 0) == 0)
+    {
+        return true;
+    }
+    std::error_code ec;
+    return std::filesystem::is_fifo(path, ec);
+}
+
 void FileConnector::open_file()
 {
     if (!path.empty())
     {
+        b_eof = false;
+        buf_pos = 0;
+        buf_end = 0;
+        pos = 0;
+        std::string p = path.string();
+        if (p.rfind("shm:", 0) == 0)
+        {
+            source = SOURCE_SHM;
+            if (ring.open(p.substr(4), 60000, scan_frames))
+            {
+                stream_buffer.resize(ring.slot_size());
+            }
+            else
+            {
+                b_eof = true;
+            }
+            file_size = (std::numeric_limits<std::uintmax_t>::max)();
+            return;
+        }
+        if (is_stream(p))
+        {
+            source = SOURCE_PIPE;
+            open_pipe();
+            file_size = (std::numeric_limits<std::uintmax_t>::max)();
+            return;
+        }
+        // Compressed container, read as the decompressed .mib byte stream
+        if (path.extension() == ".mibz")
+        {
+            source = SOURCE_CHUNKED;
+            if (chunked.open(path, n_threads))
+            {
+                file_size = chunked.raw_size();
+            }
+            return;
+        }
+        source = SOURCE_FILE;
         file_size = std::filesystem::file_size(path);
         stream.open(path, std::ios::in | std::ios::binary);
         if (stream.is_open())
@@ -34,31 +97,174 @@ void FileConnector::open_file()
     }
 }
 
+void FileConnector::open_pipe()
+{
+    if (path.string() == "-")
+    {
+#ifdef _WIN32
+        fd = _fileno(stdin);
+        _setmode(fd, _O_BINARY);
+#else
+        fd = STDIN_FILENO;
+#endif
+    }
+    else
+    {
+#ifdef _WIN32
+        fd = _open(path.string().c_str(), _O_RDONLY | _O_BINARY);
+#else
+        fd = open(path.c_str(), O_RDONLY);
+#endif
+    }
+    if (fd < 0)
+    {
+        perror("FileConnector::open_pipe(): Error opening pipe");
+        b_eof = true;
+        return;
+    }
+#ifdef F_SETPIPE_SZ
+    // A larger pipe lets the writer run ahead in bigger blocks (fails silently for regular stdin)
+    fcntl(fd, F_SETPIPE_SZ, 1 << 20);
+#endif
+    stream_buffer.resize(pipe_buffer_size);
+}
+
 void FileConnector::close_file()
 {
+    switch (source)
+    {
+    case SOURCE_CHUNKED:
+        chunked.close();
+        break;
+    case SOURCE_SHM:
+        ring.close();
+        break;
+    case SOURCE_PIPE:
+        if (fd >= 0 && path.string() != "-")
+        {
+#ifdef _WIN32
+            _close(fd);
+#else
+            close(fd);
+#endif
+        }
+        fd = -1;
+        break;
+    default:
+        break;
+    }
     if (stream.is_open())
     {
         stream.close();
     }
 }
 
-// Reading data stream from File
-void FileConnector::read_data(char *buffer, size_t data_size)
+// Reading data stream from File, returns the bytes read. Only streams end, after the last byte
+// the rest of the buffer is zeroed and fewer bytes are returned.
+size_t FileConnector::read_data(char *buffer, size_t data_size)
 {
-    stream.read(buffer, data_size);
+    switch (source)
+    {
+    case SOURCE_PIPE:
+    case SOURCE_SHM:
+        return read_stream(buffer, data_size);
+    case SOURCE_CHUNKED:
+        chunked.read(buffer, data_size);
+        break;
+    default:
+        stream.read(buffer, data_size);
+        break;
+    }
     pos += data_size;
     // Reset file to the beginning for repeat reading
     if (file_size - pos < data_size)
     {
         reset_file();
     }
+    return data_size;
 };
 
+// Read up to size bytes, blocks until data is available, 0 at the end of the stream
+size_t FileConnector::read_pipe(char *buffer, size_t size)
+{
+    while (true)
+    {
+#ifdef _WIN32
+        int n = _read(fd, buffer, static_cast<unsigned int>((std::min)(size, static_cast<size_t>(1 << 30))));
+#else
+        ssize_t n = read(fd, buffer, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+#endif
+        if (n < 0)
+        {
+            perror("FileConnector::read_pipe(): Error reading pipe");
+            return 0;
+        }
+        return static_cast<size_t>(n);
+    }
+}
+
+size_t FileConnector::read_stream(char *buffer, size_t data_size)
+{
+    size_t n_read = 0;
+    while (data_size > 0)
+    {
+        if (buf_pos == buf_end)
+        {
+            if (b_eof)
+            {
+                // Nothing more will arrive, frame based readers get empty frames
+                memset(buffer, 0, data_size);
+                return n_read;
+            }
+            size_t n;
+            if (source == SOURCE_PIPE && data_size >= stream_buffer.size() / 2)
+            {
+                // Large requests go directly into the destination
+                n = read_pipe(buffer, data_size);
+                buffer += n;
+                data_size -= n;
+                n_read += n;
+            }
+            else
+            {
+                n = (source == SOURCE_PIPE) ? read_pipe(&stream_buffer[0], stream_buffer.size())
+                                            : ring.read_frame(&stream_buffer[0]);
+                buf_pos = 0;
+                buf_end = n;
+            }
+            if (n == 0)
+            {
+                std::cout << "FileConnector: End of stream " << path << std::endl;
+                b_eof = true;
+            }
+            continue;
+        }
+        size_t n = (std::min)(data_size, buf_end - buf_pos);
+        memcpy(buffer, &stream_buffer[buf_pos], n);
+        buf_pos += n;
+        buffer += n;
+        data_size -= n;
+        n_read += n;
+    }
+    return n_read;
+}
+
 void FileConnector::reset_file()
 {
     pos = 0;
+    if (source == SOURCE_CHUNKED)
+    {
+        chunked.rewind();
+        return;
+    }
     stream.clear();
     stream.seekg(0, std::ios::beg);
 }
 
-FileConnector::FileConnector(): path(), stream(), file_size(0), pos(0) {};
\ No newline at end of file
+FileConnector::FileConnector() : path(), n_threads(0), scan_frames(0), source(SOURCE_FILE), stream(), chunked(), ring(),
+                                 fd(-1), stream_buffer(), buf_pos(0), buf_end(0), b_eof(false),
+                                 file_size(0), pos(0){};
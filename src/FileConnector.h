@@ -20,19 +20,49 @@
 #include <fstream>
 #include <filesystem>
 
+#include <vector>
+
+#include "ChunkedFile.h"
+#include "SharedRing.h"
+
+// Sequential reader for recorded data. Besides regular files it reads from stdin
+// ("-"), named pipes and shared memory rings ("shm:<name>"), which are consumed
+// once instead of being repeated.
 class FileConnector
 {
 public:
     std::filesystem::path path;
+    int n_threads;      // Decompression threads for .mibz files (0: all cores)
+    size_t scan_frames; // Frames per scan, shared memory rings are read from the start of one
     void open_file();
     void close_file();
-    void read_data(char *buffer, size_t data_size);
+    size_t read_data(char *buffer, size_t data_size);
+    static bool is_stream(const std::string &path);
     FileConnector();
 
 private:
+    enum Source
+    {
+        SOURCE_FILE,
+        SOURCE_CHUNKED,
+        SOURCE_PIPE,
+        SOURCE_SHM
+    };
+
+    Source source;
     std::ifstream stream;
+    ChunkedFileReader chunked;
+    SharedRing ring;
+    int fd;                          // Pipe file descriptor
+    std::vector<char> stream_buffer; // Pipe data or current shared memory frame
+    size_t buf_pos;
+    size_t buf_end;
+    bool b_eof;
     std::uintmax_t file_size;
     std::uintmax_t pos;
     void reset_file();
+    void open_pipe();
+    size_t read_stream(char *buffer, size_t data_size);
+    size_t read_pipe(char *buffer, size_t size);
 };
 #endif // FILE_CONNECTOR_H
\ No newline at end of file
@@ -0,0 +1,217 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <iostream>
+#include <algorithm>
+
+#include "GlTexture.h"
+
+// Pixel buffers shared by all textures, only used from the thread owning the GL context
+struct PixelRing
+{
+    enum modes
+    {
+        DIRECT,    // glTexSubImage2D from the surface
+        ORPHAN,    // One buffer, reallocated and mapped for each segment
+        PERSISTENT // Mapped once, segments are reused once the fence of their last upload passed
+    };
+    static const int n_segments = 3;
+    static const size_t segment_size = 8 << 20;
+    modes mode = DIRECT;
+    GLuint buffer = 0;
+    Uint8 *mapped = nullptr;
+    GLsync fences[n_segments] = {};
+    int segment = 0;
+
+    // Functions beyond GL 1.1 have to be loaded at runtime on some platforms
+    PFNGLGENBUFFERSPROC GenBuffers = nullptr;
+    PFNGLDELETEBUFFERSPROC DeleteBuffers = nullptr;
+    PFNGLBINDBUFFERPROC BindBuffer = nullptr;
+    PFNGLBUFFERDATAPROC BufferData = nullptr;
+    PFNGLBUFFERSTORAGEPROC BufferStorage = nullptr;
+    PFNGLMAPBUFFERRANGEPROC MapBufferRange = nullptr;
+    PFNGLUNMAPBUFFERPROC UnmapBuffer = nullptr;
+    PFNGLFENCESYNCPROC FenceSync = nullptr;
+    PFNGLCLIENTWAITSYNCPROC ClientWaitSync = nullptr;
+    PFNGLDELETESYNCPROC DeleteSync = nullptr;
+};
+static PixelRing ring;
+
+template <typename T>
+static bool load_gl(T &fn, const char *name)
+{
+    fn = reinterpret_cast<T>(SDL_GL_GetProcAddress(name));
+    return fn != nullptr;
+}
+
+void GlTexture::init_gl()
+{
+    const char *gl_version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+    int major = 0;
+    int minor = 0;
+    bool b_es = false;
+    if (gl_version != nullptr)
+    {
+        b_es = strstr(gl_version, "OpenGL ES") != nullptr;
+        const char *v = gl_version;
+        while (*v != '\0' && !isdigit(static_cast<unsigned char>(*v)))
+        {
+            v++;
+        }
+        sscanf(v, "%d.%d", &major, &minor);
+    }
+    int version = major * 10 + minor;
+
+    // Pixel buffers and mapped ranges are core in GL 3.0 and GL ES 3.0
+    bool b_buffers = load_gl(ring.GenBuffers, "glGenBuffers") &&
+                     load_gl(ring.DeleteBuffers, "glDeleteBuffers") &&
+                     load_gl(ring.BindBuffer, "glBindBuffer") &&
+                     load_gl(ring.BufferData, "glBufferData") &&
+                     load_gl(ring.MapBufferRange, "glMapBufferRange") &&
+                     load_gl(ring.UnmapBuffer, "glUnmapBuffer") &&
+                     (version >= 30 || SDL_GL_ExtensionSupported("GL_ARB_map_buffer_range"));
+    bool b_sync = load_gl(ring.FenceSync, "glFenceSync") &&
+                  load_gl(ring.ClientWaitSync, "glClientWaitSync") &&
+                  load_gl(ring.DeleteSync, "glDeleteSync") &&
+                  ((b_es ? version >= 30 : version >= 32) || SDL_GL_ExtensionSupported("GL_ARB_sync"));
+    bool b_storage = (load_gl(ring.BufferStorage, "glBufferStorage") ||
+                      load_gl(ring.BufferStorage, "glBufferStorageEXT")) &&
+                     ((!b_es && version >= 44) || SDL_GL_ExtensionSupported("GL_ARB_buffer_storage") ||
+                      SDL_GL_ExtensionSupported("GL_EXT_buffer_storage"));
+    if (!b_buffers)
+    {
+        ring.mode = PixelRing::DIRECT;
+        return;
+    }
+
+    size_t size = PixelRing::n_segments * PixelRing::segment_size;
+    ring.GenBuffers(1, &ring.buffer);
+    ring.BindBuffer(GL_PIXEL_UNPACK_BUFFER, ring.buffer);
+    if (b_sync && b_storage)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        ring.BufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+        ring.mapped = static_cast<Uint8 *>(ring.MapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+        if (ring.mapped != nullptr)
+        {
+            ring.mode = PixelRing::PERSISTENT;
+            ring.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return;
+        }
+        // The storage of the buffer is immutable, start over with a new one
+        ring.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        ring.DeleteBuffers(1, &ring.buffer);
+        ring.GenBuffers(1, &ring.buffer);
+        ring.BindBuffer(GL_PIXEL_UNPACK_BUFFER, ring.buffer);
+    }
+    ring.BufferData(GL_PIXEL_UNPACK_BUFFER, PixelRing::segment_size, nullptr, GL_STREAM_DRAW);
+    ring.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    ring.mode = PixelRing::ORPHAN;
+}
+
+void GlTexture::upload(GLuint tex_id, SDL_Surface *srf)
+{
+    upload(tex_id, srf, 0, (srf != nullptr) ? srf->h : 0);
+}
+
+void GlTexture::upload(GLuint tex_id, SDL_Surface *srf, int y0, int y1)
+{
+    if (srf == nullptr)
+    {
+        return;
+    }
+    bool b_alloc = tex_id != this->tex_id || srf->w != w || srf->h != h;
+    y0 = (std::max)(y0, 0);
+    y1 = (std::min)(y1, srf->h);
+    if (!b_alloc && y0 >= y1)
+    {
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, tex_id);
+    if (b_alloc)
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, srf->w, srf->h, 0, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+        this->tex_id = tex_id;
+        w = srf->w;
+        h = srf->h;
+        y0 = 0;
+        y1 = h;
+    }
+
+    const Uint8 *pixels = static_cast<const Uint8 *>(srf->pixels);
+    size_t row = static_cast<size_t>(w) * 4;
+    if (ring.mode == PixelRing::DIRECT || row > PixelRing::segment_size)
+    {
+        // Rows of SDL surfaces with 32 bits per pixel are not padded
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y0, w, y1 - y0, GL_BGRA, GL_UNSIGNED_BYTE, pixels + static_cast<size_t>(y0) * srf->pitch);
+        return;
+    }
+
+    int seg_rows = static_cast<int>(PixelRing::segment_size / row);
+    ring.BindBuffer(GL_PIXEL_UNPACK_BUFFER, ring.buffer);
+    for (int y = y0; y < y1; y += seg_rows)
+    {
+        int n = (std::min)(seg_rows, y1 - y);
+        size_t offset = 0;
+        Uint8 *dst = nullptr;
+        if (ring.mode == PixelRing::PERSISTENT)
+        {
+            // The segment may still be read by an earlier upload
+            GLsync &fence = ring.fences[ring.segment];
+            if (fence != nullptr)
+            {
+                while (ring.ClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+                {
+                }
+                ring.DeleteSync(fence);
+                fence = nullptr;
+            }
+            offset = ring.segment * PixelRing::segment_size;
+            dst = ring.mapped + offset;
+        }
+        else
+        {
+            // Orphaning hands the old storage to the driver instead of waiting for it
+            ring.BufferData(GL_PIXEL_UNPACK_BUFFER, PixelRing::segment_size, nullptr, GL_STREAM_DRAW);
+            dst = static_cast<Uint8 *>(ring.MapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, n * row,
+                                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+            if (dst == nullptr)
+            {
+                std::cout << "Pixel buffer could not be mapped, uploading textures directly." << std::endl;
+                ring.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                ring.mode = PixelRing::DIRECT;
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, w, y1 - y, GL_BGRA, GL_UNSIGNED_BYTE, pixels + static_cast<size_t>(y) * srf->pitch);
+                return;
+            }
+        }
+        for (int i = 0; i < n; i++)
+        {
+            memcpy(dst + i * row, pixels + static_cast<size_t>(y + i) * srf->pitch, row);
+        }
+        if (ring.mode == PixelRing::ORPHAN)
+        {
+            ring.UnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, w, n, GL_BGRA, GL_UNSIGNED_BYTE, reinterpret_cast<const void *>(offset));
+        if (ring.mode == PixelRing::PERSISTENT)
+        {
+            ring.fences[ring.segment] = ring.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            ring.segment = (ring.segment + 1) % PixelRing::n_segments;
+        }
+    }
+    ring.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
@@ -0,0 +1,39 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef GL_TEXTURE_H
+#define GL_TEXTURE_H
+
+#include <SDL.h>
+#include <SDL_opengl.h>
+
+// Texture showing a 32 bit SDL surface. It is only reallocated when the size of the surface
+// changes, redraws upload the changed rows with glTexSubImage2D. Rows are staged through a ring
+// of pixel buffers, persistently mapped if the driver supports it, otherwise orphaned for each
+// upload; without pixel buffers (GL ES 2) they are uploaded from the surface directly.
+class GlTexture
+{
+public:
+    // Selects the staging for all textures, call once the GL context is current
+    static void init_gl();
+    // Uploads the rows y0 to y1-1, the complete surface if the texture has to be (re)allocated
+    void upload(GLuint tex_id, SDL_Surface *srf, int y0, int y1);
+    void upload(GLuint tex_id, SDL_Surface *srf);
+    GlTexture() : tex_id(0), w(0), h(0){};
+
+private:
+    GLuint tex_id; // Texture the storage was allocated for
+    int w;
+    int h;
+};
+#endif // GL_TEXTURE_H
@@ -11,6 +11,9 @@
  *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
  */
 
+#include <mutex>
+#include <algorithm>
+
 #include "GuiUtils.h"
 
 template <typename T>
@@ -109,4 +112,338 @@ namespace SDL_Utils
         Uint32 *const target_pixel = (Uint32 *)((Uint8 *)surface->pixels + y * surface->pitch + x * surface->format->BytesPerPixel);
         *target_pixel = px;
     }
-}
\ No newline at end of file
+
+    // Colormaps as 0x00RRGGBB at lut_size levels, computed once for each type
+    static const Uint32 *colormap_table(int color_map)
+    {
+        static const int n_maps = 13;
+        static std::once_flag built[n_maps];
+        static std::vector<Uint32> tables[n_maps];
+        color_map = (std::min)((std::max)(color_map, 0), n_maps - 1);
+        std::call_once(built[color_map], [color_map]
+                       {
+                           std::vector<Uint32> &table = tables[color_map];
+                           table.resize(Colormap_lut::lut_size);
+                           for (int i = 0; i < Colormap_lut::lut_size; i++)
+                           {
+                               tinycolormap::Color c = tinycolormap::GetColor(static_cast<double>(i) / (Colormap_lut::lut_size - 1),
+                                                                              tinycolormap::ColormapType(color_map));
+                               table[i] = (Uint32(c.ri()) << 16) | (Uint32(c.gi()) << 8) | Uint32(c.bi());
+                           } });
+        return tables[color_map].data();
+    }
+
+    void Colormap_lut::set(int color_map, float power)
+    {
+        this->color_map = color_map;
+        rgb = colormap_table(color_map);
+        if (power == this->power)
+        {
+            return;
+        }
+        // The power maps finely scaled values to the levels of the colormap
+        this->power = power;
+        power_table.resize(power_levels);
+        for (int i = 0; i < power_levels; i++)
+        {
+            float p = std::pow(static_cast<float>(i) / (power_levels - 1), power);
+            power_table[i] = static_cast<uint16_t>(p * (lut_size - 1) + 0.5f);
+        }
+    }
+
+    // The tables hold the layout of the 32 bit surfaces created with SDL_CreateRGBSurface(0, ...)
+    static inline bool native_format(const SDL_PixelFormat *format)
+    {
+        return format->Rmask == 0x00FF0000 && format->Gmask == 0x0000FF00 && format->Bmask == 0x000000FF;
+    }
+
+    static void convert_row(const SDL_PixelFormat *format, Uint32 *px, int n)
+    {
+        if (native_format(format))
+        {
+            for (int x = 0; x < n; x++)
+            {
+                px[x] |= format->Amask;
+            }
+            return;
+        }
+        for (int x = 0; x < n; x++)
+        {
+            px[x] = SDL_MapRGB(format, (px[x] >> 16) & 0xFF, (px[x] >> 8) & 0xFF, px[x] & 0xFF);
+        }
+    }
+
+    // atan2 to about 1e-5 rad, far below one level of the table, written without branches to vectorize
+    static inline float atan2_approx(float y, float x)
+    {
+        float ax = std::fabs(x);
+        float ay = std::fabs(y);
+        float mx = (std::max)(ax, ay);
+        float a = (std::min)(ax, ay) / (mx > 0.0f ? mx : 1.0f);
+        float s = a * a;
+        float r = ((-0.0464964749f * s + 0.15931422f) * s - 0.327622764f) * s * a + a;
+        r = (ay > ax) ? 1.57079637f - r : r;
+        r = (x < 0.0f) ? 3.14159274f - r : r;
+        return (y < 0.0f) ? -r : r;
+    }
+
+    // Rows are colorized in chunks: values are scaled to table indices in loops which vectorize,
+    // then the colors are gathered from the tables
+    static const int chunk = 256;
+
+    void Colormap_lut::draw_row(SDL_Surface *surface, int y, const float *val, int n, float v_min, float v_range)
+    {
+        Uint32 *px = reinterpret_cast<Uint32 *>(static_cast<Uint8 *>(surface->pixels) + y * surface->pitch);
+        const Uint32 *lut = rgb;
+        const uint16_t *pt = power_table.data();
+        const bool b_power = power != 1.0f;
+        const float top = b_power ? power_levels - 1 : lut_size - 1;
+        const float scale = (v_range > 0.0f) ? top / v_range : 0.0f;
+        int32_t id[chunk];
+        for (int x0 = 0; x0 < n; x0 += chunk)
+        {
+            int nc = (std::min)(chunk, n - x0);
+            for (int x = 0; x < nc; x++)
+            {
+                float v = (std::min)((std::max)((val[x0 + x] - v_min) * scale, 0.0f), top);
+                id[x] = static_cast<int32_t>(v + 0.5f);
+            }
+            if (b_power)
+            {
+                for (int x = 0; x < nc; x++)
+                {
+                    px[x0 + x] = lut[pt[id[x]]];
+                }
+            }
+            else
+            {
+                for (int x = 0; x < nc; x++)
+                {
+                    px[x0 + x] = lut[id[x]];
+                }
+            }
+        }
+        convert_row(surface->format, px, n);
+    }
+
+    // Complex values: the angle selects the color, the scaled magnitude its brightness
+    void Colormap_lut::draw_row(SDL_Surface *surface, int y, const std::complex<float> *val, int n, float mag_min, float mag_range)
+    {
+        Uint32 *px = reinterpret_cast<Uint32 *>(static_cast<Uint8 *>(surface->pixels) + y * surface->pitch);
+        const float *re_im = reinterpret_cast<const float *>(val);
+        const Uint32 *lut = rgb;
+        const uint16_t *pt = power_table.data();
+        const bool b_power = power != 1.0f;
+        const float top = b_power ? power_levels - 1 : lut_size - 1;
+        const float scale = (mag_range > 0.0f) ? top / mag_range : 0.0f;
+        const float pi = 3.14159265f;
+        const float scale_ang = (lut_size - 1) / (2.0f * pi);
+        int32_t id_mag[chunk];
+        int32_t id_ang[chunk];
+        for (int x0 = 0; x0 < n; x0 += chunk)
+        {
+            int nc = (std::min)(chunk, n - x0);
+            for (int x = 0; x < nc; x++)
+            {
+                float re = re_im[2 * (x0 + x)];
+                float im = re_im[2 * (x0 + x) + 1];
+                float mag = (std::min)((std::max)((std::sqrt(re * re + im * im) - mag_min) * scale, 0.0f), top);
+                id_mag[x] = static_cast<int32_t>(mag + 0.5f);
+                float ang = (std::min)((std::max)((atan2_approx(im, re) + pi) * scale_ang, 0.0f), lut_size - 1.0f);
+                id_ang[x] = static_cast<int32_t>(ang + 0.5f);
+            }
+            if (b_power)
+            {
+                for (int x = 0; x < nc; x++)
+                {
+                    id_mag[x] = pt[id_mag[x]];
+                }
+            }
+            for (int x = 0; x < nc; x++)
+            {
+                // Brightness 0..256 from the level of the magnitude
+                Uint32 c = lut[id_ang[x]];
+                Uint32 g = static_cast<Uint32>(id_mag[x] * 256 + (lut_size - 1) / 2) / (lut_size - 1);
+                px[x0 + x] = ((((c >> 16) & 0xFF) * g >> 8) << 16) |
+                             ((((c >> 8) & 0xFF) * g >> 8) << 8) |
+                             ((c & 0xFF) * g >> 8);
+            }
+        }
+        convert_row(surface->format, px, n);
+    }
+
+    void Level_image::init(int nx, int ny, bool b_complex)
+    {
+        this->nx = nx;
+        this->ny = ny;
+        this->b_complex = b_complex;
+        level.assign(static_cast<size_t>(nx) * ny, 0);
+        hue.assign(b_complex ? static_cast<size_t>(nx) * ny : 0, 0);
+        ref_range = 0.0f;
+        b_requantize = true;
+    }
+
+    bool Level_image::set(int color_map, float power, float v_min, float v_range)
+    {
+        bool b_changed = b_requantize;
+        if (color_map != this->color_map)
+        {
+            this->color_map = color_map;
+            rgb = colormap_table(color_map);
+            b_changed = true;
+        }
+        if (power != this->power || v_min != this->v_min || v_range != this->v_range)
+        {
+            this->power = power;
+            this->v_min = v_min;
+            this->v_range = v_range;
+            b_changed = true;
+        }
+        // A new reference with headroom on both sides, once the range leaves it or the levels
+        // get too coarse for it
+        if (ref_range <= 0.0f || v_min < ref_min || v_min + v_range > ref_min + ref_range ||
+            (v_range > 0.0f && v_range * 8.0f < ref_range))
+        {
+            float r = (v_range > 0.0f) ? v_range : 1.0f;
+            ref_min = v_min - r / 2;
+            ref_range = 2 * r;
+            b_requantize = true;
+            b_changed = true;
+        }
+        if (b_changed)
+        {
+            build_table();
+        }
+        return b_changed;
+    }
+
+    void Level_image::build_table()
+    {
+        const int top = Colormap_lut::lut_size - 1;
+        const float dv = ref_range / (n_levels - 1);
+        const float scale = (v_range > 0.0f) ? 1.0f / v_range : 0.0f;
+        for (int i = 0; i < n_levels; i++)
+        {
+            float s = (std::min)((std::max)((ref_min + i * dv - v_min) * scale, 0.0f), 1.0f);
+            if (power != 1.0f)
+            {
+                s = std::pow(s, power);
+            }
+            int id = static_cast<int>(s * top + 0.5f);
+            // Complex values keep the brightness 0..256, the color comes from the angle
+            table[i] = b_complex ? static_cast<Uint32>(id * 256 + top / 2) / top : rgb[id];
+        }
+    }
+
+    void Level_image::draw(SDL_Surface *surface, const float *data, int x0, int y0, int x1, int y1)
+    {
+        const float top = n_levels - 1;
+        const float scale = (ref_range > 0.0f) ? top / ref_range : 0.0f;
+        const Uint32 *tb = table.data();
+        const bool b_native = native_format(surface->format);
+        const Uint32 alpha = b_native ? surface->format->Amask : 0;
+        for (int y = y0; y < y1; y++)
+        {
+            const float *val = data + static_cast<size_t>(y) * nx;
+            uint16_t *lv = level.data() + static_cast<size_t>(y) * nx;
+            Uint32 *px = reinterpret_cast<Uint32 *>(static_cast<Uint8 *>(surface->pixels) + y * surface->pitch);
+            for (int x = x0; x < x1; x++)
+            {
+                float v = (std::min)((std::max)((val[x] - ref_min) * scale, 0.0f), top);
+                lv[x] = static_cast<uint16_t>(static_cast<int32_t>(v + 0.5f));
+            }
+            for (int x = x0; x < x1; x++)
+            {
+                px[x] = tb[lv[x]] | alpha;
+            }
+            if (!b_native)
+            {
+                convert_row(surface->format, px + x0, x1 - x0);
+            }
+        }
+        if (x0 == 0 && y0 == 0 && x1 == nx && y1 == ny)
+        {
+            b_requantize = false;
+        }
+    }
+
+    void Level_image::draw(SDL_Surface *surface, const std::complex<float> *data, int x0, int y0, int x1, int y1)
+    {
+        const float top = n_levels - 1;
+        const float scale = (ref_range > 0.0f) ? top / ref_range : 0.0f;
+        const float pi = 3.14159265f;
+        const float scale_ang = (Colormap_lut::lut_size - 1) / (2.0f * pi);
+        for (int y = y0; y < y1; y++)
+        {
+            const float *re_im = reinterpret_cast<const float *>(data + static_cast<size_t>(y) * nx);
+            uint16_t *lv = level.data() + static_cast<size_t>(y) * nx;
+            uint16_t *hu = hue.data() + static_cast<size_t>(y) * nx;
+            for (int x = x0; x < x1; x++)
+            {
+                float re = re_im[2 * x];
+                float im = re_im[2 * x + 1];
+                float mag = (std::min)((std::max)((std::sqrt(re * re + im * im) - ref_min) * scale, 0.0f), top);
+                lv[x] = static_cast<uint16_t>(static_cast<int32_t>(mag + 0.5f));
+                float ang = (std::min)((std::max)((atan2_approx(im, re) + pi) * scale_ang, 0.0f), Colormap_lut::lut_size - 1.0f);
+                hu[x] = static_cast<uint16_t>(static_cast<int32_t>(ang + 0.5f));
+            }
+        }
+        remap(surface, x0, y0, x1, y1);
+        if (x0 == 0 && y0 == 0 && x1 == nx && y1 == ny)
+        {
+            b_requantize = false;
+        }
+    }
+
+    // Colors of the stored levels with the current table
+    void Level_image::remap(SDL_Surface *surface, int x0, int y0, int x1, int y1)
+    {
+        const Uint32 *tb = table.data();
+        const Uint32 *lut = rgb;
+        const bool b_native = native_format(surface->format);
+        const Uint32 alpha = b_native ? surface->format->Amask : 0;
+        for (int y = y0; y < y1; y++)
+        {
+            const uint16_t *lv = level.data() + static_cast<size_t>(y) * nx;
+            Uint32 *px = reinterpret_cast<Uint32 *>(static_cast<Uint8 *>(surface->pixels) + y * surface->pitch);
+            if (b_complex)
+            {
+                const uint16_t *hu = hue.data() + static_cast<size_t>(y) * nx;
+                for (int x = x0; x < x1; x++)
+                {
+                    Uint32 c = lut[hu[x]];
+                    Uint32 g = tb[lv[x]];
+                    px[x] = ((((c >> 16) & 0xFF) * g >> 8) << 16) |
+                            ((((c >> 8) & 0xFF) * g >> 8) << 8) |
+                            ((c & 0xFF) * g >> 8) | alpha;
+                }
+            }
+            else
+            {
+                for (int x = x0; x < x1; x++)
+                {
+                    px[x] = tb[lv[x]] | alpha;
+                }
+            }
+            if (!b_native)
+            {
+                convert_row(surface->format, px + x0, x1 - x0);
+            }
+        }
+    }
+
+    template <typename T>
+    void Level_image::redraw(SDL_Surface *surface, const T *data)
+    {
+        if (b_requantize)
+        {
+            draw(surface, data, 0, 0, nx, ny);
+        }
+        else
+        {
+            remap(surface, 0, 0, nx, ny);
+        }
+    }
+    template void Level_image::redraw<float>(SDL_Surface *surface, const float *data);
+    template void Level_image::redraw<std::complex<float>>(SDL_Surface *surface, const std::complex<float> *data);
+}
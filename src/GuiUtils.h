@@ -46,6 +46,69 @@ namespace SDL_Utils
 {
     void draw_pixel(SDL_Surface *surface, int x, int y, float val, int color_map);
     void draw_pixel(SDL_Surface *surface, int x, int y, float ang, float mag, int color_map);
+
+    // Colormap sampled at lut_size levels, values are scaled to an index and looked up per row.
+    // The colormaps are computed once and shared by all images, a power other than 1 goes
+    // through a finer table of its own.
+    class Colormap_lut
+    {
+    public:
+        static const int lut_size = 4096;
+        void set(int color_map, float power = 1.0f);
+        void draw_row(SDL_Surface *surface, int y, const float *val, int n, float v_min, float v_range);
+        void draw_row(SDL_Surface *surface, int y, const std::complex<float> *val, int n, float mag_min, float mag_range);
+        Colormap_lut() : color_map(0), power(1.0f), rgb(nullptr), power_table()
+        {
+            set(0);
+        };
+
+    private:
+        static const int power_levels = 65536;
+        int color_map;
+        float power;                      // Applied to the scaled values (the magnitude of complex values)
+        const Uint32 *rgb;                // Shared table of the colormap, 0x00RRGGBB
+        std::vector<uint16_t> power_table; // Level of the colormap for each of power_levels values
+    };
+
+    // Image colorized through 16 bit levels, quantized against a reference range with headroom.
+    // A new contrast, power or colormap only rebuilds the table of the levels and remaps them,
+    // the values are read again for changed areas, or once the range leaves the reference.
+    class Level_image
+    {
+    public:
+        void init(int nx, int ny, bool b_complex);
+        // True if the table changed, then all pixels need redraw()
+        bool set(int color_map, float power, float v_min, float v_range);
+        // Quantizes and draws the pixels x0..x1-1, y0..y1-1 of the complete image data
+        void draw(SDL_Surface *surface, const float *data, int x0, int y0, int x1, int y1);
+        void draw(SDL_Surface *surface, const std::complex<float> *data, int x0, int y0, int x1, int y1);
+        // All pixels, from the levels if the reference still holds, otherwise from data
+        template <typename T>
+        void redraw(SDL_Surface *surface, const T *data);
+        Level_image() : nx(0), ny(0), b_complex(false), b_requantize(true),
+                        color_map(-1), power(1.0f), v_min(0.0f), v_range(0.0f),
+                        ref_min(0.0f), ref_range(0.0f), rgb(nullptr),
+                        level(), hue(), table(n_levels){};
+
+    private:
+        static const int n_levels = 65536;
+        int nx;
+        int ny;
+        bool b_complex;
+        bool b_requantize; // Levels are not valid for the reference range
+        int color_map;
+        float power;
+        float v_min;
+        float v_range;
+        float ref_min;
+        float ref_range;
+        const Uint32 *rgb;
+        std::vector<uint16_t> level; // Quantized values (magnitudes of complex values)
+        std::vector<uint16_t> hue;   // Colormap index of the angle of complex values
+        std::vector<Uint32> table;   // Color of each level, the brightness 0..256 for complex values
+        void build_table();
+        void remap(SDL_Surface *surface, int x0, int y0, int x1, int y1);
+    };
 }
 
 #endif // GUI_UTILS_H
\ No newline at end of file
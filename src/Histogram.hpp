@@ -0,0 +1,261 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <vector>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+
+// Histogram with a fixed number of bins, to which values can be added and from which they can
+// be removed again. Values outside of the range of the bins are kept as they are, a few far
+// outliers then neither widen the bins nor move the percentiles. Once there are too many of
+// them, the width of the bins is doubled until most fit, merging pairs of bins, so the counts
+// never have to be rebuilt from the data. Values which are not finite are ignored.
+class Histogram
+{
+public:
+    static const int n_bins = 1 << 16;
+    static const size_t max_outliers = 1024; // On either side of the bins
+
+    void clear()
+    {
+        counts.assign(n_bins, 0);
+        below.clear();
+        above.clear();
+        total = 0;
+        lo = 0.0;
+        width = 0.0;
+        inv_width = 0.0;
+    }
+
+    inline void add(float v)
+    {
+        if (!std::isfinite(v))
+        {
+            return;
+        }
+        if (total == 0 && width == 0.0)
+        {
+            start(v);
+        }
+        total++;
+        if (fits(v))
+        {
+            counts[bin(v)]++;
+        }
+        else if (v < lo)
+        {
+            below.push_back(v);
+            if (below.size() > max_outliers)
+            {
+                absorb(below, false);
+            }
+        }
+        else
+        {
+            above.push_back(v);
+            if (above.size() > max_outliers)
+            {
+                absorb(above, true);
+            }
+        }
+    }
+
+    // Removes a value added before
+    inline void remove(float v)
+    {
+        if (!std::isfinite(v) || total == 0)
+        {
+            return;
+        }
+        if (fits(v))
+        {
+            uint32_t &c = counts[bin(v)];
+            if (c > 0)
+            {
+                c--;
+                total--;
+            }
+            return;
+        }
+        std::vector<float> &outliers = (v < lo) ? below : above;
+        auto it = std::find(outliers.begin(), outliers.end(), v);
+        if (it != outliers.end())
+        {
+            *it = outliers.back();
+            outliers.pop_back();
+            total--;
+        }
+    }
+
+    // Values at the clip and 100 - clip percentiles, false while the histogram is empty
+    bool limits(float clip, float &v_min, float &v_max) const
+    {
+        if (total == 0)
+        {
+            return false;
+        }
+        double n_clip = (std::max)(0.0f, (std::min)(clip, 50.0f)) * 0.01 * total;
+        // Percentiles among the outliers are taken from their values
+        if (n_clip < below.size())
+        {
+            v_min = nth(below, static_cast<size_t>(n_clip), false);
+        }
+        else
+        {
+            v_min = static_cast<float>(lo + width * find(n_clip - below.size(), false));
+        }
+        if (n_clip < above.size())
+        {
+            v_max = nth(above, static_cast<size_t>(n_clip), true);
+        }
+        else
+        {
+            v_max = static_cast<float>(lo + width * (n_bins - find(n_clip - above.size(), true)));
+        }
+        if (v_max <= v_min)
+        {
+            v_max = v_min + static_cast<float>(width);
+        }
+        return true;
+    }
+
+    size_t size() const { return total; };
+
+    Histogram() : counts(n_bins, 0), below(), above(), total(0), lo(0.0), width(0.0), inv_width(0.0){};
+
+private:
+    std::vector<uint32_t> counts;
+    std::vector<float> below; // Values below the first bin
+    std::vector<float> above; // Values above the last bin
+    size_t total;
+    // The width of the bins is a power of two and the range is kept in double, so that a value
+    // always falls into the bin which was merged from the one it was counted in
+    double lo;    // Lower edge of the first bin
+    double width; // Width of the bins
+    double inv_width;
+
+    inline bool fits(float v) const
+    {
+        return v >= lo && v < lo + n_bins * width;
+    }
+
+    inline int bin(float v) const
+    {
+        int b = static_cast<int>((v - lo) * inv_width);
+        return (std::min)((std::max)(b, 0), n_bins - 1);
+    }
+
+    // The first value sits in the middle of a narrow range, which grows with the data
+    void start(float v)
+    {
+        double s = (std::max)(std::fabs(static_cast<double>(v)), 1e-20);
+        width = std::exp2(std::ceil(std::log2(2.0 * s / n_bins)));
+        inv_width = 1.0 / width;
+        lo = (std::floor(v * inv_width) - n_bins / 2) * width;
+    }
+
+    // The n-th smallest (or largest) value of the outliers
+    static float nth(const std::vector<float> &outliers, size_t n, bool b_top)
+    {
+        std::vector<float> sorted(outliers);
+        if (b_top)
+        {
+            std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end(), std::greater<float>());
+        }
+        else
+        {
+            std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end());
+        }
+        return sorted[n];
+    }
+
+    // Grows the bins until all but the farthest quarter of the outliers fit and moves the
+    // values which fit now into the bins
+    void absorb(std::vector<float> &outliers, bool b_top)
+    {
+        size_t n_keep = max_outliers / 4;
+        float v = nth(outliers, n_keep, b_top);
+        // Bins wider than this would overflow the range
+        while (!fits(v) && width < FLT_MAX / (4.0 * n_bins))
+        {
+            grow(v >= lo);
+        }
+        for (std::vector<float> *side : {&below, &above})
+        {
+            size_t n = 0;
+            for (float o : *side)
+            {
+                if (fits(o))
+                {
+                    counts[bin(o)]++;
+                }
+                else
+                {
+                    (*side)[n++] = o;
+                }
+            }
+            side->resize(n);
+        }
+    }
+
+    // Doubles the width of the bins, extending the range up- or downwards
+    void grow(bool b_up)
+    {
+        const int half = n_bins / 2;
+        if (b_up)
+        {
+            // The bins move to the lower half
+            for (int i = 0; i < half; i++)
+            {
+                counts[i] = counts[2 * i] + counts[2 * i + 1];
+            }
+            std::fill(counts.begin() + half, counts.end(), 0);
+        }
+        else
+        {
+            // The bins move to the upper half, which is only read below the bin written
+            for (int i = half - 1; i >= 0; i--)
+            {
+                counts[half + i] = counts[2 * i] + counts[2 * i + 1];
+            }
+            std::fill(counts.begin(), counts.begin() + half, 0);
+            lo -= n_bins * width;
+        }
+        width *= 2.0;
+        inv_width = 1.0 / width;
+    }
+
+    // Position in bins at which n values lie below (or above, from the top), interpolated
+    // within the bin
+    float find(double n, bool b_top) const
+    {
+        double cum = 0;
+        for (int i = 0; i < n_bins; i++)
+        {
+            uint32_t c = counts[b_top ? n_bins - 1 - i : i];
+            if (cum + c > n)
+            {
+                return i + static_cast<float>((n - cum) / c);
+            }
+            cum += c;
+        }
+        return static_cast<float>(n_bins);
+    }
+};
+#endif // HISTOGRAM_H
@@ -31,12 +31,6 @@
 
 #include "ImGuiImageWindow.h"
 
-template <typename T>
-inline T pw(T val, T power)
-{
-    return copysign(1.0, val) * pow(abs(val), power);
-}
-
 namespace cmap = tinycolormap;
 
 GIM_Flags operator|(GIM_Flags lhs, GIM_Flags rhs)
@@ -69,17 +63,13 @@ void ImGuiImageWindow<T>::render_image()
         {
             set_min_max();
         }
-        for (int y = 0; y < ny; y++)
-        {
-            for (int x = 0; x < nx; x++)
-            {
-                set_pixel(x, y);
-            }
-        }
+        image.set(data_cmap, power, data_min, data_range);
+        draw_rect(0, 0, nx, ny);
     }
 }
 
-// Redraws the entire ricom image from line y0 to line ye
+// Redraws the changed tiles, or the lines since the last redraw, and remaps the whole image
+// if the range of the data changed
 template <typename T>
 void ImGuiImageWindow<T>::render_image(int last_idr)
 {
@@ -87,43 +77,127 @@ void ImGuiImageWindow<T>::render_image(int last_idr)
     if (b_data_set)
     {
         set_min_max(last_idr);
-        for (int y = (std::max)(0, this->last_y - render_update_offset); y < (std::min)(last_yt + render_update_offset, ny); y++)
+        if (!draw_tiles())
         {
-            for (int x = 0; x < nx; x++)
+            int y0 = (std::max)(0, this->last_y - render_update_offset);
+            int y1 = (std::min)(last_yt + render_update_offset, ny);
+            if (y0 < y1)
             {
-                set_pixel(x, y);
+                draw_rect(0, y0, nx, y1);
             }
         }
+        recolor();
     }
     this->last_y = last_yt;
     this->last_idr = last_idr;
 }
 
-template <>
-void ImGuiImageWindow<float>::set_pixel(int idx, int idy)
+// Draws the tiles changed in a newer snapshot than the last one drawn, false without tiles
+template <typename T>
+bool ImGuiImageWindow<T>::draw_tiles()
 {
-    // determine location index of value in memory
-    int idr = idy * nx + idx;
-    float val = pw((data->at(idr) - data_min) / data_range, power);
+    if (tile_version == nullptr)
+    {
+        return false;
+    }
+    int ntx = (nx + tile_size - 1) / tile_size;
+    int nty = (ny + tile_size - 1) / tile_size;
+    if (tile_version->size() != static_cast<size_t>(ntx) * nty)
+    {
+        return false;
+    }
+    uint32_t newest = drawn_version;
+    for (int ty = 0; ty < nty; ty++)
+    {
+        for (int tx = 0; tx < ntx; tx++)
+        {
+            uint32_t version = (*tile_version)[ty * ntx + tx];
+            if (version > drawn_version)
+            {
+                int x0 = tx * tile_size;
+                int y0 = ty * tile_size;
+                draw_rect(x0, y0, (std::min)(x0 + tile_size, nx), (std::min)(y0 + tile_size, ny));
+                newest = (std::max)(newest, version);
+            }
+        }
+    }
+    drawn_version = newest;
+    return true;
+}
 
-    // Update pixel at location
-    SDL_Utils::draw_pixel(sdl_srf, idx, idy, val, data_cmap);
+// A new range, power or colormap only remaps the levels of the drawn image
+template <typename T>
+void ImGuiImageWindow<T>::recolor()
+{
+    if (b_data_set && image.set(data_cmap, power, data_min, data_range))
+    {
+        image.redraw(sdl_srf, pyramid.level(data->data(), level));
+        mark_rows(0, sdl_srf->h);
+    }
 }
 
-template <>
-void ImGuiImageWindow<std::complex<float>>::set_pixel(int idx, int idy)
+// Draws the pixels x0..x1-1, y0..y1-1 of the data at the level of the pyramid shown
+template <typename T>
+void ImGuiImageWindow<T>::draw_rect(int x0, int y0, int x1, int y1)
 {
-    // determine location index of value in memory
-    int idr = idy * nx + idx;
+    pyramid.update(data->data(), x0, y0, x1, y1);
+    pyramid.rect(level, x0, y0, x1, y1);
+    image.draw(sdl_srf, pyramid.level(data->data(), level), x0, y0, x1, y1);
+    mark_rows(y0, y1);
+}
 
-    // Get magnitude and angle from complex
-    float mag = (abs(data->at(idr)) - data_min) / data_range;
-    float ang = arg(data->at(idr));
-    ang = (ang / M_PI + 1) / 2;
-    mag = pw(mag, power);
+// Shows another level of the pyramid, the surface and the texture take its size
+template <typename T>
+void ImGuiImageWindow<T>::set_level(int level)
+{
+    if (level == this->level)
+    {
+        return;
+    }
+    this->level = level;
+    int lw = pyramid.width(level);
+    int lh = pyramid.height(level);
+    SDL_FreeSurface(sdl_srf);
+    sdl_srf = SDL_CreateRGBSurface(0, lw, lh, 32, 0, 0, 0, 0);
+    if (sdl_srf == NULL)
+    {
+        std::cout << "Surface could not be created! SDL Error: " << SDL_GetError() << std::endl;
+    }
+    image.init(lw, lh, std::is_same<T, std::complex<float>>::value);
+    upload_y0 = 0;
+    upload_y1 = lh;
+    if (b_data_set)
+    {
+        pyramid.use(data->data(), level);
+        image.set(data_cmap, power, data_min, data_range);
+        image.draw(sdl_srf, pyramid.level(data->data(), level), 0, 0, lw, lh);
+    }
+}
 
-    // Update pixel at location
-    SDL_Utils::draw_pixel(sdl_srf, idx, idy, ang, mag, data_cmap);
+// Saved images always have the full resolution of the data
+template <typename T>
+void ImGuiImageWindow<T>::save_full_image(std::string *path)
+{
+    if (level == 0 || !b_data_set)
+    {
+        save_image(path, sdl_srf);
+        return;
+    }
+    SDL_Surface *srf = SDL_CreateRGBSurface(0, nx, ny, 32, 0, 0, 0, 0);
+    SDL_Utils::Level_image full;
+    full.init(nx, ny, std::is_same<T, std::complex<float>>::value);
+    full.set(data_cmap, power, data_min, data_range);
+    full.draw(srf, data->data(), 0, 0, nx, ny);
+    save_image(path, srf);
+    SDL_FreeSurface(srf);
+}
+
+// Rows of the surface which need to be uploaded to the texture
+template <typename T>
+void ImGuiImageWindow<T>::mark_rows(int y0, int y1)
+{
+    upload_y0 = (std::min)(upload_y0, y0);
+    upload_y1 = (std::max)(upload_y1, y1);
 }
 
 template <>
@@ -141,6 +215,18 @@ float ImGuiImageWindow<std::complex<float>>::get_val(int idr)
 template <typename T>
 void ImGuiImageWindow<T>::set_min_max(int last_idr)
 {
+    if (limits != nullptr)
+    {
+        if ((*limits)[0] != data_min || (*limits)[1] != data_max)
+        {
+            data_min = (*limits)[0];
+            data_max = (*limits)[1];
+            data_range = data_max - data_min;
+            b_trigger_update = true;
+            b_rescale = true;
+        }
+        return;
+    }
     for (int idr = this->last_idr; idr < last_idr; idr++)
     {
         float val = get_val(idr);
@@ -149,34 +235,69 @@ void ImGuiImageWindow<T>::set_min_max(int last_idr)
             data_min = val;
             data_range = data_max - data_min;
             b_trigger_update = true;
+            b_rescale = true;
         }
         if (val > data_max)
         {
             data_max = val;
             data_range = data_max - data_min;
             b_trigger_update = true;
+            b_rescale = true;
         }
     }
 }
 
+static inline float magnitude(float v) { return v; }
+static inline float magnitude(const std::complex<float> &v) { return std::abs(v); }
+
+// Range of the values of n elements, reduced over chunks in parallel for large images
 template <typename T>
-void ImGuiImageWindow<T>::set_min_max()
+static void min_max(const T *data, size_t n, float &v_min, float &v_max)
 {
-    for (int idr = 0; idr < nxy; idr++)
+    const size_t chunk = 1 << 18;
+    size_t n_chunks = (std::max)(static_cast<size_t>(1), (std::min)(n / chunk, static_cast<size_t>(std::thread::hardware_concurrency())));
+    std::vector<float> mins(n_chunks, FLT_MAX);
+    std::vector<float> maxs(n_chunks, -FLT_MAX);
+    auto reduce = [&](size_t c)
     {
-        float val = get_val(idr);
-        if (val < data_min)
-        {
-            data_min = val;
-            data_range = data_max - data_min;
-            b_trigger_update = true;
-        }
-        if (val > data_max)
+        float lo = FLT_MAX;
+        float hi = -FLT_MAX;
+        for (size_t i = n * c / n_chunks; i < n * (c + 1) / n_chunks; i++)
         {
-            data_max = val;
-            data_range = data_max - data_min;
-            b_trigger_update = true;
+            float val = magnitude(data[i]);
+            lo = (std::min)(lo, val);
+            hi = (std::max)(hi, val);
         }
+        mins[c] = lo;
+        maxs[c] = hi;
+    };
+    std::vector<std::thread> threads;
+    for (size_t c = 1; c < n_chunks; c++)
+    {
+        threads.emplace_back(reduce, c);
+    }
+    reduce(0);
+    for (std::thread &t : threads)
+    {
+        t.join();
+    }
+    v_min = *std::min_element(mins.begin(), mins.end());
+    v_max = *std::max_element(maxs.begin(), maxs.end());
+}
+
+template <typename T>
+void ImGuiImageWindow<T>::set_min_max()
+{
+    float v_min;
+    float v_max;
+    min_max(data->data(), nxy, v_min, v_max);
+    if (v_min < data_min || v_max > data_max)
+    {
+        data_min = (std::min)(data_min, v_min);
+        data_max = (std::max)(data_max, v_max);
+        data_range = data_max - data_min;
+        b_trigger_update = true;
+        b_rescale = true;
     }
 }
 
@@ -200,6 +321,14 @@ ImGuiImageWindow<T>::ImGuiImageWindow(const std::string &title, GLuint *tex_id,
     this->nxy = 1;
     this->render_update_offset = 0;
     this->b_trigger_update = false;
+    this->b_rescale = false;
+    this->tile_version = nullptr;
+    this->tile_size = 1;
+    this->drawn_version = 0;
+    this->limits = nullptr;
+    this->upload_y0 = 0;
+    this->upload_y1 = 1;
+    this->level = 0;
     saveFileDialog = ImGui::FileBrowser(ImGuiFileBrowserFlags_EnterNewFilename | ImGuiFileBrowserFlags_CreateNewDir);
     saveFileDialog.SetTitle("Save " + title + " image as .png");
     saveDataDialog = ImGui::FileBrowser(ImGuiFileBrowserFlags_EnterNewFilename | ImGuiFileBrowserFlags_CreateNewDir);
@@ -236,6 +365,7 @@ void ImGuiImageWindow<T>::reset_limits()
     last_y = 0;
     last_idr = 0;
     last_img = 0;
+    drawn_version = 0;
     data_min = FLT_MAX;
     data_max = -FLT_MAX;
     data_range = FLT_MAX;
@@ -248,17 +378,37 @@ void ImGuiImageWindow<T>::set_nx_ny(int width, int height)
     this->ny = height;
     this->nxy = height * width;
 
-    data_fft.resize(nxy);
     data_fft_f.resize(nxy);
-    data_val.resize(nxy);
 
     reset_limits();
 
+    // The full resolution is shown until the next layout picks a level
+    SDL_FreeSurface(sdl_srf);
     sdl_srf = SDL_CreateRGBSurface(0, this->nx, this->ny, 32, 0, 0, 0, 0);
     if (sdl_srf == NULL)
     {
         std::cout << "Surface could not be created! SDL Error: " << SDL_GetError() << std::endl;
     }
+    image.init(nx, ny, std::is_same<T, std::complex<float>>::value);
+    pyramid.init(nx, ny);
+    level = 0;
+    mark_rows(0, ny);
+}
+
+// Versions of the tiles of the data, so that redraws only touch the tiles which changed
+template <typename T>
+void ImGuiImageWindow<T>::set_tiles(const std::vector<uint32_t> *tile_version, int tile_size)
+{
+    this->tile_version = tile_version;
+    this->tile_size = tile_size;
+    drawn_version = 0;
+}
+
+// Contrast limits updated with the data, instead of its running minimum and maximum
+template <typename T>
+void ImGuiImageWindow<T>::set_limits(const std::array<float, 2> *limits)
+{
+    this->limits = limits;
 }
 
 template <typename T>
@@ -276,21 +426,12 @@ void ImGuiImageWindow<T>::reset_min_max()
     data_range = FLT_MAX;
 }
 
-template <>
-void ImGuiImageWindow<float>::compute_fft()
-{
-    FFT2D fft2d(ny, nx);
-    FFT2D::r2c(*data, data_val);
-    fft2d.fft(data_val, data_fft);
-    FFT2D::c2abs(data_fft, data_fft_f);
-}
-
-template <>
-void ImGuiImageWindow<std::complex<float>>::compute_fft()
+// Only the magnitudes are shown, so the data needs no shift before the transform
+template <typename T>
+void ImGuiImageWindow<T>::compute_fft()
 {
     FFT2D fft2d(ny, nx);
-    fft2d.fft(*data, data_fft);
-    FFT2D::c2abs(data_fft, data_fft_f);
+    fft2d.abs_spectrum(*data, data_fft_f);
 }
 
 // Deal with situation when process is finished (redraw==false) but not fully rendered
@@ -349,11 +490,18 @@ void ImGuiImageWindow<T>::render_window(bool b_redraw, int fr_count, bool b_trig
     if (t_open)
     {
         bool fr_switch = detect_frame_switch(fr_count);
+        // A changed range of the data was already remapped, new data is drawn from the values
+        bool b_values = b_trigger_ext || fr_switch || (b_trigger_update && !b_rescale);
         b_trigger_update = b_trigger_update || b_trigger_ext || fr_switch;
-        if (b_trigger_update)
+        if (b_values)
         {
             render_image();
         }
+        else if (b_rescale)
+        {
+            recolor();
+        }
+        b_rescale = false;
 
         if (this->has(GIM_Flags::SaveImButton))
         {
@@ -367,7 +515,7 @@ void ImGuiImageWindow<T>::render_window(bool b_redraw, int fr_count, bool b_trig
             {
                 std::string img_file = saveFileDialog.GetSelected().string();
                 saveFileDialog.ClearSelected();
-                save_image(&img_file, sdl_srf);
+                save_full_image(&img_file);
             }
         }
 
@@ -416,9 +564,7 @@ void ImGuiImageWindow<T>::render_window(bool b_redraw, int fr_count, bool b_trig
             ImGui::SetNextItemWidth(64);
             if (ImGui::DragFloat("Power", &power, 0.05f, 0.05f, 2.0f, "%.2f"))
             {
-                this->last_idr = 0;
-                this->last_y = 0;
-                render_image((fr_count == 0) ? nxy : fr_count);
+                recolor();
                 b_trigger_update = true;
             }
         }
@@ -429,9 +575,7 @@ void ImGuiImageWindow<T>::render_window(bool b_redraw, int fr_count, bool b_trig
             ImGui::SetNextItemWidth(-1);
             if (ImGui::Combo("Colormap", &data_cmap, cmaps, IM_ARRAYSIZE(cmaps)))
             {
-                this->last_idr = 0;
-                this->last_y = 0;
-                render_image((fr_count == 0) ? nxy : fr_count);
+                recolor();
                 b_trigger_update = true;
             }
         }
@@ -442,17 +586,22 @@ void ImGuiImageWindow<T>::render_window(bool b_redraw, int fr_count, bool b_trig
         ImGui::SetNextWindowBgAlpha(0.0f);
         ImGui::BeginChildFrame(ImGui::GetID("ImageFrame"), ImVec2(0.0f, 0.0f), ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse);
         ImVec2 vAvail = ImGui::GetContentRegionAvail();
-        float scale = (std::min)(vAvail.x / sdl_srf->w, vAvail.y / sdl_srf->h);
-        float tex_h = sdl_srf->h * scale;
-        float tex_w = sdl_srf->w * scale;
+        float scale = (std::min)(vAvail.x / nx, vAvail.y / ny);
+        float tex_h = ny * scale;
+        float tex_w = nx * scale;
         float tex_h_z = tex_h * zoom;
         float tex_w_z = tex_w * zoom;
-        if (b_redraw || b_trigger_update)
+        // The coarsest level which still has a pixel for each pixel on screen
+        int fit_level = 0;
+        while (scale > 0.0f && fit_level + 1 < pyramid.levels() && scale * zoom * (1 << (fit_level + 1)) <= 1.0f)
         {
-            glBindTexture(GL_TEXTURE_2D, (*tex_id));
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, sdl_srf->w, sdl_srf->h, 0,
-                         GL_BGRA, GL_UNSIGNED_BYTE, sdl_srf->pixels);
+            fit_level++;
         }
+        set_level(fit_level);
+        // Only the rows drawn since the last upload
+        texture.upload(*tex_id, sdl_srf, upload_y0, upload_y1);
+        upload_y0 = sdl_srf->h;
+        upload_y1 = 0;
         ImVec2 pos = ImGui::GetCursorScreenPos();
         ImGui::Image((ImTextureID)(*tex_id), ImVec2(tex_w_z, tex_h_z), uv_min, uv_max, tint_col, border_col);
         if (ImGui::IsItemHovered())
@@ -11,10 +11,13 @@
  *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
  */
 
+#include <array>
 #include <vector>
 #include <string>
+#include <thread>
 #include <stdio.h>
 #include <algorithm>
+#include <type_traits>
 #include <SDL.h>
 #include <SDL_opengl.h>
 
@@ -29,6 +32,8 @@
 #include "imfilebrowser.h"
 
 #include "GuiUtils.h"
+#include "GlTexture.h"
+#include "MipPyramid.hpp"
 
 enum class GIM_Flags : unsigned char
 {
@@ -53,6 +58,8 @@ public:
     void render_window(bool b_redraw, int last_y, bool b_trigger_update);
     void reset_min_max();
     void set_nx_ny(int width, int height);
+    void set_tiles(const std::vector<uint32_t> *tile_version, int tile_size);
+    void set_limits(const std::array<float, 2> *limits);
     bool *pb_open;
     ImGuiImageWindow<float> *fft_window;
     bool b_trigger_update;
@@ -95,15 +102,24 @@ private:
     float data_range;
     std::vector<T> *data;
     bool b_data_set;
+    bool b_rescale; // Only the range of the data changed since the last redraw
+    const std::vector<uint32_t> *tile_version; // Snapshot in which each tile of data changed, optional
+    int tile_size;
+    uint32_t drawn_version; // Newest snapshot of the tiles drawn
+    const std::array<float, 2> *limits; // Contrast kept by the producer of the data, optional
 
     // FFT data
-    std::vector<std::complex<float>> data_fft;
     std::vector<float> data_fft_f;
-    std::vector<std::complex<float>> data_val;
 
     // Surface and Texture
+    SDL_Utils::Level_image image;
     SDL_Surface *sdl_srf;
     GLuint *tex_id;
+    GlTexture texture;
+    int upload_y0; // Rows drawn since the last upload
+    int upload_y1;
+    MipPyramid<T> pyramid; // Reduced data, for images shown smaller than their size
+    int level;             // Level of the pyramid in sdl_srf
 
     // Methods
     inline void render_image(int ye);
@@ -111,7 +127,12 @@ private:
     inline void set_min_max();
     inline void set_min_max(int last_y);
     inline void reset_limits();
-    inline void set_pixel(int idx, int idy);
+    inline bool draw_tiles();
+    inline void recolor();
+    inline void mark_rows(int y0, int y1);
+    inline void draw_rect(int x0, int y0, int x1, int y1);
+    void set_level(int level);
+    void save_full_image(std::string *path);
     inline void compute_fft();
     inline bool has(GIM_Flags flag);
     inline bool detect_frame_switch(int &fr_count);
@@ -0,0 +1,127 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+#include "MappedFile.h"
+
+bool MappedFile::open(const std::string &path)
+{
+    close();
+#ifdef _WIN32
+    h_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                         FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (h_file == INVALID_HANDLE_VALUE)
+    {
+        h_file = nullptr;
+        return false;
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(h_file, &size);
+    map_size = static_cast<size_t>(size.QuadPart);
+    h_map = CreateFileMappingA(h_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (h_map == nullptr)
+    {
+        close();
+        return false;
+    }
+    map = static_cast<const char *>(MapViewOfFile(h_map, FILE_MAP_READ, 0, 0, 0));
+#else
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close();
+        return false;
+    }
+    map_size = static_cast<size_t>(st.st_size);
+    void *p = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    map = static_cast<const char *>(p);
+    madvise(p, map_size, MADV_SEQUENTIAL);
+#endif
+    if (map == nullptr)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (map != nullptr)
+    {
+        UnmapViewOfFile(map);
+    }
+    if (h_map != nullptr)
+    {
+        CloseHandle(h_map);
+    }
+    if (h_file != nullptr)
+    {
+        CloseHandle(h_file);
+    }
+    h_map = nullptr;
+    h_file = nullptr;
+#else
+    if (map != nullptr)
+    {
+        munmap(const_cast<char *>(map), map_size);
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+    fd = -1;
+#endif
+    map = nullptr;
+    map_size = 0;
+}
+
+void MappedFile::prefetch(size_t offset, size_t size)
+{
+#ifndef _WIN32
+    if (map == nullptr || offset >= map_size)
+    {
+        return;
+    }
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t end = (std::min)(offset + size, map_size);
+    offset -= offset % page;
+    madvise(const_cast<char *>(map) + offset, end - offset, MADV_WILLNEED);
+#else
+    (void)offset;
+    (void)size;
+#endif
+}
@@ -0,0 +1,50 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+
+// Read-only memory mapping of a whole file for sequential reading
+class MappedFile
+{
+public:
+    bool open(const std::string &path);
+    void close();
+    // Ask the OS to read [offset, offset + size) ahead, hides the latency of network storage
+    void prefetch(size_t offset, size_t size);
+    const char *data() { return map; };
+    size_t size() { return map_size; };
+    bool is_open() { return map != nullptr; };
+
+    MappedFile() : map(nullptr), map_size(0),
+#ifdef _WIN32
+                   h_file(nullptr), h_map(nullptr){};
+#else
+                   fd(-1){};
+#endif
+    ~MappedFile() { close(); };
+
+private:
+    const char *map;
+    size_t map_size;
+#ifdef _WIN32
+    void *h_file;
+    void *h_map;
+#else
+    int fd;
+#endif
+};
+#endif // MAPPED_FILE_H
@@ -0,0 +1,53 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef MIB_FILE_H
+#define MIB_FILE_H
+
+#include <fstream>
+#include <vector>
+#include <cstring>
+
+// Frame size of a .mib file is the distance between the first two frame headers ("MQ1,").
+// Returns the file size for a single frame, the file is rewound afterwards.
+inline size_t mib_frame_size(std::ifstream &file, size_t file_size, size_t head_size)
+{
+    size_t frame_size = file_size;
+    const size_t chunk = 1 << 20;
+    std::vector<char> buffer(chunk + 3);
+    file.seekg(head_size, std::ios::beg);
+    size_t offset = head_size;
+    while (offset < file_size && frame_size == file_size)
+    {
+        file.read(&buffer[3], chunk);
+        size_t n = file.gcount();
+        for (size_t i = 0; i < n; i++)
+        {
+            if (memcmp(&buffer[i], "MQ1,", 4) == 0 && offset + i >= head_size + 3)
+            {
+                frame_size = offset + i - 3;
+                break;
+            }
+        }
+        memcpy(&buffer[0], &buffer[chunk], 3);
+        offset += n;
+        if (n == 0)
+        {
+            break;
+        }
+    }
+    file.clear();
+    file.seekg(0, std::ios::beg);
+    return frame_size;
+}
+#endif // MIB_FILE_H
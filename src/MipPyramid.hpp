@@ -0,0 +1,108 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef MIP_PYRAMID_H
+#define MIP_PYRAMID_H
+
+#include <vector>
+#include <algorithm>
+
+// Images at half the size of the one below, down to a single pixel. Each pixel is the mean of
+// the (up to) 2x2 pixels below it. Level 0 is the data itself and not stored; only the levels up
+// to the one in use are kept up to date, higher levels are rebuilt once they are used again.
+template <typename T>
+class MipPyramid
+{
+public:
+    void init(int nx, int ny)
+    {
+        w.assign(1, nx);
+        h.assign(1, ny);
+        while (w.back() > 1 || h.back() > 1)
+        {
+            w.push_back((w.back() + 1) / 2);
+            h.push_back((h.back() + 1) / 2);
+        }
+        data.assign(w.size(), std::vector<T>());
+        for (size_t l = 1; l < w.size(); l++)
+        {
+            data[l].assign(static_cast<size_t>(w[l]) * h[l], T());
+        }
+        n_kept = 0;
+    }
+
+    int levels() const { return static_cast<int>(w.size()); };
+    int width(int l) const { return w[l]; };
+    int height(int l) const { return h[l]; };
+    const T *level(const T *base, int l) const { return (l == 0) ? base : data[l].data(); };
+
+    // Keeps the levels up to l up to date from now on, building those which were not
+    void use(const T *base, int l)
+    {
+        for (int k = n_kept + 1; k <= l; k++)
+        {
+            reduce(level(base, k - 1), k, 0, 0, w[k], h[k]);
+        }
+        n_kept = l;
+    }
+
+    // Updates the kept levels for a change of the pixels x0..x1-1, y0..y1-1 of the base
+    void update(const T *base, int x0, int y0, int x1, int y1)
+    {
+        for (int k = 1; k <= n_kept; k++)
+        {
+            x0 /= 2;
+            y0 /= 2;
+            x1 = (x1 + 1) / 2;
+            y1 = (y1 + 1) / 2;
+            reduce(level(base, k - 1), k, x0, y0, x1, y1);
+        }
+    }
+
+    // Pixels x0..x1-1, y0..y1-1 of level l which contain the pixels of the base
+    void rect(int l, int &x0, int &y0, int &x1, int &y1) const
+    {
+        x0 >>= l;
+        y0 >>= l;
+        x1 = (x1 + (1 << l) - 1) >> l;
+        y1 = (y1 + (1 << l) - 1) >> l;
+    }
+
+    MipPyramid() : w(), h(), data(), n_kept(0){};
+
+private:
+    std::vector<int> w;
+    std::vector<int> h;
+    std::vector<std::vector<T>> data;
+    int n_kept; // Levels 1..n_kept are up to date
+
+    void reduce(const T *src, int l, int x0, int y0, int x1, int y1)
+    {
+        int sw = w[l - 1];
+        int sh = h[l - 1];
+        T *dst = data[l].data();
+        for (int y = y0; y < y1; y++)
+        {
+            const T *r0 = src + static_cast<size_t>(2 * y) * sw;
+            // The last row or column of an odd size is repeated
+            const T *r1 = (2 * y + 1 < sh) ? r0 + sw : r0;
+            for (int x = x0; x < x1; x++)
+            {
+                int xa = 2 * x;
+                int xb = (std::min)(xa + 1, sw - 1);
+                dst[static_cast<size_t>(y) * w[l] + x] = (r0[xa] + r0[xb] + r1[xa] + r1[xb]) * 0.25f;
+            }
+        }
+    }
+};
+#endif // MIP_PYRAMID_H
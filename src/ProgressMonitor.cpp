@@ -13,16 +13,35 @@
 
 #include "ProgressMonitor.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
 ProgressMonitor::ProgressMonitor(size_t fr_total, bool b_bar, float report_interval, std::ostream &out) : fr_count(0), fr_count_i(0), fr_freq(0),
-                                                                                                          report_set(false), report_set_public(false),
                                                                                                           first_frame(true), fr(0), fr_avg(0), fr_count_a(0),
-                                                                                                          time_stamp(chc::high_resolution_clock::now()), unit("kHz"),
-                                                                                                          unit_bar("#"), unit_space("-")
+                                                                                                          time_stamp(chc::steady_clock::now()), count_last(0),
+                                                                                                          sum_last{0, 0}, mean{0, 0}, reporter(), b_stop(false), on_report(),
+                                                                                                          unit("kHz"), unit_bar("#"), unit_space("-")
 {
     this->fr_total = fr_total;
     this->b_bar = b_bar;
     this->out = &out;
     this->report_interval = report_interval;
+    for (Shard &s : shards)
+    {
+        s.count.store(0, std::memory_order_relaxed);
+        s.sum[0].store(0, std::memory_order_relaxed);
+        s.sum[1].store(0, std::memory_order_relaxed);
+    }
+}
+
+ProgressMonitor::~ProgressMonitor()
+{
+    stop();
 }
 
 int ProgressMonitor::GetBarLength()
@@ -41,29 +60,85 @@ void ProgressMonitor::ClearBarField()
     *out << "\r" << std::flush;
 }
 
-ProgressMonitor &ProgressMonitor::operator++()
+void ProgressMonitor::start(Report_callback on_report)
 {
-    fr_count_i++;
-    fr_count++;
-    auto mil_secs = chc::duration_cast<float_ms>(chc::high_resolution_clock::now() - time_stamp).count();
-    if (mil_secs > report_interval || fr_count >= fr_total)
+    stop();
+    this->on_report = on_report;
+    b_stop = false;
+    time_stamp = chc::steady_clock::now();
+    reporter = std::thread(&ProgressMonitor::run_reporter, this);
+}
+
+void ProgressMonitor::stop()
+{
+    if (!reporter.joinable())
     {
-        fr = fr_count_i / mil_secs;
-        fr_avg += fr;
-        fr_count_a++;
-        fr_freq = fr_avg / fr_count_a;
-        Report(fr_count, fr_avg / fr_count_a);
-        report_set = true;
-        report_set_public = true;
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(reporter_mutex);
+        b_stop = true;
+    }
+    reporter_cv.notify_one();
+    reporter.join();
+}
+
+void ProgressMonitor::run_reporter()
+{
+    // The redraw should not take time from the threads doing the reconstruction
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#elif defined(__linux__)
+    // The nice value is per thread on Linux
+    setpriority(PRIO_PROCESS, 0, getpriority(PRIO_PROCESS, 0) + 5);
+#endif
+    std::unique_lock<std::mutex> lock(reporter_mutex);
+    bool b_last = false;
+    while (!b_last)
+    {
+        b_last = reporter_cv.wait_for(lock, float_ms(report_interval), [this]
+                                      { return b_stop; });
+        sample(b_last);
     }
-    return *this;
 }
 
-void ProgressMonitor::reset_flags()
+// Sum the shards and report the frames counted since the last report
+void ProgressMonitor::sample(bool b_last)
 {
-    fr_count_i = 0;
-    report_set = false;
-    time_stamp = chc::high_resolution_clock::now();
+    size_t count = 0;
+    double sum[2] = {0, 0};
+    for (Shard &s : shards)
+    {
+        count += s.count.load(std::memory_order_acquire);
+        sum[0] += s.sum[0].load(std::memory_order_relaxed);
+        sum[1] += s.sum[1].load(std::memory_order_relaxed);
+    }
+    size_t n = count - count_last;
+    if (n == 0 && !b_last)
+    {
+        return;
+    }
+    auto now = chc::steady_clock::now();
+    fr_count = count;
+    fr_count_i = n;
+    if (n > 0)
+    {
+        float mil_secs = chc::duration_cast<float_ms>(now - time_stamp).count();
+        fr = n / mil_secs;
+        fr_avg += fr;
+        fr_count_a++;
+        fr_freq = fr_avg / fr_count_a;
+        mean = {static_cast<float>((sum[0] - sum_last[0]) / n), static_cast<float>((sum[1] - sum_last[1]) / n)};
+        Report(count, fr_freq);
+    }
+    if (on_report && (n > 0 || count > 0))
+    {
+        on_report(count, mean);
+    }
+    time_stamp = now;
+    count_last = count;
+    sum_last[0] = sum[0];
+    sum_last[1] = sum[1];
 }
 
 void ProgressMonitor::Report(unsigned long idx, float print_val)
@@ -24,6 +24,11 @@
 #include <atomic>
 #include <chrono>
 #include <cmath>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 namespace chc = std::chrono;
 typedef chc::duration<float, std::milli> float_ms;
@@ -31,23 +36,37 @@ typedef chc::duration<float, std::milli> float_ms;
 #define TOTAL_PERCENTAGE 100.0
 #define CHARACTER_WIDTH_PERCENTAGE 4
 #define TERMINAL_WIDTH 120
+// Counts processed frames on any number of threads without locks or clock reads: each thread
+// adds to its own counter shard, and a reporter thread sums the shards every report_interval,
+// prints the progress and calls back for the redraw.
 class ProgressMonitor
 {
 
 public:
     const static int DEFAULT_WIDTH;
+    // Called by the reporter with the frame count and the mean value of the frames in the interval
+    typedef std::function<void(size_t count, const std::array<float, 2> &mean)> Report_callback;
 
-    std::atomic<size_t> fr_count;   // frame count
+    std::atomic<size_t> fr_count;   // frame count, updated by the reporter
     std::atomic<size_t> fr_count_i; // Frame count in interval
     float fr_freq;                        // frame frequency
-    std::atomic<bool> report_set;         // update flag (reset internally)
-    std::atomic<bool> report_set_public;  // update flag (reset externally)
     bool first_frame;                     // first frame flag
-    ProgressMonitor &operator++();
-    void reset_flags();
+    // Count one frame and add its value (COM) to the interval mean, from any thread
+    inline void add(const std::array<float, 2> &value);
+    void start(Report_callback on_report);
+    void stop(); // Reports the last interval, called by the destructor as well
     explicit ProgressMonitor(size_t fr_total, bool b_bar = true, float report_interval = 250.0, std::ostream &out = std::cerr);
+    ~ProgressMonitor();
 
 private:
+    static const int n_shards = 16; // Threads beyond this share shards
+    struct alignas(64) Shard
+    {
+        std::atomic<size_t> count;
+        std::atomic<double> sum[2];
+    };
+    Shard shards[n_shards];
+
     bool b_bar;             // Print progress bar
     size_t fr_total; // Total number of frames
     std::ostream *out;      // Output stream
@@ -55,17 +74,57 @@ private:
     float fr;                    // Frequncy per frame
     float fr_avg;                // Average frequency
     float report_interval;       // Update interval
-    std::atomic<int> fr_count_a; // Count measured points for averaging
+    int fr_count_a;              // Count measured points for averaging
+
+    chc::time_point<chc::steady_clock> time_stamp;
+    size_t count_last;        // Shard totals at the last report
+    double sum_last[2];
+    std::array<float, 2> mean; // Of the last interval with frames
 
-    chc::time_point<chc::high_resolution_clock> time_stamp;
+    // Reporter thread
+    std::thread reporter;
+    std::mutex reporter_mutex;
+    std::condition_variable reporter_cv;
+    bool b_stop;
+    Report_callback on_report;
 
     const char *unit;
     const char *unit_bar;
     const char *unit_space;
 
+    static int shard_index();
+    static void add_relaxed(std::atomic<double> &a, double v);
+    void run_reporter();
+    void sample(bool b_last);
     void Report(unsigned long idx, float print_val);
     void ClearBarField();
     int GetBarLength();
 };
 
+// Threads are assigned shards in the order they first count
+inline int ProgressMonitor::shard_index()
+{
+    static std::atomic<int> next_shard(0);
+    thread_local int shard = next_shard.fetch_add(1, std::memory_order_relaxed) % n_shards;
+    return shard;
+}
+
+// Uncontended unless threads share a shard
+inline void ProgressMonitor::add_relaxed(std::atomic<double> &a, double v)
+{
+    double old = a.load(std::memory_order_relaxed);
+    while (!a.compare_exchange_weak(old, old + v, std::memory_order_relaxed))
+    {
+    }
+}
+
+inline void ProgressMonitor::add(const std::array<float, 2> &value)
+{
+    Shard &s = shards[shard_index()];
+    add_relaxed(s.sum[0], value[0]);
+    add_relaxed(s.sum[1], value[1]);
+    // The count is released last, so the reporter sees the sums of all counted frames
+    s.count.fetch_add(1, std::memory_order_release);
+}
+
 #endif // _PROGRESS_MONITOR_
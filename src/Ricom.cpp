@@ -83,29 +83,31 @@ void Ricom_kernel::compute_filter()
     }
 }
 
-// Applies the filter to the kernel
+// Applies the filter to the kernel. The filter is symmetric around the zero frequency, so the
+// half spectra of the real kernels are filtered in place, without shifting the kernels.
 void Ricom_kernel::include_filter()
 {
-    FFT2D fft2d(k_width_sym, k_width_sym);
-    std::vector<std::complex<float>> x2c = FFT2D::r2c(kernel_x);
-    std::vector<std::complex<float>> y2c = FFT2D::r2c(kernel_y);
-    fft2d.fft(x2c, x2c);
-    fft2d.fft(y2c, y2c);
-    for (int id = 0; id < k_area; id++)
-    {
-        if (kernel_filter[id] == 0.0f)
+    // The size follows the kernel size slider, too many sizes to measure plans for
+    FFT2D fft2d(k_width_sym, k_width_sym, FFTW_ESTIMATE);
+    std::vector<std::complex<float>> x2c;
+    std::vector<std::complex<float>> y2c;
+    fft2d.fft_r2c(kernel_x, x2c);
+    fft2d.fft_r2c(kernel_y, y2c);
+    // The normalization of the inverse transform is applied with the filter
+    float scale = 1.0f / k_area;
+    int w = k_width_sym / 2 + 1;
+    for (int ky = 0; ky < k_width_sym; ky++)
+    {
+        int iy = FFT2D::freq(ky, k_width_sym) + kernel_size;
+        for (int kx = 0; kx < w; kx++)
         {
-            x2c[id] = {0, 0};
-            y2c[id] = {0, 0};
+            float f = kernel_filter[iy * k_width_sym + kx + kernel_size] * scale;
+            x2c[ky * w + kx] *= f;
+            y2c[ky * w + kx] *= f;
         }
     }
-    fft2d.ifft(x2c, x2c);
-    fft2d.ifft(y2c, y2c);
-    for (int id = 0; id < k_area; id++)
-    {
-        kernel_x[id] = x2c[id].real();
-        kernel_y[id] = y2c[id].real();
-    }
+    fft2d.ifft_c2r(x2c, kernel_x);
+    fft2d.ifft_c2r(y2c, kernel_y);
 }
 
 void Ricom_kernel::approximate_frequencies(size_t nx_im)
@@ -216,53 +218,194 @@ void Update_list::shift(id_x_y &res, int id, int shift)
 ////////////////////////////////////////////////
 //               SDL plotting                 //
 ////////////////////////////////////////////////
-void Ricom::init_surface()
+// Creating SDL Surface (holding an image in CPU memory)
+static SDL_Surface *create_surface(int w, int h)
 {
-    // Creating SDL Surface (holding the ricom image in CPU memory)
-    srf_ricom = SDL_CreateRGBSurface(0, nx, ny, 32, 0, 0, 0, 0);
-    if (srf_ricom == NULL)
+    SDL_Surface *srf = SDL_CreateRGBSurface(0, w, h, 32, 0, 0, 0, 0);
+    if (srf == NULL)
     {
         std::cout << "Surface could not be created! SDL Error: " << SDL_GetError() << std::endl;
         exit(EXIT_FAILURE);
     }
-    // SDL surface for STEM image
-    srf_stem = SDL_CreateRGBSurface(0, nx, ny, 32, 0, 0, 0, 0);
-    if (srf_stem == NULL)
+    return srf;
+}
+
+// Keeps a surface if it already has the size
+static void fit_surface(SDL_Surface *&srf, int w, int h)
+{
+    if (srf == NULL || srf->w != w || srf->h != h)
     {
-        std::cout << "Surface could not be created! SDL Error: " << SDL_GetError() << std::endl;
-        exit(EXIT_FAILURE);
+        SDL_FreeSurface(srf);
+        srf = create_surface(w, h);
     }
-    // SDL surface for STEM image
-    srf_e_mag = SDL_CreateRGBSurface(0, nx, ny, 32, 0, 0, 0, 0);
-    if (srf_e_mag == NULL)
+}
+
+static void copy_surface(SDL_Surface *&dst, const SDL_Surface *src)
+{
+    if (src == NULL)
     {
-        std::cout << "Surface could not be created! SDL Error: " << SDL_GetError() << std::endl;
-        exit(EXIT_FAILURE);
+        return;
     }
-    // SDL surface for CBED image
-    cbed_log.assign(camera.nx_cam * camera.ny_cam, 0.0);
-    srf_cbed = SDL_CreateRGBSurface(0, camera.nx_cam, camera.ny_cam, 32, 0, 0, 0, 0);
-    if (srf_cbed == NULL)
+    fit_surface(dst, src->w, src->h);
+    memcpy(dst->pixels, src->pixels, static_cast<size_t>(src->h) * src->pitch);
+}
+
+// Copies the rows of a tile, the surfaces have the same size
+static void copy_surface_tile(SDL_Surface *dst, const SDL_Surface *src, int x0, int y0, int x1, int y1)
+{
+    size_t bpp = src->format->BytesPerPixel;
+    for (int y = y0; y < y1; y++)
     {
-        std::cout << "Surface could not be created! SDL Error: " << SDL_GetError() << std::endl;
-        exit(EXIT_FAILURE);
+        size_t o = static_cast<size_t>(y) * src->pitch + x0 * bpp;
+        memcpy(static_cast<char *>(dst->pixels) + o, static_cast<const char *>(src->pixels) + o, (x1 - x0) * bpp);
     }
 }
 
+void Ricom_frame::resize(int nx, int ny, int nx_cam, int ny_cam)
+{
+    size_t nxy = static_cast<size_t>(nx) * ny;
+    this->nx = nx;
+    this->ny = ny;
+    fr_count = 0;
+    ricom_data.assign(nxy, 0);
+    stem_data.assign(nxy, 0);
+    com_map_x.assign(nxy, 0);
+    com_map_y.assign(nxy, 0);
+    e_field_data.assign(nxy, 0);
+    fit_surface(srf_ricom, nx, ny);
+    fit_surface(srf_stem, nx, ny);
+    fit_surface(srf_e_mag, nx, ny);
+    fit_surface(srf_cbed, nx_cam, ny_cam);
+    // All tiles are new, the version keeps counting so that it never repeats for a display
+    version++;
+    int n_tiles = ((nx + DirtyTiles::tile_size - 1) / DirtyTiles::tile_size) *
+                  ((ny + DirtyTiles::tile_size - 1) / DirtyTiles::tile_size);
+    tile_version.assign(n_tiles, version);
+    ricom_limits = {0, 0};
+    stem_limits = {0, 0};
+    com_x_limits = {0, 0};
+    com_y_limits = {0, 0};
+    e_mag_limits = {0, 0};
+}
+
+// Only the tiles which changed since the snapshot held by this frame are copied, the surfaces
+// of the maps entirely if they were redrawn. Vectors and surfaces are only reallocated if the
+// size changed.
+void Ricom_frame::copy_from(const Ricom_frame &src)
+{
+    fr_count = src.fr_count;
+    ricom_limits = src.ricom_limits;
+    stem_limits = src.stem_limits;
+    com_x_limits = src.com_x_limits;
+    com_y_limits = src.com_y_limits;
+    e_mag_limits = src.e_mag_limits;
+    if (cbed_count != src.cbed_count || srf_cbed == NULL)
+    {
+        copy_surface(srf_cbed, src.srf_cbed);
+        cbed_count = src.cbed_count;
+    }
+
+    bool b_tiles = nx == src.nx && ny == src.ny && tile_version.size() == src.tile_version.size() &&
+                   srf_ricom != NULL && srf_stem != NULL && srf_e_mag != NULL;
+    if (!b_tiles)
+    {
+        nx = src.nx;
+        ny = src.ny;
+        ricom_data = src.ricom_data;
+        stem_data = src.stem_data;
+        com_map_x = src.com_map_x;
+        com_map_y = src.com_map_y;
+        e_field_data = src.e_field_data;
+        copy_surface(srf_ricom, src.srf_ricom);
+        copy_surface(srf_stem, src.srf_stem);
+        copy_surface(srf_e_mag, src.srf_e_mag);
+    }
+    else
+    {
+        bool b_redrawn = redraw_version != src.redraw_version;
+        if (b_redrawn)
+        {
+            copy_surface(srf_ricom, src.srf_ricom);
+            copy_surface(srf_stem, src.srf_stem);
+            copy_surface(srf_e_mag, src.srf_e_mag);
+        }
+        const int ts = DirtyTiles::tile_size;
+        const int ntx = (nx + ts - 1) / ts;
+        for (size_t t = 0; t < tile_version.size(); t++)
+        {
+            if (tile_version[t] == src.tile_version[t])
+            {
+                continue;
+            }
+            int x0 = static_cast<int>(t % ntx) * ts;
+            int y0 = static_cast<int>(t / ntx) * ts;
+            int x1 = (std::min)(x0 + ts, nx);
+            int y1 = (std::min)(y0 + ts, ny);
+            for (int y = y0; y < y1; y++)
+            {
+                size_t i0 = static_cast<size_t>(y) * nx + x0;
+                size_t i1 = i0 + (x1 - x0);
+                std::copy(src.ricom_data.begin() + i0, src.ricom_data.begin() + i1, ricom_data.begin() + i0);
+                std::copy(src.stem_data.begin() + i0, src.stem_data.begin() + i1, stem_data.begin() + i0);
+                std::copy(src.com_map_x.begin() + i0, src.com_map_x.begin() + i1, com_map_x.begin() + i0);
+                std::copy(src.com_map_y.begin() + i0, src.com_map_y.begin() + i1, com_map_y.begin() + i0);
+                std::copy(src.e_field_data.begin() + i0, src.e_field_data.begin() + i1, e_field_data.begin() + i0);
+            }
+            if (!b_redrawn)
+            {
+                copy_surface_tile(srf_ricom, src.srf_ricom, x0, y0, x1, y1);
+                copy_surface_tile(srf_stem, src.srf_stem, x0, y0, x1, y1);
+                copy_surface_tile(srf_e_mag, src.srf_e_mag, x0, y0, x1, y1);
+            }
+        }
+    }
+    version = src.version;
+    redraw_version = src.redraw_version;
+    tile_version = src.tile_version;
+}
+
+Ricom_frame::~Ricom_frame()
+{
+    SDL_FreeSurface(srf_ricom);
+    SDL_FreeSurface(srf_stem);
+    SDL_FreeSurface(srf_e_mag);
+    SDL_FreeSurface(srf_cbed);
+}
+
+// Only the render thread draws to the canvas, the display gets copies through update_display()
+void Ricom::init_surface()
+{
+    canvas.resize(nx, ny, camera.nx_cam, camera.ny_cam);
+    dirty_tiles.init(nx, ny);
+    ricom_image.init(nx, ny, false);
+    stem_image.init(nx, ny, false);
+    e_mag_image.init(nx, ny, true);
+    clear_histograms();
+    hist_image = 0;
+    size_t n_px = static_cast<size_t>(camera.nx_cam) * camera.ny_cam;
+    cbed_log.assign(n_px, 0.0);
+    cbed_pending.assign(n_px, 0.0);
+    cbed_render.assign(n_px, 0.0);
+}
+
 ////////////////////////////////////////////////
 //     RICOM class method implementations     //
 ////////////////////////////////////////////////
-Ricom::Ricom() : stem_max(-FLT_MAX), stem_min(FLT_MAX),
-                 update_list(),
-                 e_mag_max(-FLT_MAX), e_mag_min(FLT_MAX),
-                 ricom_max(-FLT_MAX), ricom_min(FLT_MAX),
+Ricom::Ricom() : update_list(),
                  cbed_log(),
-                 ricom_mutex(), stem_mutex(), counter_mutex(), e_field_mutex(),
-                 socket(), file_path(""),
+                 canvas(), frames(), cbed_pending(), cbed_render(),
+                 render_thread(), render_mutex(), render_cv(),
+                 dirty_tiles(), b_render_maps(false), render_count(0),
+                 b_render_cbed(false), b_render_stop(false),
+                 ricom_image(), stem_image(), e_mag_image(), cbed_lut(),
+                 ricom_hist(), stem_hist(), com_x_hist(), com_y_hist(), e_mag_hist(),
+                 tile_fed(), tiles_changed(), hist_image(0),
+                 socket(), file_path(""), record_path(""), shm_publish(""),
                  camera(),
                  mode(RICOM::FILE),
                  b_print2file(false),
                  redraw_interval(50),
+                 contrast_clip(0.1f),
                  last_y(0),
                  p_prog_mon(nullptr),
                  b_busy(false),
@@ -279,14 +422,15 @@ Ricom::Ricom() : stem_max(-FLT_MAX), stem_min(FLT_MAX),
                  nx(256), ny(256), nxy(0),
                  rep(1), fr_total(0),
                  skip_row(1), skip_img(0),
+                 first_row(0), event_window(2), cluster_window(0), events_late(0), events_dropped(0),
+                 events_read_freq(0), events_binned_freq(0),
                  n_threads(1), queue_size(64),
                  fr_freq(0.0), fr_count(0.0), fr_count_total(0.0),
-                 rescale_ricom(false), rescale_stem(false),
                  rc_quit(false),
-                 srf_ricom(NULL), ricom_cmap(9),
-                 srf_stem(NULL), stem_cmap(9),
-                 srf_cbed(NULL), cbed_cmap(5),
-                 srf_e_mag(NULL), e_mag_cmap(12)
+                 view(), ricom_cmap(9),
+                 stem_cmap(9),
+                 cbed_cmap(5),
+                 e_mag_cmap(12)
 {
     n_threads_max = std::thread::hardware_concurrency();
 }
@@ -297,28 +441,42 @@ Ricom::~Ricom(){};
 template <typename T>
 void Ricom::swap_endianess(T &val)
 {
-    if (val > 0 && camera.swap_endian)
+    if constexpr (std::is_floating_point<T>::value)
     {
+        if (camera.swap_endian)
+        {
+            uint32_t bits;
+            memcpy(&bits, &val, sizeof(bits));
+            bits = (bits >> 24) | ((bits & 0xff) << 24) | ((bits & 0xff00) << 8) | ((bits & 0xff0000) >> 8);
+            memcpy(&val, &bits, sizeof(bits));
+        }
+    }
+    else if (camera.swap_endian)
+    {
+        // The bytes are swapped as unsigned, the sign of the value is only known afterwards
+        typename std::make_unsigned<T>::type bits = val;
         switch (sizeof(T))
         {
         case 2:
-            val = (val >> 8) | ((val & 0xff) << 8);
+            bits = (bits >> 8) | ((bits & 0xff) << 8);
             break;
         case 4:
-            val = (val >> 24) | ((val & 0xff) << 24) | ((val & 0xff00) << 8) | ((val & 0xff0000) >> 8);
+            bits = (bits >> 24) | ((bits & 0xff) << 24) | ((bits & 0xff00) << 8) | ((bits & 0xff0000) >> 8);
+            break;
         default:
             break;
         }
+        val = static_cast<T>(bits);
     }
 }
 
 // Compute the centre of mass
 template <typename T>
-void Ricom::com(std::vector<T> *data, std::array<float, 2> &com)
+void Ricom::com(const T *data, std::array<float, 2> &com)
 {
     float dose = 0;
-    std::vector<size_t> sum_x(camera.nx_cam);
-    std::vector<size_t> sum_y(camera.ny_cam);
+    std::vector<acc_t<T>> sum_x(camera.nx_cam);
+    std::vector<acc_t<T>> sum_y(camera.ny_cam);
     sum_x.assign(camera.nx_cam, 0);
     sum_y.assign(camera.ny_cam, 0);
     com = {0.0, 0.0};
@@ -326,10 +484,10 @@ void Ricom::com(std::vector<T> *data, std::array<float, 2> &com)
     for (int idy = 0; idy < camera.ny_cam; idy++)
     {
         size_t y_nx = idy * camera.nx_cam;
-        size_t sum_x_temp = 0;
+        acc_t<T> sum_x_temp = 0;
         for (int idx = 0; idx < camera.nx_cam; idx++)
         {
-            T px = data->data()[y_nx + idx];
+            T px = data[y_nx + idx];
             swap_endianess(px);
             sum_x_temp += px;
             sum_y[idx] += px;
@@ -357,27 +515,17 @@ void Ricom::com(std::vector<T> *data, std::array<float, 2> &com)
 
 // Compute STEM signal
 template <typename T>
-void Ricom::stem(std::vector<T> *data, size_t id_stem)
+void Ricom::stem(const T *data, size_t id_stem)
 {
     T px;
-    size_t stem_temp = 0;
+    acc_t<T> stem_temp = 0;
     for (size_t id : detector.id_list)
     {
-        px = (*data)[id];
+        px = data[id];
+        swap_endianess(px);
         if (px > 0)
         {
-            swap_endianess(px);
             stem_temp += px;
-            if (stem_temp > stem_max)
-            {
-                stem_max = stem_temp;
-                rescale_stem = true;
-            }
-            if (stem_temp < stem_min)
-            {
-                stem_min = stem_temp;
-                rescale_stem = true;
-            }
         }
     }
     stem_data[id_stem] = stem_temp;
@@ -399,16 +547,7 @@ void Ricom::icom(std::array<float, 2> *com, int x, int y)
             ricom_data[idr.id] += com_x * kernel.kernel_x[id] + com_y * kernel.kernel_y[id];
         }
     }
-    if (ricom_data[idc] > ricom_max)
-    {
-        ricom_max = ricom_data[idc];
-        rescale_ricom = true;
-    }
-    if (ricom_data[idc] < ricom_min)
-    {
-        ricom_min = ricom_data[idc];
-        rescale_ricom = true;
-    }
+    dirty_tiles.mark(x - kernel.kernel_size, y - kernel.kernel_size, x + kernel.kernel_size, y + kernel.kernel_size);
 }
 
 // Integrate COM around position x,y
@@ -427,169 +566,343 @@ void Ricom::icom(std::array<float, 2> com, int x, int y)
             ricom_data[idr.id] += com_x * kernel.kernel_x[id] + com_y * kernel.kernel_y[id];
         }
     }
-    if (ricom_data[idc] > ricom_max)
+    dirty_tiles.mark(x - kernel.kernel_size, y - kernel.kernel_size, x + kernel.kernel_size, y + kernel.kernel_size);
+}
+
+// Convert a CBED to log-scale and hand it to the render thread
+template <typename T>
+void Ricom::plot_cbed(const T *cbed_data)
+{
+    size_t n_px = static_cast<size_t>(camera.nx_cam) * camera.ny_cam;
+    for (size_t id = 0; id < n_px; id++)
+    {
+        T vl = cbed_data[id];
+        swap_endianess(vl);
+        cbed_log[id] = log1p((float)vl);
+    }
+
+    std::lock_guard<std::mutex> lock(render_mutex);
+    cbed_log.swap(cbed_pending);
+    b_render_cbed = true;
+}
+
+// Draw the CBED in log-scale to the SDL surface srf_cbed
+void Ricom::draw_cbed_image()
+{
+    float v_min = INFINITY;
+    float v_max = 0.0;
+    for (float vl_f : cbed_render)
     {
-        ricom_max = ricom_data[idc];
-        rescale_ricom = true;
+        if (vl_f > v_max)
+        {
+            v_max = vl_f;
+        }
+        if (vl_f < v_min)
+        {
+            v_min = vl_f;
+        }
     }
-    if (ricom_data[idc] < ricom_min)
+
+    // The CBED is shown transposed, each row is gathered first
+    cbed_lut.set(cbed_cmap);
+    std::vector<float> row(camera.ny_cam);
+    for (int iy = 0; iy < camera.nx_cam; iy++)
     {
-        ricom_min = ricom_data[idc];
-        rescale_ricom = true;
+        for (int ix = 0; ix < camera.ny_cam; ix++)
+        {
+            row[ix] = cbed_render[camera.v[ix] * camera.nx_cam + camera.u[iy]];
+        }
+        cbed_lut.draw_row(canvas.srf_cbed, iy, &row[0], camera.ny_cam, v_min, v_max - v_min);
     }
 }
 
-// Redraws the entire ricom image
-void Ricom::draw_ricom_image()
+// Copies a tile of the result maps into the canvas. Tiles are copied while the workers may
+// still write to them, which marks them again for the next snapshot; the images are only ever
+// drawn from the copy.
+void Ricom::copy_tile(int x0, int y0, int x1, int y1)
 {
-    std::lock_guard<std::mutex> lock(ricom_mutex);
-    for (int y = 0; y < ny; y++)
+    for (int y = y0; y < y1; y++)
     {
-        for (int x = 0; x < nx; x++)
+        size_t i0 = static_cast<size_t>(y) * nx + x0;
+        size_t i1 = static_cast<size_t>(y) * nx + x1;
+        std::copy(ricom_data.begin() + i0, ricom_data.begin() + i1, canvas.ricom_data.begin() + i0);
+        std::copy(com_map_x.begin() + i0, com_map_x.begin() + i1, canvas.com_map_x.begin() + i0);
+        std::copy(com_map_y.begin() + i0, com_map_y.begin() + i1, canvas.com_map_y.begin() + i0);
+        if (b_vSTEM)
         {
-            set_ricom_pixel(x, y);
+            std::copy(stem_data.begin() + i0, stem_data.begin() + i1, canvas.stem_data.begin() + i0);
+        }
+        if (b_e_mag)
+        {
+            std::copy(e_field_data.begin() + i0, e_field_data.begin() + i1, canvas.e_field_data.begin() + i0);
         }
     }
 }
 
-// Redraws the ricom image from line y0 to line ye
-void Ricom::draw_ricom_image(int y0, int ye)
+// Adds (or removes) the pixels x0..x1-1, y0..y1-1 of the canvas with an index from i0 to i1-1
+// in the image to (or from) the histograms of the maps
+void Ricom::feed_tile(int x0, int y0, int x1, int y1, size_t i0, size_t i1, bool b_add)
 {
-    std::lock_guard<std::mutex> lock(ricom_mutex);
-    for (int y = y0; y <= ye; y++)
+    auto feed = [b_add](Histogram &hist, float v)
+    {
+        if (b_add)
+        {
+            hist.add(v);
+        }
+        else
+        {
+            hist.remove(v);
+        }
+    };
+    for (int y = y0; y < y1; y++)
     {
-        for (int x = 0; x < nx; x++)
+        size_t r0 = (std::max)(static_cast<size_t>(y) * nx + x0, i0);
+        size_t r1 = (std::min)(static_cast<size_t>(y) * nx + x1, i1);
+        for (size_t i = r0; i < r1; i++)
         {
-            set_ricom_pixel(x, y);
+            feed(ricom_hist, canvas.ricom_data[i]);
+            feed(com_x_hist, canvas.com_map_x[i]);
+            feed(com_y_hist, canvas.com_map_y[i]);
+            if (b_vSTEM)
+            {
+                feed(stem_hist, canvas.stem_data[i]);
+            }
+            if (b_e_mag)
+            {
+                feed(e_mag_hist, std::abs(canvas.e_field_data[i]));
+            }
         }
     }
 }
 
-// set pixel in ricom image srf_ricom at location idx, idy to value corresponding
-// value in ricom_data array
-void Ricom::set_ricom_pixel(int idx, int idy)
+void Ricom::clear_histograms()
 {
-    // determine location index of value in memory
-    int idr = idy * nx + idx;
-    float val = (ricom_data[idr] - ricom_min) / (ricom_max - ricom_min);
-
-    // Update pixel at location
-    SDL_Utils::draw_pixel(srf_ricom, idx, idy, val, ricom_cmap);
+    ricom_hist.clear();
+    stem_hist.clear();
+    com_x_hist.clear();
+    com_y_hist.clear();
+    e_mag_hist.clear();
+    tile_fed.assign(static_cast<size_t>(dirty_tiles.tiles_x()) * dirty_tiles.tiles_y(), 0);
 }
 
-// Redraws the entire stem image
-void Ricom::draw_stem_image()
+// Takes the clipped range of each histogram as contrast, unless it moved by less than a step
+// of the 8 bit colors, which would only remap the images for nothing
+void Ricom::update_limits()
 {
-    std::lock_guard<std::mutex> lock(stem_mutex);
-    for (int y = 0; y < ny; y++)
+    auto update = [this](const Histogram &hist, std::array<float, 2> &limits)
     {
-        for (int x = 0; x < nx; x++)
+        float v_min;
+        float v_max;
+        if (!hist.limits(contrast_clip, v_min, v_max))
+        {
+            return;
+        }
+        float tol = (limits[1] - limits[0]) / 256.0f;
+        if (std::abs(v_min - limits[0]) > tol || std::abs(v_max - limits[1]) > tol || tol <= 0.0f)
         {
-            set_stem_pixel(x, y);
+            limits = {v_min, v_max};
         }
+    };
+    update(ricom_hist, canvas.ricom_limits);
+    update(com_x_hist, canvas.com_x_limits);
+    update(com_y_hist, canvas.com_y_limits);
+    if (b_vSTEM)
+    {
+        update(stem_hist, canvas.stem_limits);
+    }
+    if (b_e_mag)
+    {
+        update(e_mag_hist, canvas.e_mag_limits);
     }
 }
 
-// Redraws the stem image from line y0 to line ye
-void Ricom::draw_stem_image(int y0, int ye)
+// Snapshots and redraws the tiles marked by the integration. The histograms follow the values
+// in the canvas, so that their percentiles set the contrast; pixels enter them once integrated.
+// A new contrast or colormap then only remaps the levels of the images, unless the range left
+// the one they were quantized for.
+void Ricom::render_tiles(bool b_draw)
 {
-    std::lock_guard<std::mutex> lock(stem_mutex);
-    for (int y = y0; y <= ye; y++)
+    size_t count = static_cast<size_t>(canvas.fr_count);
+    size_t image = (count > 0) ? (count - 1) / nxy : 0;
+    if (image != hist_image)
+    {
+        clear_histograms();
+        hist_image = image;
+    }
+    size_t n_done = count - image * nxy;
+
+    const int ts = DirtyTiles::tile_size;
+    const int ntx = dirty_tiles.tiles_x();
+    tiles_changed.clear();
+    for (int ty = 0; ty < dirty_tiles.tiles_y(); ty++)
     {
-        for (int x = 0; x < nx; x++)
+        for (int tx = 0; tx < ntx; tx++)
         {
-            set_stem_pixel(x, y);
+            int t = ty * ntx + tx;
+            int x0 = tx * ts;
+            int y0 = ty * ts;
+            int x1 = (std::min)(x0 + ts, nx);
+            int y1 = (std::min)(y0 + ts, ny);
+            if (dirty_tiles.take(tx, ty))
+            {
+                feed_tile(x0, y0, x1, y1, 0, tile_fed[t], false);
+                copy_tile(x0, y0, x1, y1);
+                feed_tile(x0, y0, x1, y1, 0, n_done, true);
+                tile_fed[t] = n_done;
+                tiles_changed.push_back(t);
+            }
+            else if (tile_fed[t] < n_done && tile_fed[t] < static_cast<size_t>(y1 - 1) * nx + x1 &&
+                     static_cast<size_t>(y0) * nx + x0 < n_done)
+            {
+                // Pixels integrated since the tile was copied
+                feed_tile(x0, y0, x1, y1, tile_fed[t], n_done, true);
+                tile_fed[t] = n_done;
+            }
         }
     }
-}
+    update_limits();
 
-void Ricom::draw_e_field_image(int y0, int ye)
-{
-    std::lock_guard<std::mutex> lock(e_field_mutex);
-    for (int y = y0; y <= ye; y++)
+    bool b_ricom = false;
+    bool b_stem = false;
+    bool b_e_field = false;
+    if (b_draw)
+    {
+        const std::array<float, 2> &r = canvas.ricom_limits;
+        const std::array<float, 2> &s = canvas.stem_limits;
+        const std::array<float, 2> &e = canvas.e_mag_limits;
+        b_ricom = ricom_image.set(ricom_cmap, 1.0f, r[0], r[1] - r[0]);
+        b_stem = b_vSTEM && stem_image.set(stem_cmap, 1.0f, s[0], s[1] - s[0]);
+        b_e_field = b_e_mag && e_mag_image.set(e_mag_cmap, 1.0f, e[0], e[1] - e[0]);
+    }
+
+    uint32_t version = canvas.version + 1;
+    for (int t : tiles_changed)
     {
-        for (int x = 0; x < nx; x++)
+        canvas.tile_version[t] = version;
+        if (!b_draw)
+        {
+            continue;
+        }
+        int x0 = (t % ntx) * ts;
+        int y0 = (t / ntx) * ts;
+        int x1 = (std::min)(x0 + ts, nx);
+        int y1 = (std::min)(y0 + ts, ny);
+        ricom_image.draw(canvas.srf_ricom, canvas.ricom_data.data(), x0, y0, x1, y1);
+        if (b_vSTEM)
+        {
+            stem_image.draw(canvas.srf_stem, canvas.stem_data.data(), x0, y0, x1, y1);
+        }
+        if (b_e_mag)
         {
-            set_e_field_pixel(x, y);
+            e_mag_image.draw(canvas.srf_e_mag, canvas.e_field_data.data(), x0, y0, x1, y1);
         }
     }
+    if (!tiles_changed.empty())
+    {
+        canvas.version = version;
+    }
+    if (b_ricom || b_stem || b_e_field)
+    {
+        canvas.redraw_version++;
+    }
+
+    if (b_ricom)
+    {
+        ricom_image.redraw(canvas.srf_ricom, canvas.ricom_data.data());
+    }
+    if (b_stem)
+    {
+        stem_image.redraw(canvas.srf_stem, canvas.stem_data.data());
+    }
+    if (b_e_field)
+    {
+        e_mag_image.redraw(canvas.srf_e_mag, canvas.e_field_data.data());
+    }
 }
 
-void Ricom::draw_e_field_image()
+// Waits for reports of the progress, updates the canvas and publishes a copy of it for the display
+void Ricom::run_render()
 {
-    std::lock_guard<std::mutex> lock(e_field_mutex);
-    for (int y = 0; y < ny; y++)
+    std::unique_lock<std::mutex> lock(render_mutex);
+    while (true)
     {
-        for (int x = 0; x < nx; x++)
+        render_cv.wait(lock, [this]
+                       { return b_render_maps || b_render_cbed || b_render_stop; });
+        bool b_stop = b_render_stop;
+        bool b_maps = b_render_maps;
+        b_render_maps = false;
+        bool b_cbed = b_render_cbed;
+        if (b_cbed)
         {
-            set_e_field_pixel(x, y);
+            cbed_pending.swap(cbed_render);
+            b_render_cbed = false;
         }
-    }
-}
+        canvas.fr_count = render_count;
+        lock.unlock();
 
-// set pixel in stem image srf_stem at location idx, idy to value corresponding
-// value in stem_data array
-void Ricom::set_stem_pixel(size_t idx, size_t idy)
-{
-    // determine location index of value in memory
-    int idr = idy * nx + idx;
-    float val = (stem_data[idr] - stem_min) / (stem_max - stem_min);
+        if (b_stop)
+        {
+            // The complete images, also if they were not shown while running
+            dirty_tiles.mark_all();
+            render_tiles(true);
+        }
+        else if (b_maps)
+        {
+            render_tiles(b_plot2SDL);
+        }
+        if (b_cbed)
+        {
+            draw_cbed_image();
+            canvas.cbed_count++;
+        }
+        frames.back().copy_from(canvas);
+        frames.publish();
 
-    // Update pixel at location
-    SDL_Utils::draw_pixel(srf_stem, idx, idy, val, stem_cmap);
+        lock.lock();
+        if (b_stop)
+        {
+            return;
+        }
+    }
 }
 
-// set pixel in stem image srf_stem at location idx, idy to value corresponding
-// value in stem_data array
-void Ricom::set_e_field_pixel(size_t idx, size_t idy)
+void Ricom::start_render()
 {
-    // determine location index of value in memory
-    int idr = idy * nx + idx;
-    float mag = (abs(e_field_data[idr]) - e_mag_min) / (e_mag_max - e_mag_min);
-    float ang = arg(e_field_data[idr]);
-
-    // Update pixel at location
-    SDL_Utils::draw_pixel(srf_e_mag, idx, idy, ang, mag, e_mag_cmap);
+    b_render_maps = false;
+    render_count = 0;
+    b_render_cbed = false;
+    b_render_stop = false;
+    // A first blank frame, so that the display has its surfaces right away
+    frames.back().copy_from(canvas);
+    frames.publish();
+    render_thread = std::thread(&Ricom::run_render, this);
 }
 
-// Draw a CBED in log-scale to the SDL surface srf_cbed
-template <typename T>
-void Ricom::plot_cbed(std::vector<T> *cbed_data)
+void Ricom::stop_render()
 {
-    float v_min = INFINITY;
-    float v_max = 0.0;
-
-    for (size_t id = 0; id < (*cbed_data).size(); id++)
     {
-        T vl = (*cbed_data)[id];
-        swap_endianess(vl);
-        float vl_f = log1p((float)vl);
-        if (vl_f > v_max)
-        {
-            v_max = vl_f;
-        }
-        if (vl_f < v_min)
-        {
-            v_min = vl_f;
-        }
-        cbed_log[id] = vl_f;
+        std::lock_guard<std::mutex> lock(render_mutex);
+        b_render_stop = true;
     }
+    render_cv.notify_one();
+    if (render_thread.joinable())
+    {
+        render_thread.join();
+    }
+}
 
-    float v_rng = v_max - v_min;
-    for (int ix = 0; ix < camera.ny_cam; ix++)
+// Takes the newest frame of the render thread into view, call only from the thread showing it
+bool Ricom::update_display()
+{
+    if (!frames.update())
     {
-        int iy_t = camera.v[ix] * camera.nx_cam;
-        for (int iy = 0; iy < camera.nx_cam; iy++)
-        {
-            float vl_f = cbed_log[iy_t + camera.u[iy]];
-            float val = (vl_f - v_min) / v_rng;
-            SDL_Utils::draw_pixel(srf_cbed, ix, iy, val, cbed_cmap);
-        }
+        return false;
     }
+    view.copy_from(frames.front());
+    return true;
 }
 
-// Rescales the images according to updated min and max values
-// and recomputes the Kernel if settings changed
+// Recomputes the detector and the Kernel if settings changed
 inline void Ricom::rescales_recomputes()
 {
     if (b_recompute_detector)
@@ -603,26 +916,6 @@ inline void Ricom::rescales_recomputes()
         update_list.init(kernel, nx, ny);
         b_recompute_kernel = false;
     }
-
-    if (rescale_ricom)
-    {
-        rescale_ricom = false;
-    };
-    if (b_vSTEM)
-    {
-        if (rescale_stem)
-        {
-            rescale_stem = false;
-        };
-    };
-
-    if (b_e_mag)
-    {
-        if (rescale_e_mag)
-        {
-            rescale_e_mag = false;
-        };
-    };
 }
 
 // Skip n frames
@@ -631,93 +924,55 @@ void Ricom::skip_frames(int n_skip, std::vector<T> &data, CAMERA::Camera<CameraI
 {
     for (int si = 0; si < n_skip; si++)
     {
-        camera_fr->read_frame(data, true);
+        camera_fr->next_frame(data, true);
     }
 }
 
-// Compute COM and iCOM for a frame (copy data)
+// Compute COM and iCOM for a frame
 template <typename T>
-void Ricom::com_icom(std::vector<T> data, int ix, int iy, std::array<float, 2> *com_xy_sum, ProgressMonitor *p_prog_mon)
+void Ricom::com_icom(const T *p_data, int ix, int iy, ProgressMonitor *p_prog_mon,
+                     std::vector<T> *p_cbed_frame, std::atomic<int> *p_cbed_state)
 {
-    std::vector<T> *data_ptr = &data;
-
     std::array<float, 2> com_xy = {0.0, 0.0};
-    com<T>(data_ptr, com_xy);
+    com<T>(p_data, com_xy);
     icom(com_xy, ix, iy);
 
     size_t id = iy * nx + ix;
 
     if (b_vSTEM)
     {
-        stem(data_ptr, id);
+        stem(p_data, id);
     }
     if (b_e_mag)
     {
         compute_electric_field(com_xy, id);
     }
 
-    com_xy_sum->at(0) += com_xy[0];
-    com_xy_sum->at(1) += com_xy[1];
-
     com_map_x[id] = com_xy[0];
     com_map_y[id] = com_xy[1];
 
-    counter_mutex.lock();
-    ++(*p_prog_mon);
-    fr_count = p_prog_mon->fr_count;
-    if (p_prog_mon->report_set)
+    // The first worker to see the request hands its frame to the reporter
+    int cbed_wanted = 0;
+    if (b_plot_cbed && p_cbed_state->load(std::memory_order_relaxed) == 0 &&
+        p_cbed_state->compare_exchange_strong(cbed_wanted, 1, std::memory_order_acquire))
     {
-        update_surfaces(iy, data_ptr);
-        last_y = iy;
-        fr_freq = p_prog_mon->fr_freq;
-        rescales_recomputes();
-        for (int i = 0; i < 2; i++)
-        {
-            com_public[i] = com_xy_sum->at(i) / p_prog_mon->fr_count_i;
-            com_xy_sum->at(i) = 0;
-        }
-        p_prog_mon->reset_flags();
+        std::copy(p_data, p_data + p_cbed_frame->size(), p_cbed_frame->begin());
+        p_cbed_state->store(2, std::memory_order_release);
     }
-    counter_mutex.unlock();
+    p_prog_mon->add(com_xy);
 }
 
-// Compute COM and iCOM for a frame (reference data)
+// Redraw and publish the progress, called by the reporter thread of the ProgressMonitor
 template <typename T>
-void Ricom::com_icom(std::vector<T> *data_ptr, int ix, int iy, std::array<float, 2> *com_xy_sum, ProgressMonitor *p_prog_mon)
+void Ricom::report_progress(ProgressMonitor &prog_mon, size_t count, const std::array<float, 2> &com_mean, const T *p_frame)
 {
-    std::array<float, 2> com_xy = {0.0, 0.0};
-    com<T>(data_ptr, com_xy);
-    icom(com_xy, ix, iy);
-
-    size_t id = iy * nx + ix;
-    if (b_vSTEM)
-    {
-        stem(data_ptr, id);
-    }
-    if (b_e_mag)
-    {
-        compute_electric_field(com_xy, id);
-    }
-    com_xy_sum->at(0) += com_xy[0];
-    com_xy_sum->at(1) += com_xy[1];
-
-    ++(*p_prog_mon);
-    com_map_x[id] = com_xy[0];
-    com_map_y[id] = com_xy[1];
-    fr_count = p_prog_mon->fr_count;
-    if (p_prog_mon->report_set)
-    {
-        update_surfaces(iy, data_ptr);
-        last_y = iy;
-        fr_freq = p_prog_mon->fr_freq;
-        rescales_recomputes();
-        for (int i = 0; i < 2; i++)
-        {
-            com_public[i] = com_xy_sum->at(i) / p_prog_mon->fr_count_i;
-            com_xy_sum->at(i) = 0;
-        }
-        p_prog_mon->reset_flags();
-    }
+    int iy = static_cast<int>(((count - 1) % nxy) / nx);
+    update_surfaces(count, p_frame);
+    last_y = iy;
+    fr_count = count;
+    fr_freq = prog_mon.fr_freq;
+    rescales_recomputes();
+    com_public = com_mean;
 }
 
 // Compute electric field magnitude
@@ -725,16 +980,6 @@ void Ricom::compute_electric_field(std::array<float, 2> &com_xy, size_t id)
 {
     float e_mag = std::hypot(com_xy[0] - offset[0], com_xy[1] - offset[1]);
     float e_ang = atan2(com_xy[0] - offset[0], com_xy[1] - offset[1]);
-    if (e_mag > e_mag_max)
-    {
-        e_mag_max = e_mag;
-        rescale_e_mag = true;
-    }
-    if (e_mag < e_mag_min)
-    {
-        e_mag_min = e_mag;
-        rescale_e_mag = true;
-    }
     e_field_data[id] = std::polar(e_mag, e_ang);
 }
 
@@ -745,19 +990,29 @@ void Ricom::process_data(CAMERA::Camera<CameraInterface, CAMERA::FRAME_BASED> *c
     // Memory allocation
     int cam_xy = camera_spec->nx_cam * camera_spec->ny_cam;
     std::vector<T> data(cam_xy);
-    std::vector<T> *p_data = &data;
     BoundedThreadPool pool;
 
     // Start Thread Pool
     if (n_threads > 1)
         pool.init(n_threads, queue_size);
 
-    std::array<float, 2> com_xy_sum = {0.0, 0.0};
-    std::array<float, 2> *p_com_xy_sum = &com_xy_sum;
+    // A worker copies its frame for the CBED plot after each report (0: wanted, 1: copying, 2: ready)
+    std::vector<T> cbed_frame(cam_xy);
+    std::atomic<int> cbed_state(0);
+    std::vector<T> *p_cbed_frame = &cbed_frame;
+    std::atomic<int> *p_cbed_state = &cbed_state;
 
-    // Initialize ProgressMonitor Object
+    // Initialize ProgressMonitor Object, the workers only count and the reporter thread redraws
     ProgressMonitor prog_mon(fr_total, !b_print2file, redraw_interval);
     p_prog_mon = &prog_mon;
+    prog_mon.start([&](size_t count, const std::array<float, 2> &com_mean)
+                   {
+                       bool b_cbed = cbed_state.load(std::memory_order_acquire) == 2;
+                       report_progress(prog_mon, count, com_mean, b_cbed ? &cbed_frame[0] : static_cast<const T *>(nullptr));
+                       if (b_cbed)
+                       {
+                           cbed_state.store(0, std::memory_order_release);
+                       } });
 
     for (int ir = 0; ir < rep; ir++)
     {
@@ -766,21 +1021,32 @@ void Ricom::process_data(CAMERA::Camera<CameraInterface, CAMERA::FRAME_BASED> *c
         {
             for (int ix = 0; ix < nx; ix++)
             {
-                camera_spec->read_frame(data, !p_prog_mon->first_frame);
+                const T *p_frame = camera_spec->next_frame(data, !p_prog_mon->first_frame);
                 p_prog_mon->first_frame = false;
                 if (n_threads > 1)
                 {
-                    pool.push_task([=]
-                                   { com_icom<T>(data, ix, iy, p_com_xy_sum, p_prog_mon); });
+                    if (p_frame == &data[0])
+                    {
+                        // The buffer is reused for the next frame, the task gets a copy
+                        pool.push_task([=]
+                                       { com_icom<T>(&data[0], ix, iy, p_prog_mon, p_cbed_frame, p_cbed_state); });
+                    }
+                    else
+                    {
+                        // Frame stays valid in memory owned by the interface (zero-copy)
+                        pool.push_task([=]
+                                       { com_icom<T>(p_frame, ix, iy, p_prog_mon, p_cbed_frame, p_cbed_state); });
+                    }
                 }
                 else
                 {
-                    com_icom<T>(p_data, ix, iy, p_com_xy_sum, p_prog_mon);
+                    com_icom<T>(p_frame, ix, iy, p_prog_mon, p_cbed_frame, p_cbed_state);
                 }
 
                 if (rc_quit)
                 {
                     pool.wait_for_completion();
+                    prog_mon.stop();
                     p_prog_mon = nullptr;
                     return;
                 };
@@ -798,40 +1064,170 @@ void Ricom::process_data(CAMERA::Camera<CameraInterface, CAMERA::FRAME_BASED> *c
             offset[1] = com_public[1];
         }
     }
+    prog_mon.stop();
     p_prog_mon = nullptr;
 }
 
+// Wakes the render thread, which snapshots the tiles the integration marked since the last report
 template <typename T>
-void Ricom::update_surfaces(int iy, std::vector<T> *p_frame)
+void Ricom::update_surfaces(size_t count, const T *p_frame)
 {
-    if (b_plot2SDL)
+    // No frame while the event pipeline is still accumulating one
+    if (b_plot_cbed && p_frame != nullptr)
     {
-        draw_ricom_image((std::max)(0, last_y - kernel.kernel_size), (std::min)(iy + kernel.kernel_size, ny - 1));
-        if (b_vSTEM)
+        plot_cbed(p_frame);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(render_mutex);
+        b_render_maps = true;
+        render_count = static_cast<int>(count);
+    }
+    render_cv.notify_one();
+}
+// The detector offset is handed from the integrator to the binner as one atomic word
+static inline uint64_t pack_offset(const std::array<float, 2> &offset)
+{
+    uint64_t bits;
+    memcpy(&bits, offset.data(), sizeof(bits));
+    return bits;
+}
+
+static inline std::array<float, 2> unpack_offset(uint64_t bits)
+{
+    std::array<float, 2> offset;
+    memcpy(offset.data(), &bits, sizeof(bits));
+    return offset;
+}
+
+// Process EVENT_BASED camera data as a pipeline of three stages: the camera interface reads
+// event blocks ahead on its own thread, this thread bins them by probe position, and the sums
+// of completed positions are integrated (COM, iCOM, surfaces) by integrate_events() on a third.
+template <class CameraInterface>
+void Ricom::process_data(CAMERA::Camera<CameraInterface, CAMERA::EVENT_BASED> *camera_spec)
+{
+    // Mapped files are binned on all threads
+    if (n_threads > 1 && camera_spec->n_events() > 0)
+    {
+        process_events_sharded(camera_spec);
+        return;
+    }
+
+    // Memory allocation, the maps are a ring over the probe positions not yet integrated
+    std::vector<uint32_t> dose_map(nxy);
+    std::vector<uint32_t> sumx_map(nxy);
+    std::vector<uint32_t> sumy_map(nxy);
+    std::vector<float> stem_map(nxy);
+    std::vector<uint16_t> frame(camera_spec->nx_cam * camera_spec->ny_cam);
+    // The frame is filled by the binner until b_frame_ready, then plotted and cleared by the integrator
+    std::atomic<bool> b_frame_ready(false);
+    SpscQueue<PositionSums> completed(1 << 16);
+    int acc_cbed = 0;
+    size_t acc_idx = 0;
+
+    size_t fr_total_u = (size_t)fr_total;
+    size_t nxy_u = (size_t)nxy;
+    // Events are accepted up to event_window positions behind the read position, later ones are dropped.
+    // Positions also wait for the clusters still open on them.
+    size_t window = (std::max)((size_t)(std::max)(event_window, 1), camera_spec->cluster_positions());
+    size_t p_done = 0; // Next probe position to hand to the integrator
+    // Positions in the event stream are offset by the first position of the reconstruction
+    size_t p_start = camera_spec->first_position();
+    std::atomic<size_t> p_read_abs(p_start);
+    // The integrator moves the offset at the end of each image, the binner only reads this copy
+    std::atomic<uint64_t> offset_bits(pack_offset(offset));
+    std::array<float, 2> bin_offset = offset;
+
+    reinit_vectors_limits();
+    events_late = 0;
+    events_dropped = 0;
+    std::thread integrator(&Ricom::integrate_events<CameraInterface>, this, camera_spec,
+                           std::ref(completed), std::ref(frame), std::ref(b_frame_ready),
+                           std::ref(offset_bits));
+
+    for (size_t p_read = 1;; p_read++)
+    {
+        p_read_abs = p_start + p_read;
+        bin_offset = unpack_offset(offset_bits.load(std::memory_order_acquire));
+        if (b_plot_cbed && !b_frame_ready.load(std::memory_order_acquire))
         {
-            draw_stem_image(last_y, iy);
+            if (acc_cbed == 0)
+            {
+                acc_idx = p_read;
+            }
+            camera_spec->read_frame_com_cbed(p_read_abs,
+                                             dose_map, sumx_map, sumy_map,
+                                             stem_map, b_vSTEM,
+                                             bin_offset, detector.radius2,
+                                             frame, p_start + acc_idx,
+                                             p_start + p_done, p_start + p_done + nxy_u);
+            if (++acc_cbed == 3)
+            {
+                acc_cbed = 0;
+                b_frame_ready.store(true, std::memory_order_release);
+            }
         }
-        if (b_e_mag)
+        else
         {
-            draw_e_field_image(last_y, iy);
+            camera_spec->read_frame_com(p_read_abs,
+                                        dose_map, sumx_map, sumy_map,
+                                        stem_map, b_vSTEM,
+                                        bin_offset, detector.radius2,
+                                        p_start + p_done, p_start + p_done + nxy_u);
+        }
+
+        // Watermark: positions at least event_window behind the read position are complete,
+        // at the end of the scan or stream all remaining positions are
+        bool b_end = p_read >= fr_total_u || camera_spec->end_of_stream();
+        if (b_end && window > 1 && !camera_spec->end_of_stream() && !rc_quit)
+        {
+            // Late events of the last positions can follow up to the window after them
+            p_read_abs = p_start + p_read + window - 1;
+            camera_spec->read_frame_com(p_read_abs, dose_map, sumx_map, sumy_map, stem_map, b_vSTEM,
+                                        bin_offset, detector.radius2, p_start + p_done, p_start + p_done + nxy_u);
+        }
+        size_t p_ready = b_end ? (std::min)(p_read + 1, fr_total_u) : ((p_read + 1 > window) ? p_read + 1 - window : 0);
+
+        for (; p_done < p_ready; p_done++)
+        {
+            // The slot is reused for the same position of the next image
+            size_t idxx = p_done % nxy_u;
+            PositionSums sums = {dose_map[idxx], sumx_map[idxx], sumy_map[idxx], stem_map[idxx]};
+            dose_map[idxx] = 0;
+            sumx_map[idxx] = 0;
+            sumy_map[idxx] = 0;
+            stem_map[idxx] = 0;
+            if (!completed.push(sums))
+            {
+                break;
+            }
+        }
+
+        if (b_end || rc_quit || completed.is_closed())
+        {
+            break;
         }
     }
-    if (b_plot_cbed)
+    completed.close();
+    integrator.join();
+
+    events_late = camera_spec->events_late();
+    events_dropped = camera_spec->events_dropped();
+    if (events_late > 0 || events_dropped > 0)
     {
-        plot_cbed(p_frame);
+        std::cout << std::endl
+                  << "Events out of order: " << events_late << " counted within the window of "
+                  << window << " positions, " << events_dropped << " dropped" << std::endl;
     }
 }
-// Process EVENT_BASED camera data
+
+// Integration stage of the event pipeline: COM and iCOM of the completed probe positions in
+// order, surface updates and progress. Returns when the queue is closed and drained.
 template <class CameraInterface>
-void Ricom::process_data(CAMERA::Camera<CameraInterface, CAMERA::EVENT_BASED> *camera_spec)
+void Ricom::integrate_events(CAMERA::Camera<CameraInterface, CAMERA::EVENT_BASED> *camera_spec,
+                             SpscQueue<PositionSums> &completed, std::vector<uint16_t> &frame,
+                             std::atomic<bool> &b_frame_ready, std::atomic<uint64_t> &offset_bits)
 {
-    // Memory allocation
-    std::vector<size_t> dose_map(nxy);
-    std::vector<size_t> sumx_map(nxy);
-    std::vector<size_t> sumy_map(nxy);
-    std::vector<uint16_t> frame(camera_spec->nx_cam * camera_spec->ny_cam);
-    std::vector<uint16_t> *p_frame = &frame;
-
     BoundedThreadPool pool;
 
     // Start Thread Pool
@@ -840,135 +1236,284 @@ void Ricom::process_data(CAMERA::Camera<CameraInterface, CAMERA::EVENT_BASED> *c
 
     std::array<float, 2> com_xy = {0.0, 0.0};
     std::array<float, 2> *p_com_xy = &com_xy;
-    std::array<float, 2> com_xy_sum = {0.0, 0.0};
 
     int ix = 0;
     int iy = 0;
-    int acc_cbed = 0;
-    int acc_idx = 0;
-
-    size_t img_num = 0;
-    size_t first_frame = img_num * nxy;
-    size_t end_frame = (img_num + 1) * nxy;
     size_t fr_total_u = (size_t)fr_total;
-
+    size_t nxy_u = (size_t)nxy;
+    size_t p_done = 0;
+    PositionSums sums;
+    // Cluster centroids are summed in fixed point
+    int com_bits = camera_spec->com_bits();
+    float com_scale = 1.0f / (1 << com_bits);
+
+    // Throughput of the reader and binner stages, measured between reports
+    auto t_last = chc::steady_clock::now();
+    size_t n_read_last = 0;
+    size_t n_binned_last = 0;
+    events_read_freq = 0;
+    events_binned_freq = 0;
+
+    // The reporter thread redraws and takes over the CBED frame once the binner has filled it
     ProgressMonitor prog_mon(fr_total, !b_print2file, redraw_interval);
     p_prog_mon = &prog_mon;
-
-    dose_map.assign(nxy, 0);
-    sumx_map.assign(nxy, 0);
-    sumy_map.assign(nxy, 0);
-    reinit_vectors_limits();
-
-    while (true)
+    prog_mon.start([&](size_t count, const std::array<float, 2> &com_mean)
+                   {
+                       if (b_frame_ready.load(std::memory_order_acquire))
+                       {
+                           report_progress(prog_mon, count, com_mean, &frame[0]);
+                           frame.assign(camera_spec->nx_cam * camera_spec->ny_cam, 0);
+                           b_frame_ready.store(false, std::memory_order_release);
+                       }
+                       else
+                       {
+                           report_progress(prog_mon, count, com_mean, static_cast<const uint16_t *>(nullptr));
+                       }
+                       events_late = camera_spec->events_late();
+                       events_dropped = camera_spec->events_dropped();
+
+                       auto t_now = chc::steady_clock::now();
+                       float dt_s = chc::duration<float>(t_now - t_last).count();
+                       size_t n_read = camera_spec->events_read();
+                       size_t n_binned = camera_spec->events_binned();
+                       if (dt_s > 0)
+                       {
+                           events_read_freq = (n_read - n_read_last) / dt_s * 1e-6f;
+                           events_binned_freq = (n_binned - n_binned_last) / dt_s * 1e-6f;
+                       }
+                       t_last = t_now;
+                       n_read_last = n_read;
+                       n_binned_last = n_binned; });
+
+    while (completed.pop(sums))
     {
-        // process two frames before the probe position to avoid toa problem
-        int idxx = prog_mon.fr_count - nxy * img_num - 2;
+        size_t idxx = p_done % nxy_u;
+        if (sums.dose == 0)
+        {
+            com_xy[0] = offset[0];
+            com_xy[1] = offset[1];
+        }
+        else if (com_bits == 0)
+        {
+            com_xy[0] = sums.sumx / sums.dose;
+            com_xy[1] = sums.sumy / sums.dose;
+        }
+        else
+        {
+            com_xy[0] = (float)sums.sumx / sums.dose * com_scale;
+            com_xy[1] = (float)sums.sumy / sums.dose * com_scale;
+        }
+        com_map_x[idxx] = com_xy[0];
+        com_map_y[idxx] = com_xy[1];
+        if (b_vSTEM)
+        {
+            stem_data[idxx] = sums.stem;
+        }
 
-        ++prog_mon;
-        fr_count = prog_mon.fr_count;
+        ix = idxx % nx;
+        iy = idxx / nx;
 
-        if (acc_cbed < 3 && b_plot_cbed)
+        if (n_threads > 1)
         {
-            camera_spec->read_frame_com_cbed(prog_mon.fr_count,
-                                             dose_map, sumx_map, sumy_map,
-                                             stem_data, b_vSTEM,
-                                             offset, detector.radius2,
-                                             frame, acc_idx,
-                                             first_frame, end_frame);
-            acc_cbed += 1;
+            pool.push_task([=]
+                           { icom(com_xy, ix, iy); });
         }
         else
         {
-            camera_spec->read_frame_com(prog_mon.fr_count,
-                                        dose_map, sumx_map, sumy_map,
-                                        stem_data, b_vSTEM,
-                                        offset, detector.radius2,
-                                        first_frame, end_frame);
+            icom(p_com_xy, ix, iy);
+        }
+        if (b_e_mag)
+        {
+            compute_electric_field(com_xy, idxx);
         }
+        prog_mon.add(com_xy);
 
-        if (idxx >= 0)
+        // Image completed
+        if (idxx == nxy_u - 1 && p_done + 1 < fr_total_u)
         {
-            if (dose_map[idxx] == 0)
-            {
-                com_xy[0] = offset[0];
-                com_xy[1] = offset[1];
-            }
-            else
+            pool.wait_for_completion();
+            reinit_vectors_limits();
+            if (update_offset)
             {
-                com_xy[0] = sumx_map[idxx] / dose_map[idxx];
-                com_xy[1] = sumy_map[idxx] / dose_map[idxx];
+                offset[0] = com_public[0];
+                offset[1] = com_public[1];
+                offset_bits.store(pack_offset(offset), std::memory_order_release);
             }
-            com_map_x[idxx] = com_xy[0];
-            com_map_y[idxx] = com_xy[1];
-            com_xy_sum[0] += com_xy[0];
-            com_xy_sum[1] += com_xy[1];
+        }
+        p_done++;
+
+        if (rc_quit)
+        {
+            // Stops the binner as well
+            completed.close();
+            break;
+        }
+    }
+    pool.wait_for_completion();
+    prog_mon.stop();
+    p_prog_mon = nullptr;
+}
 
-            ix = idxx % nx;
-            iy = floor(idxx / nx);
+// Process EVENT_BASED data from a mapped file: the events are split into shards, which are
+// binned in parallel into partial maps and added up. Probe positions, whose events straddle
+// two shards, are only integrated once the events following them have been binned.
+template <class CameraInterface>
+void Ricom::process_events_sharded(CAMERA::Camera<CameraInterface, CAMERA::EVENT_BASED> *camera_spec)
+{
+    const size_t shard_events = 1 << 20;
+    int n_shards = (n_threads > n_threads_max) ? n_threads_max : n_threads;
+
+    // Memory allocation
+    std::vector<uint32_t> dose_map(nxy);
+    std::vector<uint32_t> sumx_map(nxy);
+    std::vector<uint32_t> sumy_map(nxy);
+    std::vector<uint16_t> frame(camera_spec->nx_cam * camera_spec->ny_cam);
+    std::vector<EventBins> bins(n_shards);
+    std::vector<std::thread> workers;
 
-            if (n_threads > 1)
+    std::array<float, 2> com_xy = {0.0, 0.0};
+    // The frame is filled from the events of three positions, then plotted and cleared by the reporter
+    std::atomic<bool> b_frame_ready(false);
+    size_t fr_total_u = (size_t)fr_total;
+    size_t window = (std::max)((size_t)(std::max)(event_window, 1), camera_spec->cluster_positions());
+    // Cluster centroids are summed in fixed point
+    int com_bits = camera_spec->com_bits();
+    float com_scale = 1.0f / (1 << com_bits);
+
+    ProgressMonitor prog_mon(fr_total, !b_print2file, redraw_interval);
+    p_prog_mon = &prog_mon;
+    prog_mon.start([&](size_t count, const std::array<float, 2> &com_mean)
+                   {
+                       if (b_frame_ready.load(std::memory_order_acquire))
+                       {
+                           report_progress(prog_mon, count, com_mean, &frame[0]);
+                           frame.assign(camera_spec->nx_cam * camera_spec->ny_cam, 0);
+                           b_frame_ready.store(false, std::memory_order_release);
+                       }
+                       else
+                       {
+                           report_progress(prog_mon, count, com_mean, static_cast<const uint16_t *>(nullptr));
+                       } });
+    reinit_vectors_limits();
+
+    // Shards start at the first position of the reconstruction, found through the index
+    size_t p_start = camera_spec->first_position();
+    size_t e_next = camera_spec->find_event(p_start);
+    for (size_t img_num = 0; img_num * nxy < fr_total_u && !rc_quit; img_num++)
+    {
+        size_t first_frame = p_start + img_num * nxy;
+        size_t end_frame = p_start + (img_num + 1) * nxy;
+        size_t e_end = camera_spec->find_event(end_frame);
+        size_t p_done = first_frame;
+        if (img_num > 0)
+        {
+            reinit_vectors_limits();
+        }
+        dose_map.assign(nxy, 0);
+        sumx_map.assign(nxy, 0);
+        sumy_map.assign(nxy, 0);
+
+        while (p_done < end_frame && !rc_quit)
+        {
+            // Bin the next shards in parallel
+            size_t e_stop = (std::min)(e_next + n_shards * shard_events, e_end);
+            size_t n_per_shard = (e_stop - e_next + n_shards - 1) / n_shards;
+            camera_spec->prepare_bins(b_vSTEM, offset, detector.radius2);
+            workers.clear();
+            for (int s = 0; s < n_shards; s++)
             {
-                pool.push_task([=]
-                               { icom(com_xy, ix, iy); });
+                size_t e0 = (std::min)(e_next + s * n_per_shard, e_stop);
+                size_t e1 = (std::min)(e0 + n_per_shard, e_stop);
+                if (e0 == e1)
+                {
+                    bins[s].reset(first_frame, 0);
+                    continue;
+                }
+                workers.emplace_back([&, s, e0, e1]
+                                     { camera_spec->bin_events(e0, e1, first_frame, end_frame, b_vSTEM, bins[s]); });
             }
-            else
+            if (b_plot_cbed && e_next < e_stop && !b_frame_ready.load(std::memory_order_acquire))
             {
-                icom(p_com_xy, ix, iy);
+                size_t p_cbed = camera_spec->probe_position(e_next);
+                camera_spec->add_frame(e_next, e_stop, p_cbed, p_cbed + 3, frame);
+                b_frame_ready.store(true, std::memory_order_release);
             }
-            if (b_e_mag)
+            for (auto &w : workers)
             {
-                compute_electric_field(com_xy, idxx);
+                w.join();
             }
-        }
 
-        if (prog_mon.report_set)
-        {
-            update_surfaces(iy, p_frame);
-            if (b_plot_cbed)
-            {
-                frame.assign(camera_spec->nx_cam * camera_spec->ny_cam, 0);
-                acc_cbed = 0;
-                acc_idx = fr_count;
-            }
-            fr_freq = prog_mon.fr_freq;
-            rescales_recomputes();
-            for (int i = 0; i < 2; i++)
+            // Merge the partial maps
+            for (auto &b : bins)
             {
-                com_public[i] = com_xy_sum[i] / prog_mon.fr_count_i;
-                com_xy_sum[i] = 0;
+                size_t o = b.p_begin - first_frame;
+                for (size_t i = 0; i < b.dose.size(); i++)
+                {
+                    dose_map[o + i] += b.dose[i];
+                    sumx_map[o + i] += b.sumx[i];
+                    sumy_map[o + i] += b.sumy[i];
+                }
+                if (b_vSTEM)
+                {
+                    for (size_t i = 0; i < b.stem.size(); i++)
+                    {
+                        stem_data[o + i] += b.stem[i];
+                    }
+                }
+                camera_spec->add_events(b, first_frame, end_frame, dose_map, sumx_map, sumy_map,
+                                        stem_data, b_vSTEM);
             }
-            prog_mon.reset_flags();
-            last_y = iy;
-        }
 
-        if (prog_mon.fr_count >= end_frame)
-        {
-            if (prog_mon.fr_count != fr_total_u)
+            // Positions event_window before the next event are complete (same as the sequential reader)
+            size_t p_ready = end_frame;
+            if (e_stop < e_end)
             {
-                img_num++;
-                first_frame = img_num * nxy;
-                end_frame = (img_num + 1) * nxy;
-                reinit_vectors_limits();
-                dose_map.assign(nxy, 0);
-                sumx_map.assign(nxy, 0);
-                sumy_map.assign(nxy, 0);
+                size_t p_next = camera_spec->probe_position(e_stop);
+                p_ready = (p_next > p_done + window) ? (std::min)(p_next - window, end_frame) : p_done;
             }
+            e_next = e_stop;
 
-            if (update_offset)
+            // Integration
+            for (size_t p = p_done; p < p_ready; p++)
             {
-                offset[0] = com_public[0];
-                offset[1] = com_public[1];
+                size_t idxx = p - first_frame;
+                if (dose_map[idxx] == 0)
+                {
+                    com_xy[0] = offset[0];
+                    com_xy[1] = offset[1];
+                }
+                else if (com_bits == 0)
+                {
+                    com_xy[0] = sumx_map[idxx] / dose_map[idxx];
+                    com_xy[1] = sumy_map[idxx] / dose_map[idxx];
+                }
+                else
+                {
+                    com_xy[0] = (float)sumx_map[idxx] / dose_map[idxx] * com_scale;
+                    com_xy[1] = (float)sumy_map[idxx] / dose_map[idxx] * com_scale;
+                }
+                com_map_x[idxx] = com_xy[0];
+                com_map_y[idxx] = com_xy[1];
+
+                int ix = idxx % nx;
+                int iy = idxx / nx;
+                icom(com_xy, ix, iy);
+                if (b_e_mag)
+                {
+                    compute_electric_field(com_xy, idxx);
+                }
+                prog_mon.add(com_xy);
             }
+            p_done = (std::max)(p_done, p_ready);
         }
 
-        if (prog_mon.fr_count == fr_total_u || rc_quit)
+        if (update_offset)
         {
-            pool.wait_for_completion();
-            p_prog_mon = nullptr;
-            return;
+            offset[0] = com_public[0];
+            offset[1] = com_public[1];
         }
     }
+    prog_mon.stop();
     p_prog_mon = nullptr;
 }
 
@@ -1003,6 +1548,9 @@ void Ricom::run_reconstruction(RICOM::modes mode)
     stem_data.resize(nxy);
     e_field_data.resize(nxy);
 
+    // Images are drawn on their own thread while the camera pipeline runs
+    start_render();
+
     // Run camera dependent pipeline
     // Implementations are in the Interface Wrappers (src/cameras/XXXWrapper.cpp), but essentially
     // they run Ricom::process_data<FRAME_BASED>() or Ricom::process_data<EVENT_BASED>()
@@ -1021,6 +1569,7 @@ void Ricom::run_reconstruction(RICOM::modes mode)
         break;
     }
     }
+    stop_render();
     b_busy = false;
     std::cout << std::endl
               << "Reconstruction finished successfully." << std::endl;
@@ -1029,19 +1578,17 @@ void Ricom::run_reconstruction(RICOM::modes mode)
 // Template specializations, necessary to avoid linker error
 template void Ricom::run_reconstruction<MerlinInterface>(RICOM::modes);
 template void Ricom::run_reconstruction<TimepixInterface>(RICOM::modes);
+template void Ricom::run_reconstruction<ArrayInterface>(RICOM::modes);
 template void Ricom::process_data<uint8_t>(CAMERA::Camera<MerlinInterface, CAMERA::FRAME_BASED> *camera_spec);
 template void Ricom::process_data<uint16_t>(CAMERA::Camera<MerlinInterface, CAMERA::FRAME_BASED> *camera_spec);
+template void Ricom::process_data<uint8_t>(CAMERA::Camera<ArrayInterface, CAMERA::FRAME_BASED> *camera_spec);
+template void Ricom::process_data<uint16_t>(CAMERA::Camera<ArrayInterface, CAMERA::FRAME_BASED> *camera_spec);
+template void Ricom::process_data<uint32_t>(CAMERA::Camera<ArrayInterface, CAMERA::FRAME_BASED> *camera_spec);
+template void Ricom::process_data<float>(CAMERA::Camera<ArrayInterface, CAMERA::FRAME_BASED> *camera_spec);
 template void Ricom::process_data(CAMERA::Camera<TimepixInterface, CAMERA::EVENT_BASED> *camera_spec);
+template void Ricom::process_events_sharded(CAMERA::Camera<TimepixInterface, CAMERA::EVENT_BASED> *camera_spec);
 
 // Helper functions
-void Ricom::reset_limits()
-{
-    ricom_max = -FLT_MAX;
-    ricom_min = FLT_MAX;
-    stem_max = -FLT_MAX;
-    stem_min = FLT_MAX;
-}
-
 void Ricom::reinit_vectors_limits()
 {
     ricom_data.assign(nxy, 0);
@@ -1049,7 +1596,8 @@ void Ricom::reinit_vectors_limits()
     com_map_x.assign(nxy, 0);
     com_map_y.assign(nxy, 0);
     last_y = 0;
-    reset_limits();
+    // A new image changes all tiles
+    dirty_tiles.mark_all();
 }
 
 void Ricom::reset()
@@ -1062,19 +1610,57 @@ void Ricom::reset()
 enum CAMERA::Camera_model Ricom::select_mode_by_file(const char *filename)
 {
     file_path = filename;
-    if (std::filesystem::path(filename).extension() == ".t3p")
+    // stdin and shared memory rings carry .mib frames unless a data type is given
+    if (strcmp(filename, "-") == 0 || strncmp(filename, "shm:", 4) == 0)
+    {
+        mode = RICOM::FILE;
+        return CAMERA::MERLIN;
+    }
+    if (std::filesystem::path(filename).extension() == ".t3p" ||
+        std::filesystem::path(filename).extension() == ".t3c")
     {
         mode = RICOM::FILE;
         return CAMERA::TIMEPIX;
     }
-    else if (std::filesystem::path(filename).extension() == ".mib")
+    else if (std::filesystem::path(filename).extension() == ".mib" ||
+             std::filesystem::path(filename).extension() == ".mibz")
     {
         mode = RICOM::FILE;
         return CAMERA::MERLIN;
     }
     else
     {
-        return CAMERA::TIMEPIX;
+        // .npy or headerless raw data
+        mode = RICOM::FILE;
+        return CAMERA::ARRAY;
+    }
+}
+
+// Take the frame and scan size from the file header, where the format has one (.npy, .t3c)
+void Ricom::read_file_header()
+{
+    if (camera.model == CAMERA::TIMEPIX && std::filesystem::path(file_path).extension() == ".t3c")
+    {
+        EVENT_CACHE::Header header;
+        if (EventCacheReader::read_header(file_path, header))
+        {
+            camera.dwell_time = header.dwell_time;
+            camera.nx_cam = header.cam_nx;
+            camera.ny_cam = header.cam_ny;
+            nx = static_cast<int>(header.nx);
+            offset[0] = ((float)camera.nx_cam - 1) / 2;
+            offset[1] = ((float)camera.ny_cam - 1) / 2;
+        }
+        return;
+    }
+    if (camera.model == CAMERA::ARRAY && std::filesystem::path(file_path).extension() == ".npy" &&
+        !FileConnector::is_stream(file_path))
+    {
+        if (ArrayInterface::read_npy_header(file_path, camera, nx, ny))
+        {
+            offset[0] = ((float)camera.nx_cam - 1) / 2;
+            offset[1] = ((float)camera.ny_cam - 1) / 2;
+        }
     }
 }
 
@@ -1088,38 +1674,43 @@ void RICOM::run_ricom(Ricom *r, RICOM::modes mode)
     case CAMERA::TIMEPIX:
         r->run_reconstruction<TimepixInterface>(mode);
         break;
+    case CAMERA::ARRAY:
+        r->run_reconstruction<ArrayInterface>(mode);
+        break;
     default:
         break;
     }
 }
 
-void RICOM::run_connection_script(Ricom *ricom, MerlinSettings *merlin, const std::string &python_path)
+// Configure the Merlin camera through its control port and start the acquisition
+void RICOM::arm_merlin(Ricom *ricom, MerlinSettings *merlin)
 {
-
     int m_fr_total = ((ricom->nx + ricom->skip_row) * ricom->ny + ricom->skip_img) * ricom->rep;
 
-    std::ofstream run_script("run_script.py");
-    run_script << "from merlin_interface.merlin_interface import MerlinInterface" << std::endl;
-    run_script << "m = MerlinInterface(tcp_ip = \"" << ricom->socket.ip << "\" , tcp_port=" << merlin->com_port << ")" << std::endl;
-    run_script << "m.hvbias = " << merlin->hvbias << std::endl;
-    run_script << "m.threshold0 = " << merlin->threshold0 << std::endl;
-    run_script << "m.threshold1 = " << merlin->threshold1 << std::endl;
-    run_script << "m.continuousrw = " << (int)merlin->continuousrw << std::endl;
-    run_script << "m.counterdepth = " << ricom->camera.depth << std::endl;
-    run_script << "m.acquisitiontime = " << merlin->dwell_time << std::endl;
-    run_script << "m.acquisitionperiod = " << merlin->dwell_time << std::endl;
-    run_script << "m.numframestoacquire = " << m_fr_total + 1 << std::endl; // Ich verstehe nicht warum, aber er werkt.
-    run_script << "m.fileenable = " << (int)merlin->save << std::endl;
-    run_script << "m.runheadless = " << (int)merlin->headless << std::endl;
-    run_script << "m.fileformat = " << (int)merlin->raw * 2 << std::endl;
-    run_script << "m.triggerstart = " << merlin->trigger << std::endl;
-    run_script << "m.startacquisition()";
-    run_script.close();
-
-    std::string command = python_path + " run_script.py";
-    int r = std::system(command.c_str());
-    if (r != 0)
-    {
-        std::cout << "main::run_connection_script: Cannot execute python run_script. Shell exited with code " << r << std::endl;
+    // The data port has to be connected before the acquisition starts
+    auto t_wait = chc::steady_clock::now();
+    while (!ricom->socket.b_connected && !ricom->rc_quit)
+    {
+        if (chc::steady_clock::now() - t_wait > chc::seconds(10))
+        {
+            std::cout << "RICOM::arm_merlin: Data port not connected, acquisition not started." << std::endl;
+            return;
+        }
+        std::this_thread::sleep_for(chc::milliseconds(1));
+    }
+
+    auto t_start = chc::steady_clock::now();
+    MerlinControl control;
+    if (!control.connect(ricom->socket.ip, merlin->com_port))
+    {
+        std::cout << "RICOM::arm_merlin: Cannot connect to the Merlin control port." << std::endl;
+        return;
+    }
+    int status = control.arm(*merlin, ricom->camera.depth, m_fr_total + 1); // Ich verstehe nicht warum, aber er werkt.
+    control.disconnect();
+    if (status == MerlinControl::SUCCESS)
+    {
+        std::cout << "Merlin acquisition started ("
+                  << chc::duration_cast<float_ms>(chc::steady_clock::now() - t_start).count() << " ms)" << std::endl;
     }
 }
\ No newline at end of file
@@ -33,22 +33,43 @@
 #include <mutex>
 #include <future>
 #include <thread>
+#include <condition_variable>
 #include <fftw3.h>
 #include <chrono>
 #include <algorithm>
+#include <type_traits>
 
 #include "BoundedThreadPool.hpp"
+#include "SpscQueue.hpp"
+#include "TripleBuffer.hpp"
+#include "DirtyTiles.hpp"
+#include "Histogram.hpp"
 #include "tinycolormap.hpp"
 #include "fft2d.hpp"
 #include "SocketConnector.h"
 #include "ProgressMonitor.h"
 #include "MerlinInterface.h"
+#include "MerlinControl.h"
 #include "TimepixInterface.h"
+#include "ArrayInterface.h"
 #include "Camera.h"
 #include "GuiUtils.h"
 
 namespace chc = std::chrono;
 
+// Type for sums over pixel values: counts are summed exactly, intensities as floating point
+template <typename T>
+using acc_t = typename std::conditional<std::is_floating_point<T>::value, double, size_t>::type;
+
+// Sums of one completed probe position, handed from the binning to the integration of events
+struct PositionSums
+{
+    uint32_t dose;
+    uint32_t sumx;
+    uint32_t sumy;
+    float stem;
+};
+
 class Ricom_kernel
 {
 public:
@@ -137,6 +158,49 @@ public:
     ~Ricom_detector(){};
 };
 
+// Snapshot of the result maps and their images, drawn by the render thread and shown by the display
+class Ricom_frame
+{
+public:
+    // Properties
+    int fr_count; // Frames processed when the snapshot was taken
+    int nx;
+    int ny;
+    std::vector<float> ricom_data;
+    std::vector<float> stem_data;
+    std::vector<float> com_map_x;
+    std::vector<float> com_map_y;
+    std::vector<std::complex<float>> e_field_data;
+    SDL_Surface *srf_ricom; // Surface for the ricom window;
+    SDL_Surface *srf_stem;  // Surface for the vSTEM window;
+    SDL_Surface *srf_cbed;  // Surface for the CBED window;
+    SDL_Surface *srf_e_mag; // Surface for the E-Field window;
+    int cbed_count;                    // Counts the CBEDs drawn to srf_cbed
+    uint32_t version;                  // Counts the snapshots which changed any tile
+    std::vector<uint32_t> tile_version; // Snapshot in which each tile of the maps last changed
+    uint32_t redraw_version;           // Counts the redraws of the whole map surfaces
+    // Contrast of the maps, the percentiles at Ricom::contrast_clip of the integrated pixels
+    std::array<float, 2> ricom_limits;
+    std::array<float, 2> stem_limits;
+    std::array<float, 2> com_x_limits;
+    std::array<float, 2> com_y_limits;
+    std::array<float, 2> e_mag_limits;
+
+    // Methods
+    void resize(int nx, int ny, int nx_cam, int ny_cam);
+    void copy_from(const Ricom_frame &src);
+    // Constructor
+    Ricom_frame() : fr_count(0), nx(0), ny(0),
+                    ricom_data(), stem_data(), com_map_x(), com_map_y(), e_field_data(),
+                    srf_ricom(NULL), srf_stem(NULL), srf_cbed(NULL), srf_e_mag(NULL),
+                    cbed_count(0), version(0), tile_version(), redraw_version(0),
+                    ricom_limits{0, 0}, stem_limits{0, 0}, com_x_limits{0, 0}, com_y_limits{0, 0}, e_mag_limits{0, 0}{};
+    Ricom_frame(const Ricom_frame &) = delete;
+    Ricom_frame &operator=(const Ricom_frame &) = delete;
+    // Destructor
+    ~Ricom_frame();
+};
+
 namespace RICOM
 {
     enum modes
@@ -145,43 +209,62 @@ namespace RICOM
         TCP
     };
     void run_ricom(Ricom *r, RICOM::modes mode);
-    void run_connection_script(Ricom *r, MerlinSettings *merlin, const std::string &python_path);
+    void arm_merlin(Ricom *r, MerlinSettings *merlin);
 }
 
 class Ricom
 {
 private:
-    // vSTEM Variables
-    float stem_max;
-    float stem_min;
-
     // ricom variables
     std::vector<int> u;
     std::vector<int> v;
 
     Update_list update_list;
 
-    // Electric field magnitude
-    float e_mag_max;
-    float e_mag_min;
-
     // Variables for potting in the SDL2 frame
-    float ricom_max;
-    float ricom_min;
     std::vector<float> cbed_log;
 
-    // Thread Synchronization Variables
-    std::mutex ricom_mutex;
-    std::mutex stem_mutex;
-    std::mutex counter_mutex;
-    std::mutex e_field_mutex;
+    // Render thread: snapshots the result maps and colorizes them, the compute threads never draw
+    Ricom_frame canvas;                // Owned by the render thread
+    TripleBuffer<Ricom_frame> frames;  // Complete frames handed to the display
+    std::vector<float> cbed_pending;   // CBED in log-scale, waiting for the render thread
+    std::vector<float> cbed_render;    // CBED in log-scale, drawn by the render thread
+    std::thread render_thread;
+    std::mutex render_mutex;
+    std::condition_variable render_cv;
+    DirtyTiles dirty_tiles; // Tiles of the maps changed by the integration since their last snapshot
+    bool b_render_maps;  // Progress was reported since the last snapshot
+    int render_count;    // Frames processed at the last report
+    bool b_render_cbed;  // New CBED in cbed_pending
+    bool b_render_stop;  // Draw the complete images a last time and stop
+    SDL_Utils::Level_image ricom_image;
+    SDL_Utils::Level_image stem_image;
+    SDL_Utils::Level_image e_mag_image;
+    SDL_Utils::Colormap_lut cbed_lut;
+    // Values of the integrated pixels in the canvas, for the contrast of the maps
+    Histogram ricom_hist;
+    Histogram stem_hist;
+    Histogram com_x_hist;
+    Histogram com_y_hist;
+    Histogram e_mag_hist;
+    std::vector<size_t> tile_fed; // Pixels of each tile up to this index of the image are in the histograms
+    std::vector<int> tiles_changed;
+    size_t hist_image;            // Image of a series the histograms are for
 
     // Private Methods - General
     void init_surface();
     template <typename T>
-    inline void update_surfaces(int iy, std::vector<T> *p_frame);
+    inline void update_surfaces(size_t count, const T *p_frame);
+    void start_render();
+    void stop_render();
+    void run_render();
+    void render_tiles(bool b_draw);
+    void copy_tile(int x0, int y0, int x1, int y1);
+    void feed_tile(int x0, int y0, int x1, int y1, size_t i0, size_t i1, bool b_add);
+    void clear_histograms();
+    void update_limits();
+    void draw_cbed_image();
     void reinit_vectors_limits();
-    void reset_limits();
     void reset_file();
     void calculate_update_list();
     inline void rescales_recomputes();
@@ -194,31 +277,38 @@ private:
     inline void icom(std::array<float, 2> *com, int x, int y);
     inline void icom(std::array<float, 2> com, int x, int y);
     template <typename T>
-    inline void com(std::vector<T> *data, std::array<float, 2> &com);
+    inline void com(const T *data, std::array<float, 2> &com);
     template <typename T>
     void read_com_merlin(std::vector<T> &data, std::array<float, 2> &com);
-    inline void set_ricom_pixel(int idx, int idy);
     template <typename T>
-    inline void com_icom(std::vector<T> data, int ix, int iy, std::array<float, 2> *com_xy_sum, ProgressMonitor *p_prog_mon);
+    inline void com_icom(const T *p_data, int ix, int iy, ProgressMonitor *p_prog_mon,
+                         std::vector<T> *p_cbed_frame, std::atomic<int> *p_cbed_state);
     template <typename T>
-    inline void com_icom(std::vector<T> *p_data, int ix, int iy, std::array<float, 2> *com_xy_sum, ProgressMonitor *p_prog_mon);
+    void report_progress(ProgressMonitor &prog_mon, size_t count, const std::array<float, 2> &com_mean, const T *p_frame);
 
     // Private Methods - vSTEM
     template <typename T>
-    inline void stem(std::vector<T> *data, size_t id_stem);
-    inline void set_stem_pixel(size_t idx, size_t idy);
+    inline void stem(const T *data, size_t id_stem);
+
+    // Private Methods - event pipeline
+    template <class CameraInterface>
+    void integrate_events(CAMERA::Camera<CameraInterface, CAMERA::EVENT_BASED> *camera_spec,
+                          SpscQueue<PositionSums> &completed, std::vector<uint16_t> &frame,
+                          std::atomic<bool> &b_frame_ready, std::atomic<uint64_t> &offset_bits);
 
     // Private Methods electric field
     inline void compute_electric_field(std::array<float, 2> &p_com_xy, size_t id);
-    inline void set_e_field_pixel(size_t idx, size_t idy);
 
 public:
     SocketConnector socket;
     std::string file_path;
+    std::string record_path; // Record live data to this .mib file (empty: off)
+    std::string shm_publish; // Publish live frames to this shared memory ring (empty: off)
     CAMERA::Camera_BASE camera;
     RICOM::modes mode;
     bool b_print2file;
     int redraw_interval;
+    float contrast_clip; // Percent of the pixels saturating at either end of the contrast of the maps
     int last_y;
     ProgressMonitor *p_prog_mon;
     bool b_busy;
@@ -248,6 +338,15 @@ public:
     int skip_row;
     int skip_img;
 
+    // Event based cameras
+    int first_row;         // Scan rows skipped from the start of the file (a later repetition or region)
+    int event_window;      // Probe positions behind the newest one read, which still accept late events
+    int cluster_window;    // Events of neighbouring pixels within this time are one electron [ns], 0: off
+    size_t events_late;    // Events received out of order, but within the window
+    size_t events_dropped; // Events received after their probe position was integrated
+    float events_read_freq;   // Throughput of the reader stage [Mev/s]
+    float events_binned_freq; // Throughput of the binner stage [Mev/s], the integration runs at fr_freq
+
     // Variables for progress and performance
     int n_threads;
     int n_threads_max;
@@ -255,37 +354,29 @@ public:
     float fr_freq;        // Frequncy per frame
     float fr_count;       // Count all Frames processed in an image
     float fr_count_total; // Count all Frames in a scanning session
-    std::atomic<bool> rescale_ricom;
-    std::atomic<bool> rescale_stem;
-    std::atomic<bool> rescale_e_mag;
     bool rc_quit;
 
-    SDL_Surface *srf_ricom; // Surface for the ricom window;
+    Ricom_frame view; // Newest complete frame of the render thread, see update_display()
     int ricom_cmap;
-    SDL_Surface *srf_stem; // Surface for the vSTEM window;
     int stem_cmap;
-    SDL_Surface *srf_cbed; // Surface for the CBED window;
     int cbed_cmap;
-    SDL_Surface *srf_e_mag; // Surface for the E-Field window;
     int e_mag_cmap;
 
     // Public Methods
-    void draw_ricom_image();
-    void draw_ricom_image(int y0, int ye);
-    void draw_stem_image();
-    void draw_stem_image(int y0, int ye);
-    void draw_e_field_image();
-    void draw_e_field_image(int y0, int ye);
+    bool update_display();
     template <class CameraInterface>
     void run_reconstruction(RICOM::modes mode);
     void reset();
     template <typename T>
-    void plot_cbed(std::vector<T> *p_data);
+    void plot_cbed(const T *p_data);
     template <typename T, class CameraInterface>
     void process_data(CAMERA::Camera<CameraInterface, CAMERA::FRAME_BASED> *camera);
     template <class CameraInterface>
     void process_data(CAMERA::Camera<CameraInterface, CAMERA::EVENT_BASED> *camera);
+    template <class CameraInterface>
+    void process_events_sharded(CAMERA::Camera<CameraInterface, CAMERA::EVENT_BASED> *camera);
     enum CAMERA::Camera_model select_mode_by_file(const char *filename);
+    void read_file_header();
 
     // Constructor
     Ricom();
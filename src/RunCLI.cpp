@@ -23,16 +23,52 @@ int run_cli(int argc, char *argv[], Ricom *ricom, CAMERA::Default_configurations
     ricom->b_plot_cbed = false;
     std::string save_img = "";
     std::string save_dat = "";
+
+    // The camera is selected by -dtype (arrays), the file or, without one, by -dwell_time
+    // (event based). Its defaults are loaded before the other arguments, so that it never
+    // overwrites them.
+    const char *filename = nullptr;
+    bool b_array = false;
+    bool b_event_based = false;
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "-filename") == 0)
+        {
+            filename = argv[i + 1];
+        }
+        if (strcmp(argv[i], "-dtype") == 0)
+        {
+            b_array = true;
+        }
+        if (strcmp(argv[i], "-dwell_time") == 0)
+        {
+            b_event_based = true;
+        }
+    }
+    if (filename != nullptr)
+    {
+        CAMERA::Camera_model model = ricom->select_mode_by_file(filename);
+        ricom->camera = hardware_configurations[b_array ? CAMERA::ARRAY : model];
+        ricom->read_file_header();
+    }
+    else if (b_array)
+    {
+        ricom->camera = hardware_configurations[CAMERA::ARRAY];
+    }
+    else if (b_event_based)
+    {
+        ricom->camera = hardware_configurations[CAMERA::TIMEPIX];
+    }
     
     // command line arguments
     for (int i = 1; i < argc; i++)
     {
         if (i + 1 != argc)
         {
-            // Set filename to read from .mib file
+            // Set filename to read from .mib, .t3p, .npy or raw file, "-" (stdin), a named pipe or "shm:<name>",
+            // opened before the other arguments
             if (strcmp(argv[i], "-filename") == 0)
             {
-                ricom->camera = hardware_configurations[ricom->select_mode_by_file(argv[i + 1])];
                 i++;
             }
             // Set IP of camera for TCP connection
@@ -49,6 +85,30 @@ int run_cli(int argc, char *argv[], Ricom *ricom, CAMERA::Default_configurations
                 ricom->mode = RICOM::TCP;
                 i++;
             }
+            // Set socket receive buffer size in bytes
+            if (strcmp(argv[i], "-rcvbuf") == 0)
+            {
+                ricom->socket.rcvbuf_size = std::stoi(argv[i + 1]);
+                i++;
+            }
+            // Wait for complete frames on receive (MSG_WAITALL)
+            if (strcmp(argv[i], "-waitall") == 0)
+            {
+                ricom->socket.b_waitall = (bool)std::stoi(argv[i + 1]);
+                i++;
+            }
+            // Record live data to .mib file
+            if (strcmp(argv[i], "-record") == 0)
+            {
+                ricom->record_path = argv[i + 1];
+                i++;
+            }
+            // Publish live frames to a shared memory ring for other instances
+            if (strcmp(argv[i], "-shm_publish") == 0)
+            {
+                ricom->shm_publish = argv[i + 1];
+                i++;
+            }
             // Set width of image
             if (strcmp(argv[i], "-nx") == 0)
             {
@@ -144,11 +204,40 @@ int run_cli(int argc, char *argv[], Ricom *ricom, CAMERA::Default_configurations
                 ricom->rep = std::stoi(argv[i + 1]);
                 i++;
             }
+            // Set element type of raw files (uint8, uint16, uint32, float32 or numpy style, e.g. ">u2")
+            if (strcmp(argv[i], "-dtype") == 0)
+            {
+                ricom->camera.dtype = argv[i + 1];
+                i++;
+            }
+            // Set header size of raw files in bytes
+            if (strcmp(argv[i], "-header_size") == 0)
+            {
+                ricom->camera.header_size = std::stoul(argv[i + 1]);
+                i++;
+            }
             // Set Dwell Time
             if (strcmp(argv[i], "-dwell_time") == 0)
             {
                 ricom->camera.dwell_time = std::stof(argv[i + 1]);
-                ricom->camera.model = CAMERA::TIMEPIX;
+                i++;
+            }
+            // Start at this scan row of a .t3p file, e.g. ny * k for the k-th repetition
+            if (strcmp(argv[i], "-first_row") == 0)
+            {
+                ricom->first_row = std::stoi(argv[i + 1]);
+                i++;
+            }
+            // Probe positions behind the newest one, which still accept late events (event based cameras)
+            if (strcmp(argv[i], "-event_window") == 0)
+            {
+                ricom->event_window = std::stoi(argv[i + 1]);
+                i++;
+            }
+            // Group the events of one electron within this time in ns and use their centroid (Timepix)
+            if (strcmp(argv[i], "-cluster_window") == 0)
+            {
+                ricom->cluster_window = std::stoi(argv[i + 1]);
                 i++;
             }
             // Set Number of threads
@@ -170,6 +259,12 @@ int run_cli(int argc, char *argv[], Ricom *ricom, CAMERA::Default_configurations
                 ricom->b_plot2SDL = true;
                 i++;
             }
+            // Percent of the pixels saturating at either end of the contrast of the images
+            if (strcmp(argv[i], "-contrast_clip") == 0)
+            {
+                ricom->contrast_clip = std::stof(argv[i + 1]);
+                i++;
+            }
             // Set path to save reconstruction image
             if (strcmp(argv[i], "-save_img_path") == 0)
             {
@@ -197,7 +292,7 @@ int run_cli(int argc, char *argv[], Ricom *ricom, CAMERA::Default_configurations
         std::vector<SdlImageWindow> image_windows;
         std::thread run_thread;
         run_thread = std::thread(RICOM::run_ricom, ricom, ricom->mode);
-        while (ricom->srf_ricom == NULL)
+        while (!ricom->update_display())
         {
             SDL_Delay(ricom->redraw_interval);
         }
@@ -212,32 +307,21 @@ int run_cli(int argc, char *argv[], Ricom *ricom, CAMERA::Default_configurations
         SDL_GetCurrentDisplayMode(0, &DM);
         float scale = (std::min)(((float)DM.w) / ricom->nx, ((float)DM.h) / ricom->ny) * 0.8;
         bool b_redraw = false;
-        image_windows.push_back(SdlImageWindow("riCOM", ricom->srf_ricom, ricom->nx, ricom->ny, scale));
+        image_windows.push_back(SdlImageWindow("riCOM", ricom->view.srf_ricom, ricom->nx, ricom->ny, scale));
         if (ricom->b_vSTEM)
         {
-            image_windows.push_back(SdlImageWindow("vSTEM", ricom->srf_stem, ricom->nx, ricom->ny, scale));
+            image_windows.push_back(SdlImageWindow("vSTEM", ricom->view.srf_stem, ricom->nx, ricom->ny, scale));
         }
         if (ricom->b_e_mag)
         {
-            image_windows.push_back(SdlImageWindow("E-Field", ricom->srf_e_mag, ricom->nx, ricom->ny, scale));
+            image_windows.push_back(SdlImageWindow("E-Field", ricom->view.srf_e_mag, ricom->nx, ricom->ny, scale));
         }
 
         bool b_open_window = true;
         while (b_open_window)
         {
-            if (ricom->p_prog_mon != nullptr)
-            {
-                if (ricom->p_prog_mon->report_set_public)
-                {
-                    b_redraw = true;
-                    ricom->p_prog_mon->report_set_public = false;
-                }
-                else
-                {
-                    b_redraw = true;
-                }
-            }
-
+            // Windows are only updated when the render thread published a new frame
+            b_redraw = ricom->update_display();
             if (b_redraw)
             {
                 for (auto &wnd : image_windows)
@@ -270,7 +354,8 @@ int run_cli(int argc, char *argv[], Ricom *ricom, CAMERA::Default_configurations
     }
     if (save_img != "")
     {
-        save_image(&save_img, ricom->srf_ricom);
+        ricom->update_display();
+        save_image(&save_img, ricom->view.srf_ricom);
         std::cout << "riCOM reconstruction image saved as " + save_img << std::endl;
     }
     return 0;
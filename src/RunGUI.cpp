@@ -59,7 +59,6 @@
 // Forward Declarations
 template <typename T>
 inline void update_views(std::map<std::string, ImGuiImageWindow<T>> &generic_windows_f, Ricom *ricom, bool b_restarted, bool trigger, bool b_redraw);
-inline void bind_tex(SDL_Surface *srf, GLuint tex_id);
 
 ////////////////////////////////////////////////
 //            GUI implementation              //
@@ -68,7 +67,7 @@ inline void bind_tex(SDL_Surface *srf, GLuint tex_id);
 int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configurations)
 {
     std::thread run_thread;
-    std::thread py_thread;
+    std::thread control_thread;
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
     {
         printf("Error: %s\n", SDL_GetError());
@@ -126,6 +125,7 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
     // Setup Platform/Renderer backends
     ImGui_ImplSDL2_InitForOpenGL(window, gl_context);
     ImGui_ImplOpenGL3_Init(glsl_version);
+    GlTexture::init_gl();
 
     io.Fonts->AddFontFromMemoryCompressedTTF(KarlaRegular_compressed_data, KarlaRegular_compressed_size, 14.0f);
     io.Fonts->AddFontFromMemoryCompressedTTF(RobotoMedium_compressed_data, RobotoMedium_compressed_size, 14.0f);
@@ -159,11 +159,16 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     }
+    // Textures keep their storage, redraws only upload what changed
+    GlTexture cbed_tex;
+    GlTexture kernel_x_tex;
+    GlTexture kernel_y_tex;
+    int cbed_uploaded = -1;
 
     // create a file browser instances
     ImGui::FileBrowser openFileDialog;
-    openFileDialog.SetTitle("Open .mib or .t3p file");
-    openFileDialog.SetTypeFilters({".mib", ".t3p"});
+    openFileDialog.SetTitle("Open .mib, .mibz, .t3p or .t3c file");
+    openFileDialog.SetTypeFilters({".mib", ".mibz", ".t3p", ".t3c"});
     ImGui::FileBrowser saveFileDialog(ImGuiFileBrowserFlags_EnterNewFilename | ImGuiFileBrowserFlags_CreateNewDir);
     saveFileDialog.SetTitle("Save image as .png");
     ImGui::FileBrowser saveDataDialog(ImGuiFileBrowserFlags_EnterNewFilename | ImGuiFileBrowserFlags_CreateNewDir);
@@ -173,6 +178,7 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
     // Main loop conditional flags
     bool b_done = false;
     bool b_merlin_live_menu = true;
+    bool b_timepix_live_menu = false;
     bool b_acq_open = false;
     bool b_started = false;
     bool b_file_selected = false;
@@ -191,15 +197,13 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
     ImGuiINI::check_ini_setting(ini_cfg, "Appearance", "Style", style_index);
     ImGuiINI::set_style(style_index);
     // Hardware Settings
-    std::string python_path;
-#ifdef _WIN32
-    python_path = "py";
-#else
-    python_path = "python3";
-#endif
     ImGuiINI::check_ini_setting(ini_cfg, "Hardware", "Threads", ricom->n_threads);
     ImGuiINI::check_ini_setting(ini_cfg, "Hardware", "Queue Size", ricom->queue_size);
     ImGuiINI::check_ini_setting(ini_cfg, "Hardware", "Image Refresh Interval [ms]", ricom->redraw_interval);
+    ImGuiINI::check_ini_setting(ini_cfg, "Hardware", "Contrast Clip [%]", ricom->contrast_clip);
+    // FFTs of the analysis windows use measured plans, the wisdom is kept next to the settings
+    FFTPlans::set_threads(ricom->n_threads);
+    FFTPlans::load_wisdom("fftw_wisdom.dat");
     // Merlin Settings
     ImGuiINI::check_ini_setting(ini_cfg, "Merlin", "Live Interface Menu", b_merlin_live_menu);
     ImGuiINI::check_ini_setting(ini_cfg, "Merlin", "nx", hardware_configurations[CAMERA::MERLIN].nx_cam);
@@ -207,8 +211,12 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
     ImGuiINI::check_ini_setting(ini_cfg, "Merlin", "com_port", merlin_settings.com_port);
     ImGuiINI::check_ini_setting(ini_cfg, "Merlin", "data_port", ricom->socket.port);
     ImGuiINI::check_ini_setting(ini_cfg, "Merlin", "ip", ricom->socket.ip);
-    ImGuiINI::check_ini_setting(ini_cfg, "Merlin", "python_path", python_path);
+    ImGuiINI::check_ini_setting(ini_cfg, "Merlin", "rcvbuf", ricom->socket.rcvbuf_size);
     // Timepix Settings
+    ImGuiINI::check_ini_setting(ini_cfg, "Timepix", "Live Interface Menu", b_timepix_live_menu);
+    ImGuiINI::check_ini_setting(ini_cfg, "Timepix", "Event Window", ricom->event_window);
+    ImGuiINI::check_ini_setting(ini_cfg, "Timepix", "Cluster Window", ricom->cluster_window);
+    ImGuiINI::check_ini_setting(ini_cfg, "Timepix", "dwell_time", hardware_configurations[CAMERA::TIMEPIX].dwell_time);
     ImGuiINI::check_ini_setting(ini_cfg, "Timepix", "nx", hardware_configurations[CAMERA::MERLIN].nx_cam);
     ImGuiINI::check_ini_setting(ini_cfg, "Timepix", "ny", hardware_configurations[CAMERA::MERLIN].ny_cam);
 
@@ -244,9 +252,21 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
     generic_windows_f.emplace("E-Field-FFT", ImGuiImageWindow<float>("E-Field-FFT", &uiTextureIDs[8], false, 4, common_flags, &e_field_fft));
     GENERIC_WINDOW_C("E-FIELD").fft_window = &GENERIC_WINDOW("E-Field-FFT");
 
+    // The result windows only redraw the tiles changed by the integration, with the contrast of the render thread
+    for (const char *name : {"RICOM", "vSTEM", "COM-X", "COM-Y"})
+    {
+        GENERIC_WINDOW(name).set_tiles(&ricom->view.tile_version, DirtyTiles::tile_size);
+    }
+    GENERIC_WINDOW_C("E-FIELD").set_tiles(&ricom->view.tile_version, DirtyTiles::tile_size);
+    GENERIC_WINDOW("RICOM").set_limits(&ricom->view.ricom_limits);
+    GENERIC_WINDOW("vSTEM").set_limits(&ricom->view.stem_limits);
+    GENERIC_WINDOW("COM-X").set_limits(&ricom->view.com_x_limits);
+    GENERIC_WINDOW("COM-Y").set_limits(&ricom->view.com_y_limits);
+    GENERIC_WINDOW_C("E-FIELD").set_limits(&ricom->view.e_mag_limits);
+
     ricom->kernel.draw_surfaces();
-    bind_tex(ricom->kernel.srf_kx, uiTextureIDs[9]);
-    bind_tex(ricom->kernel.srf_ky, uiTextureIDs[10]);
+    kernel_x_tex.upload(uiTextureIDs[9], ricom->kernel.srf_kx);
+    kernel_y_tex.upload(uiTextureIDs[10], ricom->kernel.srf_ky);
 
     ImGuiID dock_id = 3775;
     Main_Dock main_dock(dock_id);
@@ -287,12 +307,17 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
                 {
                     ini_cfg["Hardware"]["Image Refresh Interval [ms]"] = std::to_string(ricom->redraw_interval);
                 }
+                if (ImGui::DragFloat("Contrast Clip [%]", &ricom->contrast_clip, 0.01f, 0.0f, 10.0f, "%.2f"))
+                {
+                    ini_cfg["Hardware"]["Contrast Clip [%]"] = std::to_string(ricom->contrast_clip);
+                }
                 ImGui::Separator();
 
                 ImGui::Text("Multithreading");
                 if (ImGui::DragInt("Threads", &ricom->n_threads, 1, 1, *&ricom->n_threads_max))
                 {
                     ini_cfg["Hardware"]["Threads"] = std::to_string(ricom->n_threads);
+                    FFTPlans::set_threads(ricom->n_threads);
                 }
                 if (ImGui::DragInt("Queue Size", &ricom->queue_size, 1, 1, 256))
                 {
@@ -325,14 +350,13 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
                 {
                     ini_cfg["Merlin"]["data_port"] = std::to_string(ricom->socket.port);
                 }
-                if (ImGui::InputText("python path", &python_path))
-                {
-                    ini_cfg["Merlin"]["python path"] = python_path;
-                }
                 ImGui::Separator();
 
                 ImGui::Text("Timepix Camera");
-                // ImGui::Checkbox("Live Interface Menu", &b_timepix_live_menu);
+                if (ImGui::Checkbox("Live Interface Menu##Timepix", &b_timepix_live_menu))
+                {
+                    ini_cfg["Timepix"]["Live Interface Menu"] = std::to_string(b_timepix_live_menu);
+                }
                 if (ImGui::DragInt("nx Timepix", &hardware_configurations[CAMERA::TIMEPIX].nx_cam, 1, 1, 2048))
                 {
                     ini_cfg["Timepix"]["nx"] = std::to_string(hardware_configurations[CAMERA::TIMEPIX].nx_cam);
@@ -341,6 +365,22 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
                 {
                     ini_cfg["Timepix"]["ny"] = std::to_string(hardware_configurations[CAMERA::TIMEPIX].ny_cam);
                 }
+                if (ImGui::DragInt("Event Window", &ricom->event_window, 1, 1, 4096))
+                {
+                    ini_cfg["Timepix"]["Event Window"] = std::to_string(ricom->event_window);
+                }
+                if (ImGui::IsItemHovered())
+                {
+                    ImGui::SetTooltip("Probe positions behind the newest one, which still accept late events.\nLarger windows drop fewer events, but integrate later.");
+                }
+                if (ImGui::DragInt("Cluster Window (ns)", &ricom->cluster_window, 1, 0, 10000))
+                {
+                    ini_cfg["Timepix"]["Cluster Window"] = std::to_string(ricom->cluster_window);
+                }
+                if (ImGui::IsItemHovered())
+                {
+                    ImGui::SetTooltip("Events on neighbouring pixels within this time are counted as one electron\nat their ToT weighted centroid. 0: every event is counted.");
+                }
                 ImGui::EndMenu();
             }
             if (ImGui::BeginMenu("Additional Imaging Modes"))
@@ -349,7 +389,7 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
                 {
                     if (show_com_x)
                     {
-                        GENERIC_WINDOW("COM-X").set_data(ricom->nx, ricom->ny, &ricom->com_map_x);
+                        GENERIC_WINDOW("COM-X").set_data(ricom->nx, ricom->ny, &ricom->view.com_map_x);
                     }
                     else
                     {
@@ -360,7 +400,7 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
                 {
                     if (show_com_y)
                     {
-                        GENERIC_WINDOW("COM-Y").set_data(ricom->nx, ricom->ny, &ricom->com_map_y);
+                        GENERIC_WINDOW("COM-Y").set_data(ricom->nx, ricom->ny, &ricom->view.com_map_y);
                     }
                     else
                     {
@@ -371,7 +411,7 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
                 {
                     if (ricom->b_e_mag)
                     {
-                        GENERIC_WINDOW_C("E-FIELD").set_data(ricom->nx, ricom->ny, &ricom->e_field_data);
+                        GENERIC_WINDOW_C("E-FIELD").set_data(ricom->nx, ricom->ny, &ricom->view.e_field_data);
                     }
                     else
                     {
@@ -382,7 +422,7 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
                 {
                     if (ricom->b_vSTEM)
                     {
-                        GENERIC_WINDOW("vSTEM").set_data(ricom->nx, ricom->ny, &ricom->stem_data);
+                        GENERIC_WINDOW("vSTEM").set_data(ricom->nx, ricom->ny, &ricom->view.stem_data);
                     }
                     else
                     {
@@ -396,15 +436,8 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
         }
 
         const ImGuiViewport *viewport = ImGui::GetMainViewport();
-        if (ricom->p_prog_mon != nullptr)
-        {
-            if (ricom->p_prog_mon->report_set_public)
-            {
-                b_redraw = true;
-                ricom->p_prog_mon->report_set_public = false;
-            }
-        }
-        else
+        // Redraw when the render thread published a new frame, and always while idle
+        if (ricom->update_display() || ricom->p_prog_mon == nullptr)
         {
             b_redraw = true;
         }
@@ -470,8 +503,8 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
                 }
                 GENERIC_WINDOW("RICOM").reset_min_max();
                 ricom->kernel.draw_surfaces();
-                bind_tex(ricom->kernel.srf_kx, uiTextureIDs[9]);
-                bind_tex(ricom->kernel.srf_ky, uiTextureIDs[10]);
+                kernel_x_tex.upload(uiTextureIDs[9], ricom->kernel.srf_kx);
+                kernel_y_tex.upload(uiTextureIDs[10], ricom->kernel.srf_ky);
             }
             if (kernel_changed || b_nx_changed)
             {
@@ -527,6 +560,16 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
                 }
 
                 ImGui::Checkbox("save file?", &merlin_settings.save);
+                ImGui::InputText("record to", &ricom->record_path);
+                if (ImGui::IsItemHovered())
+                {
+                    ImGui::SetTooltip("Record the received stream to this .mib file\n(leave empty to disable)");
+                }
+                ImGui::InputText("publish to", &ricom->shm_publish);
+                if (ImGui::IsItemHovered())
+                {
+                    ImGui::SetTooltip("Share the received frames with other RICOM instances\nthrough this shared memory ring (open as shm:<name>)");
+                }
 
                 if (ricom->socket.b_connected)
                 {
@@ -551,11 +594,39 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
                 {
 
                     run_thread = std::thread(RICOM::run_ricom, ricom, RICOM::TCP);
-                    std::this_thread::sleep_for(std::chrono::milliseconds(500));
-                    py_thread = std::thread(RICOM::run_connection_script, ricom, &merlin_settings, python_path);
+                    control_thread = std::thread(RICOM::arm_merlin, ricom, &merlin_settings);
                     run_thread.detach();
-                    py_thread.detach();
-                    GENERIC_WINDOW("RICOM").set_data(ricom->nx, ricom->ny, &ricom->ricom_data);
+                    control_thread.detach();
+                    GENERIC_WINDOW("RICOM").set_data(ricom->nx, ricom->ny, &ricom->view.ricom_data);
+                }
+            }
+        }
+
+        if (b_timepix_live_menu)
+        {
+            if (ImGui::CollapsingHeader("Timepix Live Mode", ImGuiTreeNodeFlags_DefaultOpen))
+            {
+                // Raw events are received from IP and Data-Port of the Hardware Settings
+                if (ImGui::DragInt("dwell time (ns)", &hardware_configurations[CAMERA::TIMEPIX].dwell_time, 1, 1))
+                {
+                    ini_cfg["Timepix"]["dwell_time"] = std::to_string(hardware_configurations[CAMERA::TIMEPIX].dwell_time);
+                }
+                if (ricom->socket.b_connected)
+                {
+                    ImGui::TextColored(ImVec4(0.0f, 1.0f, 0.0f, 1.0f), "Connected");
+                }
+                else
+                {
+                    ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "Not Connected");
+                }
+                if (ImGui::Button("Start Event Stream", ImVec2(-1.0f, 0.0f)))
+                {
+                    ricom->camera = hardware_configurations[CAMERA::TIMEPIX];
+                    run_thread = std::thread(RICOM::run_ricom, ricom, RICOM::TCP);
+                    b_started = true;
+                    b_restarted = true;
+                    run_thread.detach();
+                    GENERIC_WINDOW("RICOM").set_data(ricom->nx, ricom->ny, &ricom->view.ricom_data);
                 }
             }
         }
@@ -575,6 +646,7 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
                 b_file_selected = true;
                 openFileDialog.ClearSelected();
                 ricom->camera = hardware_configurations[ricom->select_mode_by_file(filename.c_str())];
+                ricom->read_file_header();
             }
             if (b_file_selected)
             {
@@ -598,6 +670,31 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
                 if (ricom->camera.model == CAMERA::TIMEPIX)
                 {
                     ImGui::DragInt("dwell time", &ricom->camera.dwell_time, 1, 1);
+                    ImGui::InputInt("first row", &ricom->first_row);
+                    if (ImGui::IsItemHovered())
+                    {
+                        ImGui::SetTooltip("Start the reconstruction at this scan row,\ne.g. ny * k for the k-th repetition");
+                    }
+                    ricom->first_row = (std::max)(ricom->first_row, 0);
+                }
+                // Raw files have no header, the layout has to be given
+                if (ricom->camera.model == CAMERA::ARRAY && std::filesystem::path(filename).extension() != ".npy")
+                {
+                    // Same order as ArrayInterface::Dtype
+                    static const char *dtypes[] = {"uint8", "uint16", "uint32", "float32"};
+                    bool b_big_endian;
+                    int dtype_index = (std::min)(static_cast<int>(ArrayInterface::parse_dtype(ricom->camera.dtype, b_big_endian)), 3);
+                    if (ImGui::Combo("dtype", &dtype_index, dtypes, IM_ARRAYSIZE(dtypes)))
+                    {
+                        ricom->camera.dtype = dtypes[dtype_index];
+                    }
+                    ImGui::DragInt("nx camera", &ricom->camera.nx_cam, 1, 1, 4096);
+                    ImGui::DragInt("ny camera", &ricom->camera.ny_cam, 1, 1, 4096);
+                    int header_size = static_cast<int>(ricom->camera.header_size);
+                    if (ImGui::InputInt("header size", &header_size) && header_size >= 0)
+                    {
+                        ricom->camera.header_size = header_size;
+                    }
                 }
 
                 if (ImGui::Button("Run File", ImVec2(-1.0f, 0.0f)))
@@ -606,7 +703,7 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
                     b_started = true;
                     b_restarted = true;
                     run_thread.detach();
-                    GENERIC_WINDOW("RICOM").set_data(ricom->nx, ricom->ny, &ricom->ricom_data);
+                    GENERIC_WINDOW("RICOM").set_data(ricom->nx, ricom->ny, &ricom->view.ricom_data);
                 }
             }
         }
@@ -619,6 +716,14 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
         ImGui::BeginChild("Progress", ImVec2(0, 0), true, ImGuiWindowFlags_NoScrollWithMouse | ImGuiWindowFlags_NoScrollbar);
         ImGui::ProgressBar(ricom->fr_count / (ricom->fr_total), ImVec2(-1.0f, 0.0f));
         ImGui::Text("Speed: %.2f kHz", ricom->fr_freq);
+        if (ricom->camera.type == CAMERA::EVENT_BASED && ricom->events_read_freq > 0)
+        {
+            ImGui::Text("Events read: %.1f Mev/s, binned: %.1f Mev/s", ricom->events_read_freq, ricom->events_binned_freq);
+        }
+        if (ricom->camera.type == CAMERA::EVENT_BASED && (ricom->events_late > 0 || ricom->events_dropped > 0))
+        {
+            ImGui::Text("Late events: %zu counted, %zu dropped", ricom->events_late, ricom->events_dropped);
+        }
         if (ImGui::Button("Quit", ImVec2(-1.0f, 0.0f)))
         {
             ricom->rc_quit = true;
@@ -664,9 +769,11 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
         float cross_width = tex_wh / 15.0f;
         if (b_redraw)
         {
-            if (ricom->srf_cbed != NULL)
+            // Only new CBEDs are uploaded
+            if (ricom->view.srf_cbed != NULL && ricom->view.cbed_count != cbed_uploaded)
             {
-                bind_tex(ricom->srf_cbed, uiTextureIDs[0]);
+                cbed_tex.upload(uiTextureIDs[0], ricom->view.srf_cbed);
+                cbed_uploaded = ricom->view.cbed_count;
             }
         }
         ImGui::Image((ImTextureID)uiTextureIDs[0], ImVec2(tex_wh, tex_wh), uv_min, uv_max, tint_col, border_col);
@@ -699,6 +806,11 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
         // Render all generic Image Windows
         bool trigger = (b_trigger_update != ricom->b_busy) && (ricom->b_busy == false);
         bool redraw_tick = (ricom->b_busy && b_redraw && b_started);
+        if (trigger)
+        {
+            // The last frame is published before the reconstruction reports to be done
+            ricom->update_display();
+        }
         update_views(generic_windows_f, ricom, b_restarted, trigger, redraw_tick);
         update_views(generic_windows_c, ricom, b_restarted, trigger, redraw_tick);
 
@@ -727,8 +839,8 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
 
     if (run_thread.joinable())
         run_thread.join();
-    if (py_thread.joinable())
-        py_thread.join();
+    if (control_thread.joinable())
+        control_thread.join();
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplSDL2_Shutdown();
@@ -739,6 +851,7 @@ int run_gui(Ricom *ricom, CAMERA::Default_configurations &hardware_configuration
     SDL_Quit();
 
     ini_file.write(ini_cfg, true);
+    FFTPlans::save_wisdom("fftw_wisdom.dat");
     return 0;
 }
 
@@ -753,7 +866,7 @@ void update_views(std::map<std::string, ImGuiImageWindow<T>> &generic_windows_f,
             {
                 wnd.second.set_nx_ny(ricom->nx, ricom->ny);
             }
-            wnd.second.render_window(b_redraw, ricom->fr_count, ricom->kernel.kernel_size, trigger);
+            wnd.second.render_window(b_redraw, ricom->view.fr_count, ricom->kernel.kernel_size, trigger);
         }
         else
         {
@@ -763,15 +876,8 @@ void update_views(std::map<std::string, ImGuiImageWindow<T>> &generic_windows_f,
                 {
                     wnd.second.set_nx_ny(ricom->nx, ricom->ny);
                 }
-                wnd.second.render_window(b_redraw, ricom->fr_count, trigger);
+                wnd.second.render_window(b_redraw, ricom->view.fr_count, trigger);
             }
         }
     }
-}
-
-void bind_tex(SDL_Surface *srf, GLuint tex_id)
-{
-    glBindTexture(GL_TEXTURE_2D, (tex_id));
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, srf->w, srf->h, 0,
-                 GL_BGRA, GL_UNSIGNED_BYTE, srf->pixels);
 }
\ No newline at end of file
@@ -0,0 +1,257 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <new>
+
+#include "SharedRing.h"
+
+namespace chc = std::chrono;
+
+std::string SharedRing::shm_name(const std::string &name)
+{
+    return (name.empty() || name[0] != '/') ? "/" + name : name;
+}
+
+#ifndef _WIN32
+bool SharedRing::create(const std::string &name, size_t slot_size)
+{
+    close();
+    this->name = shm_name(name);
+    uint64_t n_slots = (std::max)(ring_size / slot_size, static_cast<size_t>(4));
+    map_size = data_offset + n_slots * slot_size;
+
+    // A segment left behind by a crashed publisher is replaced
+    shm_unlink(this->name.c_str());
+    int fd = shm_open(this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (fd < 0)
+    {
+        perror("SharedRing::create(): Error creating shared memory");
+        return false;
+    }
+    if (ftruncate(fd, static_cast<off_t>(map_size)) != 0)
+    {
+        perror("SharedRing::create(): Error sizing shared memory");
+        ::close(fd);
+        shm_unlink(this->name.c_str());
+        return false;
+    }
+    void *p = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        perror("SharedRing::create(): Error mapping shared memory");
+        shm_unlink(this->name.c_str());
+        return false;
+    }
+    header = new (p) Header();
+    header->slot_size = slot_size;
+    header->n_slots = n_slots;
+    header->n_written.store(0, std::memory_order_relaxed);
+    header->b_closed.store(0, std::memory_order_relaxed);
+    header->scan_start.store(0, std::memory_order_relaxed);
+    slots = static_cast<char *>(p) + data_offset;
+    b_owner = true;
+    // Readers only accept the segment once the magic is set
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, magic, sizeof(header->magic));
+    std::cout << "Publishing frames to shared memory " << this->name << " (" << n_slots << " frames)" << std::endl;
+    return true;
+}
+
+void SharedRing::publish(const char *head, size_t head_size, const char *data, size_t data_size)
+{
+    uint64_t w = header->n_written.load(std::memory_order_relaxed);
+    char *slot = slots + (w % header->n_slots) * header->slot_size;
+    size_t n_head = (std::min)(head_size, static_cast<size_t>(header->slot_size));
+    size_t n_data = (std::min)(data_size, static_cast<size_t>(header->slot_size) - n_head);
+    memcpy(slot, head, n_head);
+    memcpy(slot + n_head, data, n_data);
+    header->n_written.store(w + 1, std::memory_order_release);
+}
+
+// The next frame published is the first of an acquisition
+void SharedRing::start_scan()
+{
+    header->scan_start.store(header->n_written.load(std::memory_order_relaxed), std::memory_order_release);
+}
+
+bool SharedRing::open(const std::string &name, int timeout_ms, size_t scan_frames)
+{
+    close();
+    this->name = shm_name(name);
+    // The publisher creates the ring with the first frame, wait for it
+    auto t_end = chc::steady_clock::now() + chc::milliseconds(timeout_ms);
+    bool b_waiting = false;
+    while (true)
+    {
+        int fd = shm_open(this->name.c_str(), O_RDONLY, 0);
+        if (fd >= 0)
+        {
+            struct stat st;
+            if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) > data_offset)
+            {
+                map_size = static_cast<size_t>(st.st_size);
+                void *p = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+                if (p != MAP_FAILED)
+                {
+                    header = static_cast<Header *>(p);
+                    if (memcmp(header->magic, magic, sizeof(header->magic)) == 0)
+                    {
+                        ::close(fd);
+                        break;
+                    }
+                    munmap(p, map_size);
+                    header = nullptr;
+                }
+            }
+            ::close(fd);
+        }
+        if (chc::steady_clock::now() > t_end)
+        {
+            std::cout << "SharedRing::open(): No shared memory ring " << this->name << "!" << std::endl;
+            return false;
+        }
+        if (!b_waiting)
+        {
+            std::cout << "Waiting for shared memory ring " << this->name << "..." << std::endl;
+            b_waiting = true;
+        }
+        std::this_thread::sleep_for(chc::milliseconds(10));
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    slots = reinterpret_cast<char *>(header) + data_offset;
+    b_owner = false;
+    // Start with the newest scan still in the ring, or else with the next one
+    this->scan_frames = scan_frames;
+    uint64_t w = header->n_written.load(std::memory_order_acquire);
+    uint64_t s = header->scan_start.load(std::memory_order_acquire);
+    next = w;
+    if (scan_frames > 0 && w > s)
+    {
+        next = s + (w - s) / scan_frames * scan_frames;
+        if (w - next >= header->n_slots)
+        {
+            next += scan_frames;
+        }
+    }
+    n_skipped = 0;
+    return true;
+}
+
+// Copy the next frame into buffer (slot_size bytes), returns 0 when the publisher has finished
+size_t SharedRing::read_frame(char *buffer)
+{
+    const uint64_t n_slots = header->n_slots;
+    const size_t size = static_cast<size_t>(header->slot_size);
+    while (true)
+    {
+        uint64_t w = header->n_written.load(std::memory_order_acquire);
+        if (next >= w)
+        {
+            if (header->b_closed.load(std::memory_order_acquire))
+            {
+                return 0;
+            }
+            std::this_thread::sleep_for(chc::microseconds(50));
+            continue;
+        }
+        // Fell behind by a full ring, continue with the newest frame at the same position of
+        // a later scan
+        if (w - next >= n_slots)
+        {
+            uint64_t step = (scan_frames > 0) ? scan_frames : 1;
+            uint64_t n_skip = (std::max)((w - 1 - next) / step, static_cast<uint64_t>(1)) * step;
+            n_skipped += n_skip;
+            next += n_skip;
+            continue;
+        }
+        memcpy(buffer, slots + (next % n_slots) * size, size);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // The slot was overwritten while copying, skipped as above
+        if (header->n_written.load(std::memory_order_relaxed) - next >= n_slots)
+        {
+            continue;
+        }
+        next++;
+        return size;
+    }
+}
+
+void SharedRing::close()
+{
+    if (header == nullptr)
+    {
+        return;
+    }
+    if (b_owner)
+    {
+        header->b_closed.store(1, std::memory_order_release);
+        // Readers keep their mapping, new readers can no longer attach
+        shm_unlink(name.c_str());
+    }
+    else if (n_skipped > 0)
+    {
+        std::cout << "Frames skipped in shared memory ring: " << n_skipped << std::endl;
+    }
+    munmap(header, map_size);
+    header = nullptr;
+    slots = nullptr;
+    map_size = 0;
+    b_owner = false;
+}
+#else
+bool SharedRing::create(const std::string &name, size_t slot_size)
+{
+    (void)name;
+    (void)slot_size;
+    std::cout << "SharedRing::create(): Shared memory rings are not supported on Windows!" << std::endl;
+    return false;
+}
+
+void SharedRing::publish(const char *head, size_t head_size, const char *data, size_t data_size)
+{
+    (void)head;
+    (void)head_size;
+    (void)data;
+    (void)data_size;
+}
+
+void SharedRing::start_scan() {}
+
+bool SharedRing::open(const std::string &name, int timeout_ms, size_t scan_frames)
+{
+    (void)name;
+    (void)timeout_ms;
+    (void)scan_frames;
+    std::cout << "SharedRing::open(): Shared memory rings are not supported on Windows!" << std::endl;
+    return false;
+}
+
+size_t SharedRing::read_frame(char *buffer)
+{
+    (void)buffer;
+    return 0;
+}
+
+void SharedRing::close() {}
+#endif
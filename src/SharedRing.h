@@ -0,0 +1,73 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef SHARED_RING_H
+#define SHARED_RING_H
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+// Frame ring buffer in POSIX shared memory. One process publishes the frames of a
+// live stream, any number of processes read them, each at its own position. Readers
+// start at the first frame of a scan, counted from the frame the publisher marked as
+// the start of the acquisition. The publisher never waits for readers: a reader that
+// falls behind by more than the ring size skips ahead by whole scans.
+class SharedRing
+{
+public:
+    size_t ring_size; // Bytes of frame data kept in the ring
+
+    // Publisher
+    bool create(const std::string &name, size_t slot_size);
+    void publish(const char *head, size_t head_size, const char *data, size_t data_size);
+    void start_scan();
+    // Reader
+    bool open(const std::string &name, int timeout_ms, size_t scan_frames);
+    size_t read_frame(char *buffer);
+    size_t slot_size() { return header ? static_cast<size_t>(header->slot_size) : 0; };
+    size_t skipped() { return n_skipped; };
+
+    bool is_open() { return header != nullptr; };
+    void close();
+    SharedRing() : ring_size(64 << 20), name(), header(nullptr), slots(nullptr), map_size(0),
+                   b_owner(false), next(0), scan_frames(0), n_skipped(0){};
+    ~SharedRing() { close(); };
+
+private:
+    struct Header
+    {
+        char magic[8];
+        uint64_t slot_size;
+        uint64_t n_slots;
+        std::atomic<uint64_t> n_written;  // Frames published so far
+        std::atomic<uint64_t> b_closed;   // Publisher has finished
+        std::atomic<uint64_t> scan_start; // First frame of the acquisition
+    };
+    static constexpr const char *magic = "RICOMSHM";
+    static constexpr size_t data_offset = 4096;
+
+    std::string name;
+    Header *header;
+    char *slots;
+    size_t map_size;
+    bool b_owner;
+    uint64_t next;      // Next frame to read
+    size_t scan_frames; // Frames per scan of the reader (0: any frame starts a scan)
+    size_t n_skipped;
+
+    static std::string shm_name(const std::string &name);
+};
+#endif // SHARED_RING_H
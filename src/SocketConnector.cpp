@@ -13,16 +13,28 @@
 
 #include "SocketConnector.h"
 
+#include <thread>
+#include <chrono>
+
+// Copy data_size bytes from the stream into buffer. Bytes already pending in the
+// ring buffer are copied, the remainder is received directly into buffer.
 int SocketConnector::read_data(char *buffer, int data_size)
 {
-    int bytes_payload_total = 0;
+    size_t n = static_cast<size_t>(data_size);
+    size_t n_buffered = (std::min)(n, ring_tail - ring_head);
+    if (n_buffered > 0)
+    {
+        memcpy(buffer, &ring[ring_head], n_buffered);
+        consume(n_buffered);
+    }
 
+    int bytes_payload_total = static_cast<int>(n_buffered);
     while (bytes_payload_total < data_size)
     {
         int bytes_payload_count = recv(rc_socket,
-                                   &buffer[bytes_payload_total],
-                                   data_size - bytes_payload_total,
-                                   0);
+                                       &buffer[bytes_payload_total],
+                                       data_size - bytes_payload_total,
+                                       b_waitall ? MSG_WAITALL : 0);
 
         if (bytes_payload_count == -1)
         {
@@ -39,6 +51,145 @@ int SocketConnector::read_data(char *buffer, int data_size)
     return 0;
 }
 
+int SocketConnector::send_data(const char *buffer, int data_size)
+{
+    int bytes_total = 0;
+    while (bytes_total < data_size)
+    {
+        int bytes_count = send(rc_socket, &buffer[bytes_total], data_size - bytes_total, 0);
+        if (bytes_count == -1)
+        {
+            perror("Error sending Data!");
+            return -1;
+        }
+        bytes_total += bytes_count;
+    }
+    return 0;
+}
+
+// Returns a pointer to the next n contiguous bytes of the stream without
+// consuming them. The pointer stays valid until the next call to peek() or consume().
+const char *SocketConnector::peek(size_t n)
+{
+    if (ring_tail - ring_head < n)
+    {
+        if (fill(n) == -1)
+        {
+            return nullptr;
+        }
+    }
+    return &ring[ring_head];
+}
+
+// Returns a pointer to at least n_min pending bytes, together with whatever else has
+// already arrived up to n_max bytes (count in n). Used for streams without framing,
+// where each call should take as much data as is available.
+const char *SocketConnector::peek_some(size_t n_min, size_t n_max, size_t &n)
+{
+    n = 0;
+    if (ring_tail - ring_head < n_min && fill(n_min) == -1)
+    {
+        return nullptr;
+    }
+#ifdef MSG_DONTWAIT
+    if (ring_tail - ring_head < n_max)
+    {
+        if (ring_head + n_max > ring.size())
+        {
+            size_t pending = ring_tail - ring_head;
+            memmove(&ring[0], &ring[ring_head], pending);
+            ring_head = 0;
+            ring_tail = pending;
+        }
+        size_t space = (std::min)(ring.size(), ring_head + n_max) - ring_tail;
+        int bytes_count = recv(rc_socket, &ring[ring_tail], static_cast<int>(space), MSG_DONTWAIT);
+        if (bytes_count > 0)
+        {
+            ring_tail += bytes_count;
+        }
+    }
+#endif
+    n = (std::min)(n_max, ring_tail - ring_head);
+    return &ring[ring_head];
+}
+
+// Mark n bytes of the stream as processed
+void SocketConnector::consume(size_t n)
+{
+    ring_head += n;
+    if (ring_head >= ring_tail)
+    {
+        ring_head = 0;
+        ring_tail = 0;
+    }
+}
+
+// Receive from the socket until at least n bytes are pending in the ring buffer.
+// Whatever the kernel has already buffered is pulled in one large chunk,
+// only the missing part of the request is waited for.
+int SocketConnector::fill(size_t n)
+{
+    if (ring.size() < n)
+    {
+        ring.resize((std::max)(buffer_size, n));
+    }
+    size_t pending = ring_tail - ring_head;
+    if (ring_head + n > ring.size())
+    {
+        memmove(&ring[0], &ring[ring_head], pending);
+        ring_head = 0;
+        ring_tail = pending;
+    }
+
+    while (ring_tail - ring_head < n)
+    {
+        size_t missing = n - (ring_tail - ring_head);
+        size_t space = ring.size() - ring_tail;
+        int bytes_count = -1;
+#ifdef MSG_DONTWAIT
+        bytes_count = recv(rc_socket, &ring[ring_tail], space, MSG_DONTWAIT);
+        if (bytes_count > 0)
+        {
+            ring_tail += bytes_count;
+            continue;
+        }
+        if (bytes_count == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            perror("Error reading Data!");
+            return -1;
+        }
+#endif
+        if (b_waitall)
+        {
+            bytes_count = recv(rc_socket, &ring[ring_tail], static_cast<int>(missing), MSG_WAITALL);
+        }
+        else
+        {
+            bytes_count = recv(rc_socket, &ring[ring_tail], static_cast<int>(space), 0);
+        }
+
+        if (bytes_count == -1)
+        {
+            perror("Error reading Data!");
+            return -1;
+        }
+        else if (bytes_count == 0)
+        {
+            std::cout << "Unexpected end of transmission" << std::endl;
+            return -1;
+        }
+        ring_tail += bytes_count;
+    }
+    return 0;
+}
+
+void SocketConnector::reset_ring()
+{
+    ring.resize(buffer_size);
+    ring_head = 0;
+    ring_tail = 0;
+}
+
 void SocketConnector::flush_socket()
 {
     close_socket();
@@ -82,6 +233,16 @@ void SocketConnector::connect_socket()
         handle_socket_errors("setting socket options");
     }
 
+    // Large receive window, must be set before connecting for TCP window scaling
+    if (rcvbuf_size > 0)
+    {
+        if (setsockopt(rc_socket, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char *>(&rcvbuf_size), sizeof(rcvbuf_size)) == SOCKET_ERROR)
+        {
+            handle_socket_errors("setting receive buffer size");
+        }
+    }
+    reset_ring();
+
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = inet_addr(ip.c_str());
     address.sin_port = htons(port);
@@ -99,10 +260,31 @@ void SocketConnector::connect_socket()
                 handle_socket_errors("connecting to Socket");
             }
             error_counter++;
+            if (connect_attempts > 0)
+            {
+                if (error_counter >= connect_attempts)
+                {
+                    std::cout << "No connection to " << ip << ":" << port << " after " << error_counter << " attempts." << std::endl;
+                    close_socket();
+                    b_connected = false;
+                    return;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
         }
         else
         {
             std::cout << "Connected by " << inet_ntoa(address.sin_addr) << "\n";
+            int rcvbuf = 0;
+#ifdef WIN32
+            int rcvbuf_len = sizeof(rcvbuf);
+#else
+            socklen_t rcvbuf_len = sizeof(rcvbuf);
+#endif
+            if (getsockopt(rc_socket, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<char *>(&rcvbuf), &rcvbuf_len) == 0)
+            {
+                std::cout << "Receive buffer: " << rcvbuf / 1024 << " kB" << std::endl;
+            }
             b_connected = true;
             break;
         }
@@ -31,29 +31,54 @@
 #endif
 
 #include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
 #include <iostream>
+#include <atomic>
 
 class SocketConnector
 {
 public:
     SOCKET rc_socket;
 
-    bool b_connected;
+    std::atomic<bool> b_connected;
     std::string ip;
     int port;
+    int connect_attempts; // Attempts of connect_socket() before giving up (0: keep trying)
+
+    // Receive tuning
+    int rcvbuf_size;    // SO_RCVBUF in bytes (0: system default)
+    size_t buffer_size; // Capacity of the receive ring buffer in bytes
+    bool b_waitall;     // Use MSG_WAITALL when the ring buffer runs short
 
     std::string connection_information;
     int read_data(char *buffer, int data_size);
+    int send_data(const char *buffer, int data_size);
+    const char *peek(size_t n);
+    const char *peek_some(size_t n_min, size_t n_max, size_t &n);
+    void consume(size_t n);
     void flush_socket();
     void connect_socket();
     void close_socket();
     SocketConnector() : rc_socket(INVALID_SOCKET),
                         b_connected(false),
                         ip("127.0.0.1"),
-                        port(6342){};
+                        port(6342),
+                        connect_attempts(0),
+                        rcvbuf_size(8 * 1024 * 1024),
+                        buffer_size(16 * 1024 * 1024),
+                        b_waitall(true),
+                        ring(), ring_head(0), ring_tail(0){};
 
 private:
     struct sockaddr_in address;
+    // Receive ring buffer, bytes [ring_head, ring_tail) are pending
+    std::vector<char> ring;
+    size_t ring_head;
+    size_t ring_tail;
+    int fill(size_t n);
+    void reset_ring();
 #ifdef WIN32
     WSADATA w;
     const char opt = 1;
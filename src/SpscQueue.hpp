@@ -0,0 +1,143 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+// Bounded lock-free queue between exactly one producer and one consumer thread.
+// Each side owns one index and only reads the other one, the waiting variants spin
+// briefly and then back off to yielding and sleeping. close() releases both sides.
+template <typename T>
+class SpscQueue
+{
+public:
+    // Capacity is rounded up to a power of two, only call while no thread uses the queue
+    void init(size_t capacity)
+    {
+        size_t n = 2;
+        while (n < capacity)
+        {
+            n <<= 1;
+        }
+        slots.assign(n, T());
+        mask = n - 1;
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+        head_cache = 0;
+        tail_cache = 0;
+        b_closed.store(false, std::memory_order_release);
+    }
+
+    bool try_push(const T &item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail_cache > mask)
+        {
+            tail_cache = tail.load(std::memory_order_acquire);
+            if (h - tail_cache > mask)
+            {
+                return false;
+            }
+        }
+        slots[h & mask] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T &item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head_cache)
+        {
+            head_cache = head.load(std::memory_order_acquire);
+            if (t == head_cache)
+            {
+                return false;
+            }
+        }
+        item = slots[t & mask];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Waits while the queue is full, false once it is closed
+    bool push(const T &item)
+    {
+        int spins = 0;
+        while (!try_push(item))
+        {
+            if (is_closed())
+            {
+                return false;
+            }
+            backoff(spins);
+        }
+        return true;
+    }
+
+    // Waits while the queue is empty, false once it is closed and drained
+    bool pop(T &item)
+    {
+        int spins = 0;
+        while (!try_pop(item))
+        {
+            if (is_closed())
+            {
+                // Items pushed before close() are still handed out
+                return try_pop(item);
+            }
+            backoff(spins);
+        }
+        return true;
+    }
+
+    void close() { b_closed.store(true, std::memory_order_release); };
+    bool is_closed() { return b_closed.load(std::memory_order_acquire); };
+    size_t size() { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); };
+
+    explicit SpscQueue(size_t capacity = 1024) : slots(), mask(0), head(0), tail_cache(0),
+                                                 tail(0), head_cache(0), b_closed(false)
+    {
+        init(capacity);
+    };
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    // Producer and consumer state on separate cache lines, each with a copy of the other index
+    alignas(64) std::atomic<size_t> head; // Next slot to write
+    size_t tail_cache;                    // Producer's copy of tail
+    alignas(64) std::atomic<size_t> tail; // Next slot to read
+    size_t head_cache;                    // Consumer's copy of head
+    alignas(64) std::atomic<bool> b_closed;
+
+    static void backoff(int &spins)
+    {
+        if (++spins < 64)
+        {
+            return;
+        }
+        if (spins < 256)
+        {
+            std::this_thread::yield();
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+};
+#endif // SPSC_QUEUE_H
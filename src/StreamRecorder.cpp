@@ -0,0 +1,134 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#include "StreamRecorder.h"
+
+void StreamRecorder::open(const std::string &path)
+{
+    close();
+    this->path = path;
+    if (this->path.extension() != ".mib")
+    {
+        this->path += ".mib";
+    }
+    stream.open(this->path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!stream.is_open())
+    {
+        std::cout << "StreamRecorder::open(): Error opening file " << this->path << "!" << std::endl;
+        return;
+    }
+    n_written = 0;
+    n_dropped = 0;
+    b_failed = false;
+    b_running = true;
+    b_recording = true;
+    writer = std::thread(&StreamRecorder::run_writer, this);
+}
+
+// Acquisition header is stored next to the .mib file, as Merlin does
+void StreamRecorder::write_header(const char *data, size_t data_size)
+{
+    if (!b_recording)
+    {
+        return;
+    }
+    std::filesystem::path hdr_path = path;
+    hdr_path.replace_extension(".hdr");
+    std::ofstream hdr(hdr_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    hdr.write(data, data_size);
+}
+
+// Queue a frame (header + payload) for writing. The frame is swapped with a buffer written
+// before (or an empty one), which the caller fills next. Returns false if it was dropped.
+bool StreamRecorder::write_frame(std::vector<char> &frame)
+{
+    if (!b_recording)
+    {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx_queue);
+        if (b_failed)
+        {
+            return false;
+        }
+        if (queue.size() >= queue_limit)
+        {
+            n_dropped++;
+            return false;
+        }
+        queue.emplace();
+        queue.back().swap(frame);
+        if (!pool.empty())
+        {
+            frame.swap(pool.back());
+            pool.pop_back();
+        }
+    }
+    cnd_queue.notify_one();
+    return true;
+}
+
+void StreamRecorder::run_writer()
+{
+    std::unique_lock<std::mutex> lock(mtx_queue);
+    while (true)
+    {
+        cnd_queue.wait(lock, [this]
+                       { return !queue.empty() || !b_running; });
+        if (queue.empty())
+        {
+            break;
+        }
+        std::vector<char> buffer = std::move(queue.front());
+        queue.pop();
+        lock.unlock();
+        stream.write(buffer.data(), buffer.size());
+        lock.lock();
+        if (!stream)
+        {
+            std::cout << "StreamRecorder: Error writing to " << path << ", recording stopped!" << std::endl;
+            b_failed = true;
+            queue = std::queue<std::vector<char>>();
+            break;
+        }
+        n_written++;
+        pool.push_back(std::move(buffer));
+    }
+}
+
+void StreamRecorder::close()
+{
+    if (!b_recording)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx_queue);
+        b_running = false;
+    }
+    cnd_queue.notify_one();
+    if (writer.joinable())
+    {
+        writer.join();
+    }
+    stream.close();
+    pool.clear();
+    b_recording = false;
+    std::cout << "Recorded " << n_written << " frames to " << path;
+    if (n_dropped > 0)
+    {
+        std::cout << " (" << n_dropped << " frames dropped, disk too slow)";
+    }
+    std::cout << std::endl;
+}
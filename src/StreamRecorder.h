@@ -0,0 +1,62 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef STREAM_RECORDER_H
+#define STREAM_RECORDER_H
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <cstring>
+
+// Writes frames of a live stream to disk from a background thread.
+// Frames are handed over by swapping the caller's buffer with a recycled one through a bounded
+// queue, when the queue is full the frame is dropped instead of blocking the caller.
+// A failed write stops the recording.
+class StreamRecorder
+{
+public:
+    bool b_recording;
+    size_t queue_limit; // Maximum number of frames waiting to be written
+
+    void open(const std::string &path);
+    void write_header(const char *data, size_t data_size);
+    bool write_frame(std::vector<char> &frame);
+    void close();
+    StreamRecorder() : b_recording(false), queue_limit(256),
+                       path(), stream(), queue(), pool(),
+                       b_running(false), b_failed(false), n_written(0), n_dropped(0){};
+    ~StreamRecorder() { close(); };
+
+private:
+    std::filesystem::path path;
+    std::ofstream stream;
+    std::queue<std::vector<char>> queue;
+    std::vector<std::vector<char>> pool; // Written buffers for reuse
+    std::thread writer;
+    std::mutex mtx_queue;
+    std::condition_variable cnd_queue;
+    bool b_running;
+    bool b_failed; // Writing failed, frames are no longer accepted
+    size_t n_written;
+    size_t n_dropped;
+
+    void run_writer();
+};
+#endif // STREAM_RECORDER_H
@@ -0,0 +1,36 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef TIMEPIX_EVENT_H
+#define TIMEPIX_EVENT_H
+
+#include <cstdint>
+
+#ifdef __GNUC__
+#define PACK(__Declaration__) __Declaration__ __attribute__((__packed__))
+#endif
+
+#ifdef _MSC_VER
+#define PACK(__Declaration__) __pragma(pack(push, 1)) __Declaration__ __pragma(pack(pop))
+#endif
+
+// One event record as stored in .t3p files and sent by the Timepix event stream
+PACK(struct e_event
+     {
+         uint32_t index;
+         uint64_t toa;
+         uint8_t overflow;
+         uint8_t ftoa;
+         uint16_t tot;
+     });
+#endif // TIMEPIX_EVENT_H
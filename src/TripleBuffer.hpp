@@ -0,0 +1,57 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <array>
+#include <atomic>
+
+// Hands complete values from exactly one writer to exactly one reader thread without locks.
+// The writer fills back() and publishes it, the reader takes the newest published value with
+// update() and reads front(). Neither side waits, a value the reader missed is overwritten.
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Writer side, the slot stays owned by the writer until publish()
+    T &back() { return slots[i_back]; };
+    void publish()
+    {
+        i_back = middle.exchange(i_back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // Reader side, true if a newer value than the current front() was published
+    bool update()
+    {
+        if ((middle.load(std::memory_order_relaxed) & fresh_bit) == 0)
+        {
+            return false;
+        }
+        i_front = middle.exchange(i_front, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+    T &front() { return slots[i_front]; };
+
+    TripleBuffer() : slots(), i_back(0), middle(1), i_front(2){};
+
+private:
+    static const int index_mask = 3;
+    static const int fresh_bit = 4;
+    std::array<T, 3> slots;
+    // Each side owns one slot index, the third is exchanged through middle
+    alignas(64) int i_back;
+    alignas(64) std::atomic<int> middle; // Slot index and fresh_bit if it was not read yet
+    alignas(64) int i_front;
+};
+#endif // TRIPLE_BUFFER_H
@@ -0,0 +1,254 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#include <fstream>
+#include <cctype>
+#include <algorithm>
+
+#include "ArrayInterface.h"
+
+// Accepts numpy type descriptions ("<u2", "|u1", ">f4") and names ("uint16", "float32")
+ArrayInterface::Dtype ArrayInterface::parse_dtype(const std::string &dtype, bool &big_endian)
+{
+    std::string t = dtype;
+    big_endian = false;
+    if (!t.empty() && (t[0] == '<' || t[0] == '>' || t[0] == '|' || t[0] == '='))
+    {
+        big_endian = (t[0] == '>');
+        t = t.substr(1);
+    }
+    if (t == "u1" || t == "uint8")
+    {
+        big_endian = false;
+        return U8;
+    }
+    if (t == "u2" || t == "uint16")
+    {
+        return U16;
+    }
+    if (t == "u4" || t == "uint32")
+    {
+        return U32;
+    }
+    if (t == "f4" || t == "float32")
+    {
+        return F32;
+    }
+    return INVALID;
+}
+
+size_t ArrayInterface::dtype_size(Dtype dtype)
+{
+    switch (dtype)
+    {
+    case U8:
+        return 1;
+    case U16:
+        return 2;
+    case U32:
+    case F32:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+// Header: "\x93NUMPY", version, header length, then a python dict literal, e.g.
+// {'descr': '<u2', 'fortran_order': False, 'shape': (64, 64, 256, 256), }
+bool ArrayInterface::parse_npy_header(const std::string &path, std::string &descr, std::vector<size_t> &shape, size_t &offset)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    char pre[12];
+    file.read(pre, sizeof(pre));
+    if (!file || memcmp(pre, "\x93NUMPY", 6) != 0)
+    {
+        std::cout << "ArrayInterface: " << path << " is not a .npy file!" << std::endl;
+        return false;
+    }
+    size_t l_head;
+    if (pre[6] == 1)
+    {
+        l_head = static_cast<uint8_t>(pre[8]) | (static_cast<uint8_t>(pre[9]) << 8);
+        offset = 10 + l_head;
+    }
+    else
+    {
+        l_head = static_cast<uint8_t>(pre[8]) | (static_cast<uint8_t>(pre[9]) << 8) |
+                 (static_cast<uint8_t>(pre[10]) << 16) | (static_cast<size_t>(static_cast<uint8_t>(pre[11])) << 24);
+        offset = 12 + l_head;
+    }
+    std::string head(l_head, '\0');
+    file.seekg(offset - l_head, std::ios::beg);
+    file.read(&head[0], l_head);
+    if (!file)
+    {
+        std::cout << "ArrayInterface: Header of " << path << " is incomplete!" << std::endl;
+        return false;
+    }
+
+    size_t p = head.find("'descr'");
+    size_t q0 = head.find('\'', head.find(':', p) + 1);
+    size_t q1 = head.find('\'', q0 + 1);
+    if (p == std::string::npos || q0 == std::string::npos || q1 == std::string::npos)
+    {
+        std::cout << "ArrayInterface: No data type in the header of " << path << "!" << std::endl;
+        return false;
+    }
+    descr = head.substr(q0 + 1, q1 - q0 - 1);
+
+    p = head.find("'fortran_order'");
+    if (p != std::string::npos && head.compare(head.find(':', p) + 1, 5, " True") == 0)
+    {
+        std::cout << "ArrayInterface: Fortran ordered arrays are not supported!" << std::endl;
+        return false;
+    }
+
+    p = head.find("'shape'");
+    size_t s0 = head.find('(', p);
+    size_t s1 = head.find(')', s0);
+    if (p == std::string::npos || s0 == std::string::npos || s1 == std::string::npos)
+    {
+        std::cout << "ArrayInterface: No shape in the header of " << path << "!" << std::endl;
+        return false;
+    }
+    shape.clear();
+    std::string dims = head.substr(s0 + 1, s1 - s0 - 1);
+    size_t i = 0;
+    while (i < dims.size())
+    {
+        if (isdigit(dims[i]))
+        {
+            size_t n = 0;
+            shape.push_back(std::stoul(dims.substr(i), &n));
+            i += n;
+        }
+        else
+        {
+            i++;
+        }
+    }
+    return true;
+}
+
+// Frame size, data type and (for 4D arrays) scan size from the .npy header
+bool ArrayInterface::read_npy_header(const std::string &path, CAMERA::Camera_BASE &cam, int &nx_scan, int &ny_scan)
+{
+    std::string descr;
+    std::vector<size_t> shape;
+    size_t offset;
+    if (!parse_npy_header(path, descr, shape, offset))
+    {
+        return false;
+    }
+    bool big_endian;
+    if (parse_dtype(descr, big_endian) == INVALID)
+    {
+        std::cout << "ArrayInterface: Data type " << descr << " not supported (uint8, uint16, uint32 or float32)!" << std::endl;
+        return false;
+    }
+    if (shape.size() < 3)
+    {
+        std::cout << "ArrayInterface: Expected a 3D or 4D array in " << path << "!" << std::endl;
+        return false;
+    }
+    size_t n = shape.size();
+    cam.nx_cam = static_cast<int>(shape[n - 1]);
+    cam.ny_cam = static_cast<int>(shape[n - 2]);
+    if (n == 4)
+    {
+        nx_scan = static_cast<int>(shape[1]);
+        ny_scan = static_cast<int>(shape[0]);
+    }
+    cam.dtype = descr;
+    cam.header_size = offset;
+    cam.swap_endian = big_endian;
+    return true;
+}
+
+// Ask the OS to read the next window of frames ahead, hides the latency of network storage
+void ArrayInterface::prefetch(size_t frame)
+{
+    if (frame < n_frames)
+    {
+        file.prefetch(data_offset + frame * frame_bytes, prefetch_frames * frame_bytes);
+    }
+}
+
+void ArrayInterface::init_interface(const std::string &path)
+{
+    i_frame = 0;
+    b_stream = FileConnector::is_stream(path);
+    if (b_stream)
+    {
+        stream.path = path;
+        stream.open_file();
+        return;
+    }
+    // The header of .npy files is authoritative, raw files rely on the settings
+    if (std::filesystem::path(path).extension() == ".npy")
+    {
+        std::vector<size_t> shape;
+        if (parse_npy_header(path, descr, shape, data_offset) && shape.size() >= 3 &&
+            (shape[shape.size() - 1] != static_cast<size_t>(nx) || shape[shape.size() - 2] != static_cast<size_t>(ny)))
+        {
+            std::cout << "ArrayInterface: Frame size in the file (" << shape[shape.size() - 1] << "x"
+                      << shape[shape.size() - 2] << ") differs from the camera settings!" << std::endl;
+        }
+    }
+    if (!file.open(path))
+    {
+        perror("ArrayInterface::init_interface(): Error mapping file");
+    }
+}
+
+ArrayInterface::Dtype ArrayInterface::pre_run()
+{
+    Dtype dtype = parse_dtype(descr, b_big_endian);
+    if (dtype == INVALID)
+    {
+        std::cout << "ArrayInterface::pre_run(): Data type " << descr << " not supported!" << std::endl;
+        return INVALID;
+    }
+    frame_bytes = static_cast<size_t>(nx) * ny * dtype_size(dtype);
+    if (b_stream)
+    {
+        // Skip the stream header
+        std::vector<char> head(data_offset);
+        if (data_offset > 0)
+        {
+            stream.read_data(&head[0], data_offset);
+        }
+        std::cout << "Reading frames of " << nx << "x" << ny << " (" << descr << ") from " << stream.path << std::endl;
+        return dtype;
+    }
+    n_frames = (file.size() > data_offset) ? (file.size() - data_offset) / frame_bytes : 0;
+    if (!file.is_open() || n_frames == 0)
+    {
+        std::cout << "ArrayInterface::pre_run(): File contains no complete frame!" << std::endl;
+        return INVALID;
+    }
+    prefetch_frames = (std::max)(static_cast<size_t>((8 << 20) / frame_bytes), static_cast<size_t>(1));
+    std::cout << "Mapped " << n_frames << " frames of " << nx << "x" << ny << " (" << descr << ")" << std::endl;
+    return dtype;
+}
+
+void ArrayInterface::close_interface()
+{
+    if (b_stream)
+    {
+        stream.close_file();
+        b_stream = false;
+        return;
+    }
+    file.close();
+}
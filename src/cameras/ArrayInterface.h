@@ -0,0 +1,103 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef ARRAY_INTERFACE_H
+#define ARRAY_INTERFACE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <filesystem>
+
+#include "Camera.h"
+#include "FileConnector.h"
+#include "MappedFile.h"
+
+// 4D-STEM datasets from other detectors or simulations, stored as .npy file or as
+// headerless raw binary file (frames in scan order, row-major). The file is mapped
+// into memory and the frames are passed to the reconstruction without copying.
+// Raw frames can also be streamed from stdin, a named pipe or a shared memory ring.
+class ArrayInterface
+{
+public:
+    enum Dtype
+    {
+        U8,
+        U16,
+        U32,
+        F32,
+        INVALID
+    };
+
+private:
+    MappedFile file;
+    size_t frame_bytes;
+    size_t n_frames;
+    size_t i_frame;
+    size_t prefetch_frames; // Frames per read-ahead window
+    bool b_big_endian;
+    bool b_stream; // Frames are read sequentially instead of mapped
+    FileConnector stream;
+
+    void prefetch(size_t frame);
+
+protected:
+    int nx;
+    int ny;
+    std::string descr;  // numpy style type description, e.g. "<u2"
+    size_t data_offset; // Header size in bytes
+
+public:
+    static Dtype parse_dtype(const std::string &dtype, bool &big_endian);
+    static size_t dtype_size(Dtype dtype);
+    static bool parse_npy_header(const std::string &path, std::string &descr, std::vector<size_t> &shape, size_t &offset);
+    static bool read_npy_header(const std::string &path, CAMERA::Camera_BASE &cam, int &nx_scan, int &ny_scan);
+
+    void init_interface(const std::string &path);
+    Dtype pre_run();
+    bool big_endian() { return b_big_endian; };
+    template <typename T>
+    const T *next_frame(std::vector<T> &data);
+    void close_interface();
+
+    ArrayInterface() : file(), frame_bytes(0), n_frames(0), i_frame(0), prefetch_frames(1), b_big_endian(false),
+                       b_stream(false), stream(),
+                       nx(256), ny(256), descr("<u2"), data_offset(0){};
+};
+
+// Frames follow each other in the file, the file is repeated if more frames are requested
+template <typename T>
+const T *ArrayInterface::next_frame(std::vector<T> &data)
+{
+    if (b_stream)
+    {
+        stream.read_data(reinterpret_cast<char *>(&data[0]), frame_bytes);
+        return &data[0];
+    }
+    const char *p = file.data() + data_offset + i_frame * frame_bytes;
+    if (i_frame % prefetch_frames == 0)
+    {
+        prefetch(i_frame + prefetch_frames);
+    }
+    i_frame = (i_frame + 1) % n_frames;
+    // Unaligned element access is not allowed, copy instead (raw files with odd header size)
+    if (reinterpret_cast<uintptr_t>(p) % alignof(T) != 0)
+    {
+        memcpy(&data[0], p, frame_bytes);
+        return &data[0];
+    }
+    return reinterpret_cast<const T *>(p);
+}
+#endif // ARRAY_INTERFACE_H
@@ -0,0 +1,120 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef ARRAY_WRAPPER_H
+#define ARRAY_WRAPPER_H
+
+#include "Camera.h"
+#include "ArrayInterface.h"
+#include "Ricom.h"
+
+using namespace CAMERA;
+
+// Default constructor and definition of default configurations
+template <>
+Camera<ArrayInterface, FRAME_BASED>::Camera()
+{
+    model = ARRAY;
+    type = FRAME_BASED;
+    nx = 256;
+    ny = 256;
+    swap_endian = false;
+};
+template <>
+Camera<ArrayInterface, EVENT_BASED>::Camera(){};
+
+// Constructor with camera_base as argument
+template <>
+Camera<ArrayInterface, FRAME_BASED>::Camera(Camera_BASE &cam)
+{
+    type = FRAME_BASED;
+    nx = cam.nx_cam;
+    ny = cam.ny_cam;
+    descr = cam.dtype;
+    data_offset = cam.header_size;
+    swap_endian = cam.swap_endian;
+    u = cam.u;
+    v = cam.v;
+};
+template <>
+Camera<ArrayInterface, EVENT_BASED>::Camera(Camera_BASE &cam) { (void)cam; };
+
+// Frames are read from the mapped file without copying
+template <>
+template <typename T>
+const T *Camera<ArrayInterface, FRAME_BASED>::next_frame(std::vector<T> &data, bool b_first)
+{
+    (void)b_first;
+    return ArrayInterface::next_frame<T>(data);
+};
+
+// Read frame method wrapper
+template <>
+template <typename T>
+void Camera<ArrayInterface, FRAME_BASED>::read_frame(std::vector<T> &data, bool b_first)
+{
+    const T *p = next_frame<T>(data, b_first);
+    if (p != &data[0])
+    {
+        std::copy(p, p + data.size(), data.begin());
+    }
+};
+
+// Template Specializations to avoid linker issues
+template const uint8_t *Camera<ArrayInterface, FRAME_BASED>::next_frame(std::vector<uint8_t> &data, bool b_first);
+template const uint16_t *Camera<ArrayInterface, FRAME_BASED>::next_frame(std::vector<uint16_t> &data, bool b_first);
+template const uint32_t *Camera<ArrayInterface, FRAME_BASED>::next_frame(std::vector<uint32_t> &data, bool b_first);
+template const float *Camera<ArrayInterface, FRAME_BASED>::next_frame(std::vector<float> &data, bool b_first);
+template void Camera<ArrayInterface, FRAME_BASED>::read_frame(std::vector<uint8_t> &data, bool b_first);
+template void Camera<ArrayInterface, FRAME_BASED>::read_frame(std::vector<uint16_t> &data, bool b_first);
+template void Camera<ArrayInterface, FRAME_BASED>::read_frame(std::vector<uint32_t> &data, bool b_first);
+template void Camera<ArrayInterface, FRAME_BASED>::read_frame(std::vector<float> &data, bool b_first);
+
+// Run method wrapper
+template <>
+void Camera<ArrayInterface, FRAME_BASED>::run(Ricom *ricom)
+{
+    switch (ricom->mode)
+    {
+    case RICOM::modes::FILE:
+        ArrayInterface::init_interface(ricom->file_path);
+        break;
+    case RICOM::modes::TCP:
+        perror("TCP mode not supported for array files");
+        return;
+    }
+    ArrayInterface::Dtype dtype = ArrayInterface::pre_run();
+    ricom->camera.swap_endian = ArrayInterface::big_endian();
+    switch (dtype)
+    {
+    case ArrayInterface::U8:
+        ricom->process_data<uint8_t, ArrayInterface>(this);
+        break;
+    case ArrayInterface::U16:
+        ricom->process_data<uint16_t, ArrayInterface>(this);
+        break;
+    case ArrayInterface::U32:
+        ricom->process_data<uint32_t, ArrayInterface>(this);
+        break;
+    case ArrayInterface::F32:
+        ricom->process_data<float, ArrayInterface>(this);
+        break;
+    default:
+        perror("Camera<ArrayInterface, FRAME_BASED>::run: pre_run returned an error!");
+        break;
+    }
+    close_interface();
+};
+template <>
+void Camera<ArrayInterface, EVENT_BASED>::run(Ricom *ricom) { (void)ricom; };
+#endif // ARRAY_WRAPPER_H
@@ -0,0 +1,155 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#include "MerlinControl.h"
+
+bool MerlinControl::connect(const std::string &ip, int port)
+{
+    socket.ip = ip;
+    socket.port = port;
+    socket.rcvbuf_size = 0;
+    socket.buffer_size = 4096;
+    // The control port is up as soon as the Merlin software runs, so a few seconds will do
+    socket.connect_attempts = 30;
+    socket.connect_socket();
+    return socket.b_connected;
+}
+
+void MerlinControl::disconnect()
+{
+    if (socket.b_connected)
+    {
+        socket.close_socket();
+        socket.b_connected = false;
+    }
+}
+
+int MerlinControl::set(const std::string &name, const std::string &value)
+{
+    return send_command("SET", name, value, nullptr);
+}
+
+int MerlinControl::get(const std::string &name, std::string &value)
+{
+    return send_command("GET", name, "", &value);
+}
+
+int MerlinControl::cmd(const std::string &name)
+{
+    return send_command("CMD", name, "", nullptr);
+}
+
+// Send a command and wait for the answer of the camera
+int MerlinControl::send_command(const std::string &type, const std::string &name, const std::string &value, std::string *response_value)
+{
+    std::string body = "," + type + "," + name;
+    if (!value.empty())
+    {
+        body += "," + value;
+    }
+    char head[16];
+    snprintf(head, sizeof(head), "MPX,%010zu", body.size());
+    std::string msg = head + body;
+    if (socket.send_data(msg.data(), static_cast<int>(msg.size())) == -1)
+    {
+        std::cout << "MerlinControl: Error sending " << type << " " << name << std::endl;
+        return NO_RESPONSE;
+    }
+
+    // Response header "MPX,<length>"
+    std::string rsp(14, '\0');
+    if (socket.read_data(&rsp[0], 14) == -1 || rsp.compare(0, 4, "MPX,") != 0)
+    {
+        std::cout << "MerlinControl: No valid response to " << type << " " << name << std::endl;
+        return NO_RESPONSE;
+    }
+    char *end;
+    unsigned long l = strtoul(rsp.c_str() + 4, &end, 10);
+    if (end != rsp.c_str() + 14 || l == 0 || l > 4096)
+    {
+        std::cout << "MerlinControl: Invalid response length to " << type << " " << name << std::endl;
+        return NO_RESPONSE;
+    }
+    rsp.assign(l, '\0');
+    if (socket.read_data(&rsp[0], static_cast<int>(l)) == -1)
+    {
+        return NO_RESPONSE;
+    }
+
+    // Status is the last field, a value (GET) the one before
+    size_t i_status = rsp.rfind(',');
+    const char *s_status = rsp.c_str() + i_status + 1;
+    long status = (i_status == std::string::npos) ? 0 : strtol(s_status, &end, 10);
+    if (i_status == std::string::npos || end == s_status)
+    {
+        std::cout << "MerlinControl: No status in the response to " << type << " " << name << std::endl;
+        return NO_RESPONSE;
+    }
+    if (response_value != nullptr)
+    {
+        size_t i_value = (i_status > 0) ? rsp.rfind(',', i_status - 1) : std::string::npos;
+        if (i_value == std::string::npos)
+        {
+            return NO_RESPONSE;
+        }
+        *response_value = rsp.substr(i_value + 1, i_status - i_value - 1);
+    }
+    if (status != SUCCESS)
+    {
+        std::cout << "MerlinControl: " << type << " " << name << " " << value << " failed (" << status_string(static_cast<int>(status)) << ")" << std::endl;
+    }
+    return static_cast<int>(status);
+}
+
+// Configure the camera with the settings from the GUI and start the acquisition
+int MerlinControl::arm(MerlinSettings &settings, int depth, int n_frames)
+{
+    int status = SUCCESS;
+    auto check = [&status](int s)
+    { if (s != SUCCESS) status = s; };
+
+    check(set("HVBIAS", settings.hvbias));
+    check(set("THRESHOLD0", settings.threshold0));
+    check(set("THRESHOLD1", settings.threshold1));
+    check(set("CONTINUOUSRW", (int)settings.continuousrw));
+    check(set("COUNTERDEPTH", depth));
+    check(set("ACQUISITIONTIME", settings.dwell_time));
+    check(set("ACQUISITIONPERIOD", settings.dwell_time));
+    check(set("NUMFRAMESTOACQUIRE", n_frames));
+    check(set("FILEENABLE", (int)settings.save));
+    check(set("RUNHEADLESS", (int)settings.headless));
+    check(set("FILEFORMAT", (int)settings.raw * 2));
+    check(set("TRIGGERSTART", (int)settings.trigger));
+    if (status == NO_RESPONSE)
+    {
+        return status;
+    }
+    return cmd("STARTACQUISITION");
+}
+
+const char *MerlinControl::status_string(int status)
+{
+    switch (status)
+    {
+    case SUCCESS:
+        return "success";
+    case BUSY:
+        return "system busy";
+    case NOT_RECOGNISED:
+        return "command not recognised";
+    case OUT_OF_RANGE:
+        return "parameter out of range";
+    default:
+        return "no response";
+    }
+}
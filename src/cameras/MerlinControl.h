@@ -0,0 +1,66 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+#ifndef MERLIN_CONTROL_H
+#define MERLIN_CONTROL_H
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+
+#include "SocketConnector.h"
+#include "MerlinInterface.h"
+
+// Client for the Merlin control port.
+// Commands are sent as "MPX,<length>,<TYPE>,<NAME>[,<VALUE>]", where TYPE is SET, GET or CMD
+// and length counts the bytes following the length field (including the leading comma).
+// The camera answers "MPX,<length>,<TYPE>,<NAME>[,<VALUE>],<STATUS>".
+class MerlinControl
+{
+public:
+    enum Status
+    {
+        SUCCESS = 0,
+        BUSY = 1,
+        NOT_RECOGNISED = 2,
+        OUT_OF_RANGE = 3,
+        NO_RESPONSE = -1
+    };
+
+    bool connect(const std::string &ip, int port);
+    void disconnect();
+    int set(const std::string &name, const std::string &value);
+    template <typename T>
+    int set(const std::string &name, T value);
+    int get(const std::string &name, std::string &value);
+    int cmd(const std::string &name);
+    int arm(MerlinSettings &settings, int depth, int n_frames);
+    MerlinControl() : socket(){};
+
+private:
+    SocketConnector socket;
+    int send_command(const std::string &type, const std::string &name, const std::string &value, std::string *response_value);
+    static const char *status_string(int status);
+};
+
+template <typename T>
+int MerlinControl::set(const std::string &name, T value)
+{
+    std::ostringstream ss;
+    ss << value;
+    return set(name, ss.str());
+}
+
+#endif // MERLIN_CONTROL_H
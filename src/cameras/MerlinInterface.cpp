@@ -13,6 +13,116 @@
 
 #include "MerlinInterface.h"
 
+// Parse n decimal digits, non-digit characters (padding) are skipped
+static inline size_t parse_uint(const char *p, size_t n)
+{
+    size_t val = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (p[i] >= '0' && p[i] <= '9')
+        {
+            val = val * 10 + (p[i] - '0');
+        }
+    }
+    return val;
+}
+
+// Read TCP and frame header from the socket ring buffer and validate them
+bool MerlinInterface::read_tcp_frame_head()
+{
+    const size_t l_tcp = tcp_buffer.size();
+    // TCP header "MPX,<length>," and frame header start "MQ1,<frame>,<header length>"
+    const char *p = socket->peek(l_tcp + 16);
+    if (p == nullptr)
+    {
+        return false;
+    }
+    if (memcmp(p, "MPX,", 4) != 0 || memcmp(p + l_tcp, "MQ1,", 4) != 0)
+    {
+        std::cerr << "MerlinInterface::read_tcp_frame_head(): Stream is out of sync, invalid header!" << std::endl;
+        return false;
+    }
+    size_t l_frame = parse_uint(p + 4, 10);
+    int fr = static_cast<int>(parse_uint(p + l_tcp + 4, 6));
+    size_t l_head = parse_uint(p + l_tcp + 11, 5);
+    if (l_head < 16 || l_head > l_frame)
+    {
+        std::cerr << "MerlinInterface::read_tcp_frame_head(): Invalid frame header length (" << l_head << ")!" << std::endl;
+        return false;
+    }
+
+    p = socket->peek(l_tcp + l_head);
+    if (p == nullptr)
+    {
+        return false;
+    }
+    frame_head.assign(p + l_tcp, p + l_tcp + l_head);
+    memcpy(&head_buffer[0], &frame_head[0], (std::min)(l_head, head_buffer.size()));
+    socket->consume(l_tcp + l_head);
+    tcp_payload = l_frame - l_head;
+
+    if (frame_id >= 0 && fr > frame_id + 1)
+    {
+        n_dropped += fr - frame_id - 1;
+    }
+    frame_id = fr;
+    return true;
+}
+
+// Read the payload of the current TCP frame, a short frame is padded with zeros
+void MerlinInterface::read_tcp_frame_data(char *buffer, size_t data_size)
+{
+    size_t n = (std::min)(data_size, tcp_payload);
+    // A recorded frame is received behind its header into the buffer handed to the recorder,
+    // the frame to decode is copied from there
+    bool b_record = recorder.b_recording;
+    char *dst = buffer;
+    if (b_record)
+    {
+        record_frame.resize(frame_head.size() + data_size);
+        memcpy(&record_frame[0], &frame_head[0], frame_head.size());
+        dst = &record_frame[frame_head.size()];
+    }
+    if (socket->read_data(dst, static_cast<int>(n)) == -1)
+    {
+        perror("MerlinInterface::read_data<MODE_TCP>(): Error reading frame data from Socket!");
+    }
+    tcp_payload -= n;
+    if (n < data_size)
+    {
+        memset(dst + n, 0, data_size - n);
+        n_short++;
+    }
+    if (b_record)
+    {
+        memcpy(buffer, dst, data_size);
+        recorder.write_frame(record_frame);
+    }
+    if (!shm_name.empty())
+    {
+        // The ring is sized with the first frame
+        if (!ring.is_open() && !ring.create(shm_name, frame_head.size() + data_size))
+        {
+            shm_name.clear();
+        }
+        else
+        {
+            // Merlin counts the frames of each acquisition from 1
+            if (frame_id == 1)
+            {
+                ring.start_scan();
+            }
+            ring.publish(&frame_head[0], frame_head.size(), buffer, data_size);
+        }
+    }
+    // Skip trailing bytes so the next header is found at the right position
+    if (tcp_payload > 0 && socket->peek(tcp_payload) != nullptr)
+    {
+        socket->consume(tcp_payload);
+    }
+    tcp_payload = 0;
+}
+
 void MerlinInterface::read_head_data()
 {
     switch (mode)
@@ -21,11 +131,7 @@ void MerlinInterface::read_head_data()
         file.read_data(&head_buffer[0], head_buffer.size());
         break;
     case MODE_TCP:
-        if (socket->read_data(&tcp_buffer[0], tcp_buffer.size()) == -1)
-        {
-            perror("MerlinInterface::read_head_data<MODE_TCP>(): Error reading TCP header from Socket!");
-        }
-        if (socket->read_data(&head_buffer[0], head_buffer.size()) == -1)
+        if (!read_tcp_frame_head())
         {
             perror("MerlinInterface::read_head_data<MODE_TCP>(): Error reading Frame header from Socket!");
         }
@@ -41,10 +147,7 @@ void MerlinInterface::read_data(char *buffer, int data_size)
         file.read_data(buffer, data_size);
         break;
     case MODE_TCP:
-        if (socket->read_data(buffer, data_size) == -1)
-        {
-            perror("MerlinInterface::read_data<MODE_TCP>(): Error reading frame data from Socket!");
-        }
+        read_tcp_frame_data(buffer, static_cast<size_t>(data_size));
         break;
     }
 }
@@ -138,6 +241,7 @@ int MerlinInterface::read_aquisition_header()
     acq_header.resize(l);
     char *buffer = reinterpret_cast<char *>(&acq_header[0]);
     socket->read_data(buffer, l);
+    recorder.write_header(buffer, l);
     char *p = strtok(buffer, " ");
     while (p)
     {
@@ -284,14 +388,31 @@ void MerlinInterface::init_interface(SocketConnector *socket)
 {
     mode = MODE_TCP;
     this->socket = socket;
+    tcp_payload = 0;
+    frame_id = -1;
+    n_dropped = 0;
+    n_short = 0;
     // socket->flush_socket();
     socket->connect_socket();
 };
 
-void MerlinInterface::init_interface(const std::string &path)
+// Record the live stream to a .mib file while it is processed
+void MerlinInterface::init_recorder(const std::string &path)
+{
+    recorder.open(path);
+};
+
+// Share the live frames with other processes, they read the ring like a .mib file
+void MerlinInterface::init_publisher(const std::string &name)
+{
+    shm_name = name;
+};
+
+void MerlinInterface::init_interface(const std::string &path, size_t scan_frames)
 {
     mode = MODE_FILE;
     file.path = path;
+    file.scan_frames = scan_frames;
     file.open_file();
 };
 
@@ -300,8 +421,15 @@ void MerlinInterface::close_interface()
     switch (mode)
     {
     case MODE_TCP:
+        if (n_dropped > 0 || n_short > 0)
+        {
+            std::cout << "Frames dropped: " << n_dropped << ", short frames: " << n_short << std::endl;
+        }
         socket->close_socket();
         socket->b_connected = false;
+        recorder.close();
+        ring.close();
+        shm_name.clear();
         break;
     case MODE_FILE:
         file.close_file();
@@ -311,10 +439,12 @@ void MerlinInterface::close_interface()
     }
 };
 
-MerlinInterface::MerlinInterface() : socket(), file(), dtype(),
-                                     head_buffer(), head(), tcp_buffer(),
+MerlinInterface::MerlinInterface() : socket(), file(), recorder(), ring(), shm_name(), dtype(),
+                                     head_buffer(), head(), tcp_buffer(), frame_head(), record_frame(),
                                      rcv(), ds_merlin(),
                                      b_raw(true), b_binary(true),
+                                     tcp_payload(0), frame_id(-1),
+                                     n_dropped(0), n_short(0),
                                      nx(256), ny(256),
                                      data_depth(1), mode(MODE_FILE),
                                      acq(), acq_header(){};
\ No newline at end of file
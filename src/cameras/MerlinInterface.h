@@ -27,6 +27,8 @@
 
 #include "SocketConnector.h"
 #include "FileConnector.h"
+#include "StreamRecorder.h"
+#include "SharedRing.h"
 
 class MerlinInterface
 {
@@ -39,11 +41,16 @@ private:
 
     SocketConnector *socket;
     FileConnector file;
+    StreamRecorder recorder;
+    SharedRing ring;
+    std::string shm_name; // Shared memory ring to publish to
 
     std::string dtype;
     std::array<char, 384> head_buffer;
     std::array<std::string, 8> head;
     std::array<char, 15> tcp_buffer;
+    std::vector<char> frame_head; // Complete header of the current TCP frame
+    std::vector<char> record_frame; // Header and payload of the frame to record
     std::string rcv;
 
     // Data Properties
@@ -51,7 +58,15 @@ private:
     bool b_raw;
     bool b_binary;
 
+    // Live stream state
+    size_t tcp_payload; // Bytes of the current TCP frame not yet read
+    int frame_id;       // Frame number of the last frame header
+    size_t n_dropped;   // Frames missing in the sequence of frame numbers
+    size_t n_short;     // Frames with less payload than expected
+
     inline void read_head_data();
+    inline bool read_tcp_frame_head();
+    inline void read_tcp_frame_data(char *buffer, size_t data_size);
     void init_uv(std::vector<int> &u, std::vector<int> &v);
 
 protected:
@@ -79,7 +94,9 @@ public:
     template <typename T>
     void read_frame(std::vector<T> &data, bool dump_head);
     void init_interface(SocketConnector *socket);
-    void init_interface(const std::string &path);
+    void init_interface(const std::string &path, size_t scan_frames);
+    void init_recorder(const std::string &path);
+    void init_publisher(const std::string &name);
     void close_interface();
 };
 
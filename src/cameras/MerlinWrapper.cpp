@@ -56,9 +56,19 @@ void Camera<MerlinInterface, FRAME_BASED>::read_frame(std::vector<T> &data, bool
 {
     MerlinInterface::read_frame<T>(data, b_first);
 };
+// Frames are decoded into data
+template <>
+template <typename T>
+const T *Camera<MerlinInterface, FRAME_BASED>::next_frame(std::vector<T> &data, bool b_first)
+{
+    MerlinInterface::read_frame<T>(data, b_first);
+    return &data[0];
+};
 // Template Specializations to avoid linker issues
 template void Camera<MerlinInterface, FRAME_BASED>::read_frame(std::vector<uint8_t> &data, bool dump_head);
 template void Camera<MerlinInterface, FRAME_BASED>::read_frame(std::vector<uint16_t> &data, bool dump_head);
+template const uint8_t *Camera<MerlinInterface, FRAME_BASED>::next_frame(std::vector<uint8_t> &data, bool dump_head);
+template const uint16_t *Camera<MerlinInterface, FRAME_BASED>::next_frame(std::vector<uint16_t> &data, bool dump_head);
 
 // Run method wrapper
 template <>
@@ -67,10 +77,19 @@ void Camera<MerlinInterface, FRAME_BASED>::run(Ricom *ricom)
     switch (ricom->mode)
     {
     case RICOM::modes::FILE:
-        MerlinInterface::init_interface(ricom->file_path);
+        // Frames of a scan including the skipped ones, where shared memory readers start
+        MerlinInterface::init_interface(ricom->file_path, static_cast<size_t>((ricom->nx + ricom->skip_row) * ricom->ny + ricom->skip_img));
         break;
     case RICOM::modes::TCP:
         MerlinInterface::init_interface(&ricom->socket);
+        if (!ricom->record_path.empty())
+        {
+            MerlinInterface::init_recorder(ricom->record_path);
+        }
+        if (!ricom->shm_publish.empty())
+        {
+            MerlinInterface::init_publisher(ricom->shm_publish);
+        }
         break;
     }
     int bits = MerlinInterface::pre_run(ricom->camera.u, ricom->camera.v);
@@ -11,124 +11,1158 @@
  *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
  */
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+
 #include "TimepixInterface.h"
 
-// Read a frame and compute COM
-void TimepixInterface::read_frame_com(std::atomic<size_t> &idx, std::vector<size_t> &dose_map,
-                                      std::vector<size_t> &sumx_map, std::vector<size_t> &sumy_map,
-                                      std::vector<float> &stem_map, bool b_stem,
-                                      std::array<float, 2> &offset, std::array<float, 2> &radius2,
-                                      size_t first_frame, size_t end_frame)
+// Probe position reciprocal, pixel coordinates for the detector width and vSTEM mask
+void TimepixInterface::init_tables()
+{
+    // 25 * 2^64 / dt by long division, exact for toa < 2^64 / dt
+    dt_mul = 0;
+    toa_exact_max = 0;
+    if (dt > 25)
+    {
+        uint64_t rem = 25;
+        for (int i = 0; i < 64; i++)
+        {
+            rem <<= 1;
+            dt_mul <<= 1;
+            if (rem >= static_cast<uint64_t>(dt))
+            {
+                rem -= dt;
+                dt_mul |= 1;
+            }
+        }
+        dt_mul += (rem != 0);
+        toa_exact_max = UINT64_MAX / dt;
+    }
+
+    n_pixels = static_cast<size_t>(nx) * ny;
+    nx_shift = (nx == 256) ? 8 : (nx == 512) ? 9 : 0;
+    xy_lut.clear();
+    if (nx_shift == 0)
+    {
+        xy_lut.resize(n_pixels);
+        for (size_t i = 0; i < n_pixels; i++)
+        {
+            xy_lut[i] = static_cast<uint32_t>(i % nx) | static_cast<uint32_t>(i / nx) << 16;
+        }
+    }
+    stem_lut.assign(n_pixels, 0);
+    lut_offset = {-1.0f, -1.0f};
+    lut_radius2 = {-1.0f, -1.0f};
+
+    // Clusters are found on the detector grid within the window of ToA units
+    cluster_ticks = (cluster_window > 0) ? (static_cast<uint64_t>(cluster_window) + 24) / 25 : 0;
+    cluster_horizon = 2 * cluster_ticks + (static_cast<uint64_t>(cluster_late) * dt + 24) / 25;
+    clusters.init(nx, ny, cluster_ticks, cluster_horizon);
+}
+
+void EventClusterer::init(int nx, int ny, uint64_t window, uint64_t horizon)
+{
+    this->nx = nx;
+    this->ny = ny;
+    this->window = window;
+    this->horizon = horizon;
+    id_head = 0;
+    id_tail = 0;
+    if (window == 0)
+    {
+        pixels.clear();
+        ring.clear();
+        return;
+    }
+    pixels.assign(static_cast<size_t>(nx) * ny, {0xFFFFFFFF, 0});
+    ring.resize(ring_size);
+    mask = ring_size - 1;
+}
+
+// Fixed point centroid of a cluster and the pixel it falls on
+inline void TimepixInterface::centroid(const EventClusterer::Cluster &c, uint32_t &x, uint32_t &y, uint32_t &index)
+{
+    x = static_cast<uint32_t>(((c.sum_x << centroid_bits) + c.sum_w / 2) / c.sum_w);
+    y = static_cast<uint32_t>(((c.sum_y << centroid_bits) + c.sum_w / 2) / c.sum_w);
+    const uint32_t half = 1u << (centroid_bits - 1);
+    index = ((y + half) >> centroid_bits) * nx + ((x + half) >> centroid_bits);
+}
+
+// The detector can be changed during the reconstruction, the mask follows it
+void TimepixInterface::update_stem_lut(const std::array<float, 2> &offset, const std::array<float, 2> &radius2)
+{
+    if (offset == lut_offset && radius2 == lut_radius2)
+    {
+        return;
+    }
+    for (size_t i = 0; i < n_pixels; i++)
+    {
+        double dx = static_cast<float>(i % nx) - offset[0];
+        double dy = static_cast<float>(i / nx) - offset[1];
+        double d2 = dx * dx + dy * dy;
+        stem_lut[i] = (d2 > radius2[0] && d2 <= radius2[1]);
+    }
+    lut_offset = offset;
+    lut_radius2 = radius2;
+}
+
+template <int NX_SHIFT>
+inline void TimepixInterface::split_index(uint32_t index, uint32_t &x, uint32_t &y)
 {
-    e_event ev;
+    if (NX_SHIFT > 0)
+    {
+        x = index & ((1u << NX_SHIFT) - 1);
+        y = index >> NX_SHIFT;
+    }
+    else
+    {
+        uint32_t xy = xy_lut[index];
+        x = xy & 0xFFFF;
+        y = xy >> 16;
+    }
+}
 
+// Bin events until the first event after probe position idx_end, events of frame_id are added to frame.
+// The maps are a ring over the open probe positions [first_frame, end_frame): position p is binned
+// into (p - p_start) % size, so events arriving late are still counted as long as their position is open.
+template <int NX_SHIFT, typename T>
+void TimepixInterface::read_events(size_t idx_end, std::vector<uint32_t> &dose_map,
+                                   std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
+                                   std::vector<float> &stem_map, bool b_stem, T *frame, size_t frame_id,
+                                   size_t first_frame, size_t end_frame)
+{
+    const size_t n_frames = end_frame - first_frame;
+    const size_t n_slots = dose_map.size();
+    const size_t slot0 = (first_frame - p_start) % n_slots;
+    // Kept in locals, the map stores could alias the members
+    size_t p_max = p_newest;
+    size_t late = 0;
+    size_t dropped = 0;
+    size_t binned = 0;
+    bool b_done = false;
     while (true)
     {
-        read_event(ev);
-        size_t probe_position = floor(ev.toa * 25 / dt);
-        if (probe_position >= first_frame && probe_position < end_frame)
+        if (ev_begin == ev_end && !next_block())
+        {
+            break;
+        }
+        const e_event *ev = ev_begin;
+        const e_event *end = ev_end;
+        while (ev < end)
         {
-            size_t x = ev.index % nx;
-            size_t y = floor(ev.index / nx);
+            size_t probe_position = probe_position_of(ev->toa);
+            uint32_t index = ev->index;
+            ++ev;
+            // One unsigned compare for first_frame <= probe_position < end_frame
             size_t probe_position2 = probe_position - first_frame;
-            dose_map[probe_position2]++;
-            sumx_map[probe_position2] += x;
-            sumy_map[probe_position2] += y;
-            if (b_stem)
+            if (probe_position2 < n_frames && index < n_pixels)
             {
-                float d2 = pow((float)x - offset[0], 2) + pow((float)y - offset[1], 2);
-                if (d2 > radius2[0] && d2 <= radius2[1])
+                uint32_t x, y;
+                split_index<NX_SHIFT>(index, x, y);
+                size_t slot = probe_position2 + slot0;
+                if (slot >= n_slots)
                 {
-                    stem_map[probe_position2]++;
+                    slot -= n_slots;
                 }
+                dose_map[slot]++;
+                sumx_map[slot] += x;
+                sumy_map[slot] += y;
+                if (frame != nullptr && probe_position == frame_id)
+                {
+                    frame[index]++;
+                }
+                if (b_stem)
+                {
+                    stem_map[slot] += stem_lut[index];
+                }
+                if (probe_position < p_max)
+                {
+                    late++;
+                }
+            }
+            else if (index < n_pixels)
+            {
+                dropped++;
+            }
+            p_max = (std::max)(p_max, probe_position);
+            if (probe_position > idx_end)
+            {
+                b_done = true;
+                break;
             }
         }
-        if (probe_position > idx)
+        binned += ev - ev_begin;
+        ev_begin = ev;
+        if (b_done)
         {
             break;
         }
     }
+    p_newest = p_max;
+    n_late.fetch_add(late, std::memory_order_relaxed);
+    n_dropped.fetch_add(dropped, std::memory_order_relaxed);
+    n_binned.fetch_add(binned, std::memory_order_relaxed);
 }
 
-// Read a frame and compute COM and create frame representation
-template <typename T>
-void TimepixInterface::read_frame_com(std::atomic<size_t> &idx, std::vector<size_t> &dose_map,
-                                      std::vector<size_t> &sumx_map, std::vector<size_t> &sumy_map,
-                                      std::vector<float> &stem_map, bool b_stem,
-                                      std::array<float, 2> &offset, std::array<float, 2> &radius2,
-                                      std::vector<T> &frame, size_t frame_id,
+// Same as read_events, but the events are grouped into clusters and each cluster adds its centroid
+// to the probe position of its first event. Clusters are emitted once the stream has moved the
+// cluster horizon past them, so the positions are integrated cluster_positions() later.
+template <int NX_SHIFT, typename T>
+void TimepixInterface::cluster_events(size_t idx_end, std::vector<uint32_t> &dose_map,
+                                      std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
+                                      std::vector<float> &stem_map, bool b_stem, T *frame, size_t frame_id,
                                       size_t first_frame, size_t end_frame)
 {
-    e_event ev;
-
+    const size_t n_frames = end_frame - first_frame;
+    const size_t n_slots = dose_map.size();
+    const size_t slot0 = (first_frame - p_start) % n_slots;
+    size_t p_max = p_newest;
+    size_t late = 0;
+    size_t dropped = 0;
+    size_t binned = 0;
+    bool b_done = false;
+    auto emit = [&](const EventClusterer::Cluster &c)
+    {
+        size_t probe_position2 = probe_position_of(c.toa) - first_frame;
+        if (probe_position2 >= n_frames)
+        {
+            dropped += c.n;
+            return;
+        }
+        uint32_t x, y, index;
+        centroid(c, x, y, index);
+        size_t slot = probe_position2 + slot0;
+        if (slot >= n_slots)
+        {
+            slot -= n_slots;
+        }
+        dose_map[slot]++;
+        sumx_map[slot] += x;
+        sumy_map[slot] += y;
+        if (b_stem)
+        {
+            stem_map[slot] += stem_lut[index];
+        }
+    };
     while (true)
     {
-        read_event(ev);
-        size_t probe_position = floor(ev.toa * 25 / dt);
-        if (probe_position >= first_frame && probe_position < end_frame) //  && ev.toa * 25 % dt < dt/10
+        if (ev_begin == ev_end && !next_block())
         {
-            size_t x = ev.index % nx;
-            size_t y = floor(ev.index / nx);
-            size_t probe_position2 = probe_position - first_frame;
-            dose_map[probe_position2]++;
-            sumx_map[probe_position2] += x;
-            sumy_map[probe_position2] += y;
-            if (probe_position == frame_id)
-                frame[x + y * nx]++;
+            // End of the stream, the open clusters are complete
+            clusters.flush(emit);
+            break;
+        }
+        const e_event *ev = ev_begin;
+        const e_event *end = ev_end;
+        while (ev < end)
+        {
+            size_t probe_position = probe_position_of(ev->toa);
+            uint32_t index = ev->index;
+            if (probe_position - first_frame < n_frames && index < n_pixels)
+            {
+                uint32_t x, y;
+                split_index<NX_SHIFT>(index, x, y);
+                clusters.add(index, x, y, ev->toa, ev->tot, 0, true, emit);
+                if (frame != nullptr && probe_position == frame_id)
+                {
+                    frame[index]++;
+                }
+                if (probe_position < p_max)
+                {
+                    late++;
+                }
+            }
+            else if (index < n_pixels)
+            {
+                dropped++;
+            }
+            ++ev;
+            p_max = (std::max)(p_max, probe_position);
+            if (probe_position > idx_end)
+            {
+                b_done = true;
+                break;
+            }
+        }
+        binned += ev - ev_begin;
+        ev_begin = ev;
+        if (b_done)
+        {
+            break;
+        }
+    }
+    p_newest = p_max;
+    n_late.fetch_add(late, std::memory_order_relaxed);
+    n_dropped.fetch_add(dropped, std::memory_order_relaxed);
+    n_binned.fetch_add(binned, std::memory_order_relaxed);
+}
+
+// Read the cached positions up to idx_end. The events of a position are summed up locally and
+// added to its slot at once, events are in order, so none arrive late.
+template <int NX_SHIFT, typename P, typename T>
+void TimepixInterface::read_cache(size_t idx_end, std::vector<uint32_t> &dose_map,
+                                  std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
+                                  std::vector<float> &stem_map, bool b_stem, T *frame, size_t frame_id,
+                                  size_t first_frame, size_t end_frame)
+{
+    const size_t n_frames = end_frame - first_frame;
+    const size_t n_slots = dose_map.size();
+    const size_t slot0 = (first_frame - p_start) % n_slots;
+    const size_t row_nx = cache.header.nx;
+    size_t dropped = 0;
+    size_t binned = 0;
+    while (!b_stream_end)
+    {
+        size_t probe_position = cache_row * row_nx + cache_x;
+        if (probe_position > idx_end)
+        {
+            break;
+        }
+        uint32_t n = EVENT_CACHE::read_count(cache_counts);
+        const P *pixels = reinterpret_cast<const P *>(cache_data.pixels) + cache_event;
+        size_t probe_position2 = probe_position - first_frame;
+        if (probe_position2 < n_frames)
+        {
+            uint32_t dose = 0;
+            uint32_t sumx = 0;
+            uint32_t sumy = 0;
+            uint32_t stem = 0;
+            for (uint32_t i = 0; i < n; i++)
+            {
+                uint32_t index = pixels[i];
+                if (index < n_pixels)
+                {
+                    uint32_t x, y;
+                    split_index<NX_SHIFT>(index, x, y);
+                    dose++;
+                    sumx += x;
+                    sumy += y;
+                    if (b_stem)
+                    {
+                        stem += stem_lut[index];
+                    }
+                }
+            }
+            size_t slot = probe_position2 + slot0;
+            if (slot >= n_slots)
+            {
+                slot -= n_slots;
+            }
+            dose_map[slot] += dose;
+            sumx_map[slot] += sumx;
+            sumy_map[slot] += sumy;
             if (b_stem)
             {
-                float d2 = pow((float)x - offset[0], 2) + pow((float)y - offset[1], 2);
-                if (d2 > radius2[0] && d2 <= radius2[1])
+                stem_map[slot] += stem;
+            }
+            if (frame != nullptr && probe_position == frame_id)
+            {
+                for (uint32_t i = 0; i < n; i++)
                 {
-                    stem_map[probe_position2]++;
+                    if (pixels[i] < n_pixels)
+                    {
+                        frame[pixels[i]]++;
+                    }
                 }
             }
         }
-        if (probe_position > idx)
+        else
+        {
+            dropped += n;
+        }
+        cache_event += n;
+        binned += n;
+        if (++cache_x == row_nx && !seek_cache(cache_row + 1, 0))
+        {
+            b_stream_end = true;
+        }
+    }
+    n_dropped.fetch_add(dropped, std::memory_order_relaxed);
+    // The cache is read from the mapping while binning, both stages count the same events
+    n_read.fetch_add(binned, std::memory_order_relaxed);
+    n_binned.fetch_add(binned, std::memory_order_relaxed);
+}
+
+// Position (row, x) of the cache, false after the last row
+bool TimepixInterface::seek_cache(size_t row, size_t x)
+{
+    if (!cache.row(row, cache_data))
+    {
+        return false;
+    }
+    cache_row = row;
+    cache_x = 0;
+    cache_event = 0;
+    cache_counts = cache_data.counts;
+    for (; cache_x < x; cache_x++)
+    {
+        cache_event += EVENT_CACHE::read_count(cache_counts);
+    }
+    // The following row is read from disk while this one is processed
+    cache.prefetch_row(row + 1);
+    return true;
+}
+
+// Dispatch on the source and the detector width
+template <typename T>
+void TimepixInterface::read_any(size_t idx_end, std::vector<uint32_t> &dose_map,
+                                std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
+                                std::vector<float> &stem_map, bool b_stem, T *frame, size_t frame_id,
+                                size_t first_frame, size_t end_frame)
+{
+    if (mode == MODE_CACHE)
+    {
+        bool b_short = cache.header.pixel_bytes == 2;
+        switch (nx_shift)
+        {
+        case 8:
+            if (b_short)
+                read_cache<8, uint16_t>(idx_end, dose_map, sumx_map, sumy_map, stem_map, b_stem, frame, frame_id, first_frame, end_frame);
+            else
+                read_cache<8, uint32_t>(idx_end, dose_map, sumx_map, sumy_map, stem_map, b_stem, frame, frame_id, first_frame, end_frame);
+            break;
+        case 9:
+            if (b_short)
+                read_cache<9, uint16_t>(idx_end, dose_map, sumx_map, sumy_map, stem_map, b_stem, frame, frame_id, first_frame, end_frame);
+            else
+                read_cache<9, uint32_t>(idx_end, dose_map, sumx_map, sumy_map, stem_map, b_stem, frame, frame_id, first_frame, end_frame);
+            break;
+        default:
+            if (b_short)
+                read_cache<0, uint16_t>(idx_end, dose_map, sumx_map, sumy_map, stem_map, b_stem, frame, frame_id, first_frame, end_frame);
+            else
+                read_cache<0, uint32_t>(idx_end, dose_map, sumx_map, sumy_map, stem_map, b_stem, frame, frame_id, first_frame, end_frame);
+            break;
+        }
+        return;
+    }
+    if (cluster_ticks > 0)
+    {
+        switch (nx_shift)
         {
+        case 8:
+            cluster_events<8>(idx_end, dose_map, sumx_map, sumy_map, stem_map, b_stem, frame, frame_id, first_frame, end_frame);
+            break;
+        case 9:
+            cluster_events<9>(idx_end, dose_map, sumx_map, sumy_map, stem_map, b_stem, frame, frame_id, first_frame, end_frame);
+            break;
+        default:
+            cluster_events<0>(idx_end, dose_map, sumx_map, sumy_map, stem_map, b_stem, frame, frame_id, first_frame, end_frame);
             break;
         }
+        return;
+    }
+    switch (nx_shift)
+    {
+    case 8:
+        read_events<8>(idx_end, dose_map, sumx_map, sumy_map, stem_map, b_stem, frame, frame_id, first_frame, end_frame);
+        break;
+    case 9:
+        read_events<9>(idx_end, dose_map, sumx_map, sumy_map, stem_map, b_stem, frame, frame_id, first_frame, end_frame);
+        break;
+    default:
+        read_events<0>(idx_end, dose_map, sumx_map, sumy_map, stem_map, b_stem, frame, frame_id, first_frame, end_frame);
+        break;
+    }
+}
+
+// Read a frame and compute COM
+void TimepixInterface::read_frame_com(std::atomic<size_t> &idx, std::vector<uint32_t> &dose_map,
+                                      std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
+                                      std::vector<float> &stem_map, bool b_stem,
+                                      std::array<float, 2> &offset, std::array<float, 2> &radius2,
+                                      size_t first_frame, size_t end_frame)
+{
+    if (b_stem)
+    {
+        update_stem_lut(offset, radius2);
     }
+    uint16_t *no_frame = nullptr;
+    read_any(idx, dose_map, sumx_map, sumy_map, stem_map, b_stem, no_frame, 0, first_frame, end_frame);
 }
-template void TimepixInterface::read_frame_com<uint8_t>(std::atomic<size_t> &idx, std::vector<size_t> &dose_map,
-                                                        std::vector<size_t> &sumx_map, std::vector<size_t> &sumy_map,
+
+// Read a frame and compute COM and create frame representation
+template <typename T>
+void TimepixInterface::read_frame_com(std::atomic<size_t> &idx, std::vector<uint32_t> &dose_map,
+                                      std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
+                                      std::vector<float> &stem_map, bool b_stem,
+                                      std::array<float, 2> &offset, std::array<float, 2> &radius2,
+                                      std::vector<T> &frame, size_t frame_id,
+                                      size_t first_frame, size_t end_frame)
+{
+    if (b_stem)
+    {
+        update_stem_lut(offset, radius2);
+    }
+    read_any(idx, dose_map, sumx_map, sumy_map, stem_map, b_stem, &frame[0], frame_id, first_frame, end_frame);
+}
+template void TimepixInterface::read_frame_com<uint8_t>(std::atomic<size_t> &idx, std::vector<uint32_t> &dose_map,
+                                                        std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
                                                         std::vector<float> &stem_map, bool b_stem,
                                                         std::array<float, 2> &offset, std::array<float, 2> &radius,
                                                         std::vector<uint8_t> &frame, size_t frame_id,
                                                         size_t first_frame, size_t end_frame);
-template void TimepixInterface::read_frame_com<uint16_t>(std::atomic<size_t> &idx, std::vector<size_t> &dose_map,
-                                                         std::vector<size_t> &sumx_map, std::vector<size_t> &sumy_map,
+template void TimepixInterface::read_frame_com<uint16_t>(std::atomic<size_t> &idx, std::vector<uint32_t> &dose_map,
+                                                         std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
                                                          std::vector<float> &stem_map, bool b_stem,
                                                          std::array<float, 2> &offset, std::array<float, 2> &radius,
                                                          std::vector<uint16_t> &frame, size_t frame_id,
                                                          size_t first_frame, size_t end_frame);
-template void TimepixInterface::read_frame_com<uint32_t>(std::atomic<size_t> &idx, std::vector<size_t> &dose_map,
-                                                         std::vector<size_t> &sumx_map, std::vector<size_t> &sumy_map,
+template void TimepixInterface::read_frame_com<uint32_t>(std::atomic<size_t> &idx, std::vector<uint32_t> &dose_map,
+                                                         std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
                                                          std::vector<float> &stem_map, bool b_stem,
                                                          std::array<float, 2> &offset, std::array<float, 2> &radius,
                                                          std::vector<uint32_t> &frame, size_t frame_id,
                                                          size_t first_frame, size_t end_frame);
 
-void TimepixInterface::read_event(e_event &ev)
+void EventBins::reset(size_t p_begin, size_t n)
+{
+    this->p_begin = p_begin;
+    dose.assign(n, 0);
+    sumx.assign(n, 0);
+    sumy.assign(n, 0);
+    stem.assign(n, 0);
+    outside.clear();
+    outside_hits.clear();
+}
+
+// First event at or after the probe position, the events are ordered by ToA up to a small jitter
+size_t TimepixInterface::find_event(size_t probe_position)
 {
-    switch (mode)
+    size_t lo = 0;
+    size_t hi = events.size();
+    if (!events.index.empty())
+    {
+        // The first ToA of the probe position is ceil(probe_position * dt / 25)
+        uint64_t toa = (static_cast<uint64_t>(probe_position) * dt + 24) / 25;
+        events.index.range(toa, lo, hi);
+    }
+    while (lo < hi)
     {
-    case MODE_FILE:
-        file.read_data((char *)&ev, sizeof(ev));
+        size_t mid = lo + (hi - lo) / 2;
+        if (this->probe_position(mid) < probe_position)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Bin the events [e_begin, e_end) of the current image into bins. The window spans the probe
+// positions of the first and last event plus a margin for the ToA jitter.
+template <int NX_SHIFT>
+void TimepixInterface::bin_range(size_t e_begin, size_t e_end, size_t first_frame, size_t end_frame, bool b_stem, EventBins &bins)
+{
+    const size_t margin = 64;
+    size_t p_lo = (std::max)(probe_position(e_begin), first_frame + margin) - margin;
+    size_t p_hi = (std::min)(probe_position(e_end - 1) + margin, end_frame);
+    size_t n_window = (p_hi > p_lo) ? p_hi - p_lo : 0;
+    bins.reset(p_lo, n_window);
+
+    const size_t n_frames = end_frame - first_frame;
+    const e_event *ev = events.data();
+    for (size_t i = e_begin; i < e_end; i++)
+    {
+        size_t probe_position = probe_position_of(ev[i].toa);
+        uint32_t index = ev[i].index;
+        if (probe_position - first_frame >= n_frames || index >= n_pixels)
+        {
+            continue;
+        }
+        size_t probe_position2 = probe_position - p_lo;
+        if (probe_position2 >= n_window)
+        {
+            bins.outside.push_back(i);
+            continue;
+        }
+        uint32_t x, y;
+        split_index<NX_SHIFT>(index, x, y);
+        bins.dose[probe_position2]++;
+        bins.sumx[probe_position2] += x;
+        bins.sumy[probe_position2] += y;
+        if (b_stem)
+        {
+            bins.stem[probe_position2] += stem_lut[index];
+        }
+    }
+}
+
+// Bin the clusters of the events [e_begin, e_end) like bin_range(). A cluster is binned by the shard
+// holding its first event: the events just before the shard are clustered to recognise the clusters
+// continuing into it, the events just after it only complete the clusters of the shard.
+template <int NX_SHIFT>
+void TimepixInterface::cluster_range(size_t e_begin, size_t e_end, size_t first_frame, size_t end_frame, bool b_stem, EventBins &bins)
+{
+    const size_t margin = 64;
+    size_t p_lo = (std::max)(probe_position(e_begin), first_frame + margin) - margin;
+    size_t p_hi = (std::min)(probe_position(e_end - 1) + margin, end_frame);
+    size_t n_window = (p_hi > p_lo) ? p_hi - p_lo : 0;
+    bins.reset(p_lo, n_window);
+
+    const size_t n_frames = end_frame - first_frame;
+    const e_event *ev = events.data();
+    const size_t max_overlap = 1 << 16;
+    const uint64_t span = cluster_horizon;
+    size_t e_lo = e_begin;
+    while (e_lo > 0 && e_begin - e_lo < max_overlap && ev[e_lo - 1].toa + span >= ev[e_begin].toa)
+    {
+        e_lo--;
+    }
+    size_t e_hi = e_end;
+    while (e_hi < events.size() && e_hi - e_end < max_overlap && ev[e_hi].toa <= ev[e_end - 1].toa + span)
+    {
+        e_hi++;
+    }
+
+    auto emit = [&](const EventClusterer::Cluster &c)
+    {
+        size_t probe_position = probe_position_of(c.toa);
+        if (c.e_first < e_begin || c.e_first >= e_end || probe_position - first_frame >= n_frames)
+        {
+            return;
+        }
+        uint32_t x, y, index;
+        centroid(c, x, y, index);
+        uint32_t stem = b_stem ? stem_lut[index] : 0;
+        size_t probe_position2 = probe_position - p_lo;
+        if (probe_position2 >= n_window)
+        {
+            bins.outside_hits.push_back({probe_position, x, y, stem});
+            return;
+        }
+        bins.dose[probe_position2]++;
+        bins.sumx[probe_position2] += x;
+        bins.sumy[probe_position2] += y;
+        bins.stem[probe_position2] += stem;
+    };
+    bins.clusters.init(nx, ny, cluster_ticks, cluster_horizon);
+    for (size_t i = e_lo; i < e_hi; i++)
+    {
+        size_t probe_position = probe_position_of(ev[i].toa);
+        uint32_t index = ev[i].index;
+        if (probe_position - first_frame >= n_frames || index >= n_pixels)
+        {
+            continue;
+        }
+        uint32_t x, y;
+        split_index<NX_SHIFT>(index, x, y);
+        bins.clusters.add(index, x, y, ev[i].toa, ev[i].tot, i, i < e_end, emit);
+    }
+    bins.clusters.flush(emit);
+}
+
+// Called from several threads at once, the detector geometry must be set with prepare_bins() first
+void TimepixInterface::bin_events(size_t e_begin, size_t e_end, size_t first_frame, size_t end_frame,
+                                  bool b_stem, EventBins &bins)
+{
+    if (cluster_ticks > 0)
+    {
+        switch (nx_shift)
+        {
+        case 8:
+            cluster_range<8>(e_begin, e_end, first_frame, end_frame, b_stem, bins);
+            break;
+        case 9:
+            cluster_range<9>(e_begin, e_end, first_frame, end_frame, b_stem, bins);
+            break;
+        default:
+            cluster_range<0>(e_begin, e_end, first_frame, end_frame, b_stem, bins);
+            break;
+        }
+        return;
+    }
+    switch (nx_shift)
+    {
+    case 8:
+        bin_range<8>(e_begin, e_end, first_frame, end_frame, b_stem, bins);
         break;
-    case MODE_TCP: // not implemented yet
+    case 9:
+        bin_range<9>(e_begin, e_end, first_frame, end_frame, b_stem, bins);
         break;
+    default:
+        bin_range<0>(e_begin, e_end, first_frame, end_frame, b_stem, bins);
+        break;
+    }
+}
+
+void TimepixInterface::prepare_bins(bool b_stem, std::array<float, 2> &offset, std::array<float, 2> &radius2)
+{
+    if (b_stem)
+    {
+        update_stem_lut(offset, radius2);
+    }
+}
+
+// Add single events and clusters (outside the bin windows) to the maps of the current image
+void TimepixInterface::add_events(const EventBins &bins, size_t first_frame, size_t end_frame,
+                                  std::vector<uint32_t> &dose_map, std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
+                                  std::vector<float> &stem_map, bool b_stem)
+{
+    for (const EventBins::Hit &hit : bins.outside_hits)
+    {
+        if (hit.probe_position < first_frame || hit.probe_position >= end_frame)
+        {
+            continue;
+        }
+        size_t probe_position2 = hit.probe_position - first_frame;
+        dose_map[probe_position2]++;
+        sumx_map[probe_position2] += hit.x;
+        sumy_map[probe_position2] += hit.y;
+        if (b_stem)
+        {
+            stem_map[probe_position2] += hit.stem;
+        }
+    }
+    const e_event *ev = events.data();
+    for (size_t i : bins.outside)
+    {
+        size_t probe_position = probe_position_of(ev[i].toa);
+        uint32_t index = ev[i].index;
+        if (probe_position < first_frame || probe_position >= end_frame || index >= n_pixels)
+        {
+            continue;
+        }
+        size_t probe_position2 = probe_position - first_frame;
+        dose_map[probe_position2]++;
+        sumx_map[probe_position2] += index % nx;
+        sumy_map[probe_position2] += index / nx;
+        if (b_stem)
+        {
+            stem_map[probe_position2] += stem_lut[index];
+        }
     }
 }
 
-void TimepixInterface::init_interface(const std::string &t3p_path)
+// Accumulate the events of the probe positions [p_begin, p_end) into a CBED frame
+void TimepixInterface::add_frame(size_t e_begin, size_t e_end, size_t p_begin, size_t p_end, std::vector<uint16_t> &frame)
+{
+    const e_event *ev = events.data();
+    for (size_t i = e_begin; i < e_end; i++)
+    {
+        size_t probe_position = probe_position_of(ev[i].toa);
+        if (probe_position >= p_end)
+        {
+            break;
+        }
+        if (probe_position >= p_begin && ev[i].index < frame.size())
+        {
+            frame[ev[i].index]++;
+        }
+    }
+}
+
+// Loads the index kept next to the file, or builds and saves it
+bool EventIndex::open(const std::string &path, const e_event *events, size_t n_events)
+{
+    std::error_code ec;
+    Header header;
+    memcpy(header.magic, "RICOMT3I", sizeof(header.magic));
+    header.file_size = std::filesystem::file_size(path, ec);
+    header.mtime = static_cast<int64_t>(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+    std::string idx_path = path + ".idx";
+    if (load(idx_path, header))
+    {
+        return true;
+    }
+    std::cout << "Indexing " << path << "..." << std::endl;
+    build(events, n_events);
+    save(idx_path, header);
+    return !first_event.empty();
+}
+
+// The index is only used for the file it was built from, and if it is complete
+bool EventIndex::load(const std::string &idx_path, const Header &expected)
+{
+    std::ifstream f(idx_path, std::ios::in | std::ios::binary);
+    Header header;
+    if (!f.is_open() || !f.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+        header.file_size != expected.file_size || header.mtime != expected.mtime ||
+        header.bucket_ticks == 0 || header.n_entries == 0)
+    {
+        return false;
+    }
+    std::error_code ec;
+    uintmax_t idx_size = std::filesystem::file_size(idx_path, ec);
+    if (ec || header.n_entries > (idx_size - sizeof(header)) / sizeof(uint64_t) ||
+        idx_size != sizeof(header) + header.n_entries * sizeof(uint64_t))
+    {
+        std::cout << "EventIndex: " << idx_path << " is incomplete, rebuilding it" << std::endl;
+        return false;
+    }
+    first_event.resize(header.n_entries);
+    if (!f.read(reinterpret_cast<char *>(&first_event[0]), header.n_entries * sizeof(uint64_t)))
+    {
+        first_event.clear();
+        return false;
+    }
+    toa_first = header.toa_first;
+    bucket_ticks = header.bucket_ticks;
+    return true;
+}
+
+// One pass over the events: each bucket points to the first event reaching its ToA
+void EventIndex::build(const e_event *events, size_t n_events)
+{
+    first_event.clear();
+    if (n_events == 0)
+    {
+        return;
+    }
+    toa_first = events[0].toa;
+    uint64_t toa_last = (std::max)(events[n_events - 1].toa, toa_first);
+    uint64_t n_buckets = (std::max)(n_events / bucket_events, static_cast<size_t>(1));
+    bucket_ticks = (std::max)((toa_last - toa_first) / n_buckets, static_cast<uint64_t>(1));
+    uint64_t b_max = (toa_last - toa_first) / bucket_ticks;
+    first_event.reserve(b_max + 2);
+    for (size_t i = 0; i < n_events; i++)
+    {
+        uint64_t toa = events[i].toa;
+        if (toa < toa_first)
+        {
+            continue;
+        }
+        // Corrupted ToA values beyond the last event are left out
+        uint64_t b = (toa - toa_first) / bucket_ticks;
+        if (b > b_max)
+        {
+            continue;
+        }
+        while (first_event.size() <= b)
+        {
+            first_event.push_back(i);
+        }
+    }
+    first_event.push_back(n_events);
+}
+
+void EventIndex::save(const std::string &idx_path, Header &header)
+{
+    header.toa_first = toa_first;
+    header.bucket_ticks = bucket_ticks;
+    header.n_entries = first_event.size();
+    std::ofstream f(idx_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (f.is_open())
+    {
+        f.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        f.write(reinterpret_cast<const char *>(&first_event[0]), first_event.size() * sizeof(uint64_t));
+    }
+    if (!f.is_open() || !f)
+    {
+        // Read-only location, the index is only kept for this session
+        std::cout << "EventIndex: Could not write " << idx_path << std::endl;
+    }
+}
+
+void EventIndex::range(uint64_t toa, size_t &lo, size_t &hi)
+{
+    uint64_t b = (toa < toa_first) ? 0 : (toa - toa_first) / bucket_ticks;
+    if (b + 1 >= first_event.size())
+    {
+        lo = first_event.back();
+        hi = first_event.back();
+        return;
+    }
+    lo = first_event[b];
+    hi = first_event[b + 1];
+}
+
+// Regular files are mapped, stdin and pipes are read in chunks
+bool EventSource::open(const std::string &path)
+{
+    close();
+    b_mapped = !FileConnector::is_stream(path);
+    if (b_mapped)
+    {
+        if (!map.open(path))
+        {
+            perror("EventSource::open(): Error mapping file");
+            return false;
+        }
+        n_events = map.size() / sizeof(e_event);
+        pos = 0;
+        index.open(path, data(), n_events);
+        map.prefetch(0, block_events * sizeof(e_event));
+        return true;
+    }
+    stream.path = path;
+    stream.open_file();
+    b_stream = true;
+    return true;
+}
+
+// Fill the buffer from the stream, returns the complete events read, 0 at the end of the stream
+size_t EventSource::read(e_event *events, size_t n)
+{
+    if (!b_stream)
+    {
+        return 0;
+    }
+    return stream.read_data(reinterpret_cast<char *>(events), n * sizeof(e_event)) / sizeof(e_event);
+}
+
+// Next block of events, the file is repeated from the start when all events are read
+size_t EventSource::next_block(const e_event *&events)
+{
+    if (!b_mapped || n_events == 0)
+    {
+        return 0;
+    }
+    if (pos >= n_events)
+    {
+        pos = 0;
+    }
+    size_t n = (std::min)(block_events, n_events - pos);
+    events = reinterpret_cast<const e_event *>(map.data()) + pos;
+    pos += n;
+    // Read the following block while this one is processed
+    map.prefetch(pos * sizeof(e_event), block_events * sizeof(e_event));
+    return n;
+}
+
+// Continue reading at this event (mapped files only)
+void EventSource::seek(size_t event)
+{
+    if (b_mapped && event < n_events)
+    {
+        pos = event;
+        map.prefetch(pos * sizeof(e_event), block_events * sizeof(e_event));
+    }
+}
+
+void EventSource::close()
+{
+    index.close();
+    if (b_mapped)
+    {
+        map.close();
+    }
+    else if (b_stream)
+    {
+        stream.close_file();
+    }
+    b_mapped = false;
+    b_stream = false;
+    n_events = 0;
+    pos = 0;
+}
+
+// Next block from the reader, the previous one is released. The reader is started with the
+// first block, the sharded binning of mapped files does not need it.
+bool TimepixInterface::next_block()
+{
+    if (!reader.joinable() && !b_stream_end)
+    {
+        start_reader();
+    }
+    if (block_buffer >= 0)
+    {
+        free_buffers.push(block_buffer);
+        block_buffer = -1;
+    }
+    EventBlock block;
+    if (b_stream_end || !blocks.pop(block) || block.n == 0)
+    {
+        if (!b_stream_end && mode == MODE_TCP)
+        {
+            std::cout << "TimepixInterface: End of event stream" << std::endl;
+        }
+        b_stream_end = true;
+        ev_end = ev_begin;
+        return false;
+    }
+    ev_begin = block.events;
+    ev_end = block.events + block.n;
+    block_buffer = block.buffer;
+    return true;
+}
+
+// Reader stage, runs until the end of the stream or stop_reader()
+void TimepixInterface::read_ahead()
+{
+    const size_t page_size = 4096;
+    char touched = 0;
+    while (true)
+    {
+        EventBlock block = {nullptr, 0, -1};
+        if (mode == MODE_FILE && events.is_mapped())
+        {
+            block.n = events.next_block(block.events);
+            // Page faults of the mapping are taken here instead of in the binner
+            const volatile char *p = reinterpret_cast<const volatile char *>(block.events);
+            for (size_t o = 0; o < block.n * sizeof(e_event); o += page_size)
+            {
+                touched ^= p[o];
+            }
+        }
+        else
+        {
+            if (!free_buffers.pop(block.buffer))
+            {
+                break;
+            }
+            std::vector<e_event> &buffer = pool[block.buffer];
+            if (mode == MODE_TCP)
+            {
+                // Everything that has arrived so far, at least one event
+                size_t n_bytes = 0;
+                const char *p = socket->peek_some(sizeof(e_event), buffer.size() * sizeof(e_event), n_bytes);
+                if (p != nullptr)
+                {
+                    block.n = n_bytes / sizeof(e_event);
+                    memcpy(&buffer[0], p, block.n * sizeof(e_event));
+                    socket->consume(block.n * sizeof(e_event));
+                }
+            }
+            else
+            {
+                block.n = events.read(&buffer[0], buffer.size());
+            }
+            block.events = &buffer[0];
+        }
+        n_read.fetch_add(block.n, std::memory_order_relaxed);
+        if (!blocks.push(block) || block.n == 0)
+        {
+            break;
+        }
+    }
+    (void)touched;
+}
+
+void TimepixInterface::start_reader()
+{
+    if (mode == MODE_TCP || !events.is_mapped())
+    {
+        pool.assign(pool_blocks, std::vector<e_event>(pool_events));
+    }
+    blocks.init(pool_blocks);
+    free_buffers.init(pool_blocks);
+    for (size_t i = 0; i < pool_blocks; i++)
+    {
+        free_buffers.push(static_cast<int>(i));
+    }
+    block_buffer = -1;
+    reader = std::thread(&TimepixInterface::read_ahead, this);
+}
+
+void TimepixInterface::stop_reader()
+{
+    if (!reader.joinable())
+    {
+        return;
+    }
+    blocks.close();
+    free_buffers.close();
+    if (mode == MODE_TCP)
+    {
+        // Wake up a reader waiting for data
+#ifdef _WIN32
+        shutdown(socket->rc_socket, SD_RECEIVE);
+#else
+        shutdown(socket->rc_socket, SHUT_RD);
+#endif
+    }
+    reader.join();
+    pool.clear();
+}
+
+// Reconstruction starting at probe position p_start, mapped files are read from there
+void TimepixInterface::init_interface(const std::string &t3p_path, size_t p_start)
 {
     mode = MODE_FILE;
-    file.path = t3p_path;
-    file.open_file();
+    ev_begin = nullptr;
+    ev_end = nullptr;
+    b_stream_end = false;
+    this->p_start = p_start;
+    p_newest = p_start;
+    n_late = 0;
+    n_dropped = 0;
+    n_read = 0;
+    n_binned = 0;
+    init_tables();
+    if (std::filesystem::path(t3p_path).extension() == ".t3c")
+    {
+        // Probe positions are taken from the cache, the dwell time it was made for applies
+        mode = MODE_CACHE;
+        if (cluster_ticks > 0)
+        {
+            std::cout << "TimepixInterface: Event caches have no ToA, clustering is off" << std::endl;
+            cluster_ticks = 0;
+            clusters.init(nx, ny, 0, 0);
+        }
+        if (!cache.open(t3p_path))
+        {
+            b_stream_end = true;
+            return;
+        }
+        if (cache.header.dwell_time != static_cast<uint32_t>(dt))
+        {
+            std::cout << "TimepixInterface: " << t3p_path << " was made for a dwell time of "
+                      << cache.header.dwell_time << " ns" << std::endl;
+        }
+        if (cache.header.cam_nx != static_cast<uint32_t>(nx) || cache.header.cam_ny != static_cast<uint32_t>(ny))
+        {
+            std::cout << "TimepixInterface: Detector size of " << t3p_path << " is " << cache.header.cam_nx
+                      << "x" << cache.header.cam_ny << std::endl;
+        }
+        b_stream_end = !seek_cache(p_start / cache.header.nx, p_start % cache.header.nx);
+        return;
+    }
+    events.open(t3p_path);
+    if (p_start > 0)
+    {
+        if (n_events() > 0)
+        {
+            events.seek(find_event(p_start));
+        }
+        else
+        {
+            std::cout << "TimepixInterface: Streams are read from the start up to position " << p_start << std::endl;
+        }
+    }
+};
+
+// The event stream is the raw .t3p event records, without any framing
+void TimepixInterface::init_interface(SocketConnector *socket)
+{
+    mode = MODE_TCP;
+    ev_begin = nullptr;
+    ev_end = nullptr;
+    b_stream_end = false;
+    p_start = 0;
+    p_newest = 0;
+    n_late = 0;
+    n_dropped = 0;
+    n_read = 0;
+    n_binned = 0;
+    this->socket = socket;
+    init_tables();
+    socket->connect_socket();
 };
 
 void TimepixInterface::close_interface()
 {
-    file.close_file();
+    stop_reader();
+    if (mode == MODE_TCP)
+    {
+        socket->close_socket();
+        socket = nullptr;
+    }
+    else if (mode == MODE_CACHE)
+    {
+        cache.close();
+        cache_counts = nullptr;
+    }
+    else
+    {
+        events.close();
+    }
+    ev_begin = nullptr;
+    ev_end = nullptr;
 };
\ No newline at end of file
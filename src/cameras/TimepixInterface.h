@@ -14,41 +14,363 @@
 #ifndef TIMEPIX_INTERFACE_H
 #define TIMEPIX_INTERFACE_H
 
-#ifdef __GNUC__
-#define PACK(__Declaration__) __Declaration__ __attribute__((__packed__))
-#endif
-
-#ifdef _MSC_VER
-#define PACK(__Declaration__) __pragma(pack(push, 1)) __Declaration__ __pragma(pack(pop))
-#endif
-
 #define _USE_MATH_DEFINES
 #include <cmath>
+#include <algorithm>
+#include <cstdint>
 #include <atomic>
+#include <thread>
 #include <vector>
 #include <array>
+#include <string>
 
 #include "FileConnector.h"
+#include "TimepixEvent.h"
+#include "MappedFile.h"
+#include "SocketConnector.h"
+#include "EventCache.h"
+#include "SpscQueue.hpp"
+
+// Sidecar index of a .t3p file (<file>.idx): the first event at or after each ToA bucket.
+// Events of any probe position, for any dwell time, are found from it without reading the
+// file up to there. Built with one pass over the file and cached next to it.
+class EventIndex
+{
+public:
+    bool open(const std::string &path, const e_event *events, size_t n_events);
+    void range(uint64_t toa, size_t &lo, size_t &hi); // First event with this ToA lies in [lo, hi]
+    bool empty() { return first_event.empty(); };
+    void close() { first_event.clear(); };
+    EventIndex() : toa_first(0), bucket_ticks(1), first_event(){};
+
+private:
+    static const size_t bucket_events = 4096; // Average events per bucket
+    struct Header
+    {
+        char magic[8];
+        uint64_t file_size;
+        int64_t mtime;
+        uint64_t toa_first;
+        uint64_t bucket_ticks;
+        uint64_t n_entries;
+    };
+
+    uint64_t toa_first;                 // ToA of bucket 0
+    uint64_t bucket_ticks;              // ToA span of a bucket
+    std::vector<uint64_t> first_event; // Per bucket, one past the last entry is the number of events
+
+    bool load(const std::string &idx_path, const Header &expected);
+    void build(const e_event *events, size_t n_events);
+    void save(const std::string &idx_path, Header &header);
+};
+
+// Hands out the events of a .t3p file in large blocks. Regular files are mapped and
+// the blocks point into the mapping, streams are read into the caller's buffers.
+class EventSource
+{
+public:
+    bool open(const std::string &path);
+    size_t next_block(const e_event *&events); // Mapped files only
+    size_t read(e_event *events, size_t n);    // Streams only
+    const e_event *data() { return reinterpret_cast<const e_event *>(map.data()); };
+    size_t size() { return b_mapped ? n_events : 0; }; // Events in the mapped file, 0 for streams
+    bool is_mapped() { return b_mapped; };
+    void seek(size_t event);
+    void close();
+    EventIndex index; // Only for mapped files
+    EventSource() : index(), map(), stream(), b_mapped(false), b_stream(false), n_events(0), pos(0){};
+
+private:
+    static const size_t block_events = 1 << 20; // 16 MB per block from the mapping
+
+    MappedFile map;
+    FileConnector stream;
+    bool b_mapped;
+    bool b_stream; // Stream opened
+    size_t n_events;
+    size_t pos; // Next event in the mapping
+};
+
+// Groups the pixels fired by one electron: events on neighbouring pixels within the cluster
+// window of ToA. The pixel grid holds the newest cluster of each pixel with its ToA, so it
+// serves as a spatial hash whose entries expire as the ToA moves on. Open clusters are kept
+// in a ring in the order they were started, and are closed once the stream is a horizon past
+// their first event, which leaves room for the arrival disorder of the events.
+class EventClusterer
+{
+public:
+    struct Cluster
+    {
+        uint64_t toa;    // Earliest ToA
+        uint64_t sum_x;  // ToT weighted coordinates
+        uint64_t sum_y;
+        uint64_t sum_w;
+        uint32_t n;      // Events
+        uint32_t parent; // Cluster it was merged into, its own id otherwise
+        size_t e_first;  // First event in the stream, decides the shard emitting it
+    };
 
-PACK(struct e_event
-     {
-         uint32_t index;
-         uint64_t toa;
-         uint8_t overflow;
-         uint8_t ftoa;
-         uint16_t tot;
-     });
+    // Also forgets all clusters, window 0: off. Clusters close once the stream is horizon past their first event.
+    void init(int nx, int ny, uint64_t window, uint64_t horizon);
+    bool enabled() { return window > 0; };
+    // Add an event, closed clusters are passed to emit. Without b_open the event only joins open clusters.
+    template <typename Emit>
+    inline void add(uint32_t index, uint32_t x, uint32_t y, uint64_t toa, uint16_t tot, size_t e, bool b_open, Emit &&emit);
+    // Close all open clusters
+    template <typename Emit>
+    void flush(Emit &&emit);
+    EventClusterer() : pixels(), ring(), mask(0), id_head(0), id_tail(0), window(0), horizon(0), nx(0), ny(0){};
+
+private:
+    static const uint32_t ring_size = 4096; // Open clusters at most
+    struct Pixel
+    {
+        uint32_t cluster;
+        uint32_t toa; // Low 32 bit
+    };
+    std::vector<Pixel> pixels;
+    std::vector<Cluster> ring;
+    uint32_t mask;
+    uint32_t id_head; // Open clusters are [id_head, id_tail)
+    uint32_t id_tail;
+    uint64_t window;
+    uint64_t horizon; // Arrival disorder of the events is tolerated up to horizon - 2 * window
+    int nx;
+    int ny;
+
+    bool is_open(uint32_t id) { return id - id_head < id_tail - id_head; };
+    template <typename Emit>
+    inline void close_oldest(Emit &&emit);
+};
+
+template <typename Emit>
+inline void EventClusterer::close_oldest(Emit &&emit)
+{
+    Cluster &c = ring[id_head & mask];
+    if (c.parent == id_head && c.n > 0)
+    {
+        emit(c);
+    }
+    id_head++;
+}
+
+template <typename Emit>
+inline void EventClusterer::add(uint32_t index, uint32_t x, uint32_t y, uint64_t toa, uint16_t tot, size_t e, bool b_open, Emit &&emit)
+{
+    while (id_head != id_tail && ring[id_head & mask].toa + horizon < toa)
+    {
+        close_oldest(emit);
+    }
+
+    // Open clusters of the neighbouring pixels within the window, a second one is merged into the older
+    const uint32_t none = 0xFFFFFFFF;
+    const uint32_t toa32 = static_cast<uint32_t>(toa);
+    uint32_t id = none;
+    uint32_t y0 = (y > 0) ? y - 1 : 0;
+    uint32_t y1 = (y + 1 < static_cast<uint32_t>(ny)) ? y + 1 : y;
+    uint32_t x0 = (x > 0) ? x - 1 : 0;
+    uint32_t x1 = (x + 1 < static_cast<uint32_t>(nx)) ? x + 1 : x;
+    for (uint32_t yy = y0; yy <= y1; yy++)
+    {
+        for (uint32_t xx = x0; xx <= x1; xx++)
+        {
+            const Pixel &q = pixels[yy * nx + xx];
+            int64_t dt = static_cast<int32_t>(toa32 - q.toa);
+            if (!is_open(q.cluster) || dt > static_cast<int64_t>(window) || dt < -static_cast<int64_t>(window))
+            {
+                continue;
+            }
+            // Follow merges as long as the cluster merged into is still open
+            uint32_t c = q.cluster;
+            while (ring[c & mask].parent != c && is_open(ring[c & mask].parent))
+            {
+                c = ring[c & mask].parent;
+            }
+            if (ring[c & mask].parent != c || c == id)
+            {
+                continue;
+            }
+            if (id == none)
+            {
+                id = c;
+                continue;
+            }
+            uint32_t older = (c - id_head < id - id_head) ? c : id;
+            uint32_t younger = (older == c) ? id : c;
+            Cluster &a = ring[older & mask];
+            Cluster &b = ring[younger & mask];
+            a.toa = (std::min)(a.toa, b.toa);
+            a.sum_x += b.sum_x;
+            a.sum_y += b.sum_y;
+            a.sum_w += b.sum_w;
+            a.n += b.n;
+            a.e_first = (std::min)(a.e_first, b.e_first);
+            b.n = 0;
+            b.parent = older;
+            id = older;
+        }
+    }
+
+    if (id == none)
+    {
+        if (!b_open)
+        {
+            return;
+        }
+        if (id_tail - id_head == ring_size)
+        {
+            close_oldest(emit);
+        }
+        id = id_tail++;
+        ring[id & mask] = {toa, 0, 0, 0, 0, id, e};
+    }
+    Cluster &c = ring[id & mask];
+    uint64_t w = (tot > 0) ? tot : 1;
+    c.toa = (std::min)(c.toa, toa);
+    c.sum_x += x * w;
+    c.sum_y += y * w;
+    c.sum_w += w;
+    c.n++;
+    c.e_first = (std::min)(c.e_first, e);
+    pixels[index] = {id, toa32};
+}
+
+template <typename Emit>
+void EventClusterer::flush(Emit &&emit)
+{
+    while (id_head != id_tail)
+    {
+        close_oldest(emit);
+    }
+}
+
+// Partial dose, COM and STEM sums of a range of events, keyed by probe position.
+// Events outside the window are only listed and added by the caller.
+struct EventBins
+{
+    // Centroid of a cluster outside the window, in fixed point
+    struct Hit
+    {
+        size_t probe_position;
+        uint32_t x;
+        uint32_t y;
+        uint32_t stem;
+    };
+    size_t p_begin; // Probe position of the first entry
+    std::vector<uint32_t> dose;
+    std::vector<uint32_t> sumx;
+    std::vector<uint32_t> sumy;
+    std::vector<float> stem;
+    std::vector<size_t> outside; // Event indices outside the window
+    std::vector<Hit> outside_hits;
+    EventClusterer clusters;     // Scratch state of the shard
+
+    void reset(size_t p_begin, size_t n);
+};
 
 class TimepixInterface
 {
 private:
-    FileConnector file;
+    EventSource events;
+    const e_event *ev_begin; // Events of the current block not yet processed
+    const e_event *ev_end;
+
+    // Reader stage: a thread takes event blocks from the file or socket ahead of the binning.
+    // Blocks of mapped files point into the mapping, streams are read into a pool of buffers,
+    // which the binner hands back once it is done with them.
+    struct EventBlock
+    {
+        const e_event *events;
+        size_t n;   // 0 at the end of the stream
+        int buffer; // Pool buffer holding the events, -1 for the mapping
+    };
+    static const size_t pool_blocks = 4;        // Blocks read ahead
+    static const size_t pool_events = 1 << 16;  // 1 MB per stream buffer
+    std::vector<std::vector<e_event>> pool;
+    SpscQueue<EventBlock> blocks;   // Reader -> binner
+    SpscQueue<int> free_buffers;    // Binner -> reader
+    std::thread reader;
+    int block_buffer;               // Pool buffer of the current block
+    std::atomic<size_t> n_read;     // Events read
+    std::atomic<size_t> n_binned;   // Events binned
+    SocketConnector *socket;        // Live mode: raw events from the socket
+    bool b_stream_end;
+
+    // Event cache (.t3c): probe positions are stored, events are read row by row in order
+    EventCacheReader cache;
+    EventCacheReader::Row cache_data; // Current row
+    size_t cache_row;
+    size_t cache_x;                // Next position within the row
+    size_t cache_event;            // First event of that position within the row
+    const uint8_t *cache_counts;   // Event count of that position
+
+    // Arrival order of the events
+    size_t p_start;   // First probe position of the reconstruction
+    size_t p_newest;  // Highest probe position read so far
+    std::atomic<size_t> n_late;    // Events behind p_newest, but still within the open window
+    std::atomic<size_t> n_dropped; // Events outside the open window
+
+    // Clustering: one ToT weighted centroid per electron instead of one count per pixel.
+    // Centroids are summed in fixed point with centroid_bits fractional bits.
+    static const int centroid_bits = 4;
+    int cluster_window;       // unit: ns, 0: off
+    int cluster_late;         // Probe positions events can arrive late and still join their cluster
+    uint64_t cluster_ticks;   // In ToA units
+    uint64_t cluster_horizon; // Clusters are complete this many ToA units after their first event
+    EventClusterer clusters;
+
+    // Per-event tables, the inner loops only do table lookups, shifts and adds
+    uint64_t dt_mul;                 // 25 * 2^64 / dt rounded up: probe position = mulhi(toa, dt_mul)
+    uint64_t toa_exact_max;          // The reciprocal is exact below this ToA
+    size_t n_pixels;                 // Events with a larger pixel index are invalid and skipped
+    int nx_shift;                    // log2(nx) for detector widths 256 and 512, else 0
+    std::vector<uint32_t> xy_lut;    // x | y << 16 per pixel for other widths
+    std::vector<uint8_t> stem_lut;   // 1 inside the vSTEM detector
+    std::array<float, 2> lut_offset; // Detector geometry of stem_lut
+    std::array<float, 2> lut_radius2;
+
+    inline bool next_block();
+    void read_ahead();
+    void start_reader();
+    void stop_reader();
+    void init_tables();
+    inline void update_stem_lut(const std::array<float, 2> &offset, const std::array<float, 2> &radius2);
+    inline size_t probe_position_of(uint64_t toa);
+    template <int NX_SHIFT>
+    inline void split_index(uint32_t index, uint32_t &x, uint32_t &y);
+    template <int NX_SHIFT, typename T>
+    void read_events(size_t idx_end, std::vector<uint32_t> &dose_map,
+                     std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
+                     std::vector<float> &stem_map, bool b_stem, T *frame, size_t frame_id,
+                     size_t first_frame, size_t end_frame);
+    template <int NX_SHIFT, typename T>
+    void cluster_events(size_t idx_end, std::vector<uint32_t> &dose_map,
+                        std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
+                        std::vector<float> &stem_map, bool b_stem, T *frame, size_t frame_id,
+                        size_t first_frame, size_t end_frame);
+    inline void centroid(const EventClusterer::Cluster &c, uint32_t &x, uint32_t &y, uint32_t &index);
+    template <int NX_SHIFT, typename P, typename T>
+    void read_cache(size_t idx_end, std::vector<uint32_t> &dose_map,
+                    std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
+                    std::vector<float> &stem_map, bool b_stem, T *frame, size_t frame_id,
+                    size_t first_frame, size_t end_frame);
+    template <typename T>
+    void read_any(size_t idx_end, std::vector<uint32_t> &dose_map,
+                  std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
+                  std::vector<float> &stem_map, bool b_stem, T *frame, size_t frame_id,
+                  size_t first_frame, size_t end_frame);
+    bool seek_cache(size_t row, size_t x);
+    template <int NX_SHIFT>
+    void bin_range(size_t e_begin, size_t e_end, size_t first_frame, size_t end_frame, bool b_stem, EventBins &bins);
+    template <int NX_SHIFT>
+    void cluster_range(size_t e_begin, size_t e_end, size_t first_frame, size_t end_frame, bool b_stem, EventBins &bins);
 
 protected:
     enum Mode
     {
         MODE_FILE,
-        MODE_TCP
+        MODE_TCP,
+        MODE_CACHE
     };
     Mode mode;
     int nx;
@@ -56,25 +378,82 @@ protected:
     int dt; // unit: ns
 
 public:
-    void read_frame_com(std::atomic<size_t> &idx, std::vector<size_t> &dose_map,
-                        std::vector<size_t> &sumx_map, std::vector<size_t> &sumy_map, 
+    void read_frame_com(std::atomic<size_t> &idx, std::vector<uint32_t> &dose_map,
+                        std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map, 
                         std::vector<float> &stem_map, bool b_stem,
                         std::array<float, 2> &offset, std::array<float, 2> &radius,
                         size_t first_frame, size_t end_frame
                         );
 
     template <typename T>                    
-    void read_frame_com(std::atomic<size_t> &idx, std::vector<size_t> &dose_map,
-                        std::vector<size_t> &sumx_map, std::vector<size_t> &sumy_map,
+    void read_frame_com(std::atomic<size_t> &idx, std::vector<uint32_t> &dose_map,
+                        std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
                         std::vector<float> &stem_map, bool b_stem,
                         std::array<float, 2> &offset, std::array<float, 2> &radius,
                         std::vector<T> &frame, size_t frame_id,
                         size_t first_frame, size_t end_frame);
 
-    inline void read_event(e_event &ev);
-    void init_interface(const std::string &t3p_path);
+    // Sharded binning of mapped files
+    size_t n_events() { return events.size(); };
+    size_t probe_position(size_t event) { return probe_position_of(events.data()[event].toa); };
+    size_t find_event(size_t probe_position);
+    void prepare_bins(bool b_stem, std::array<float, 2> &offset, std::array<float, 2> &radius2);
+    void bin_events(size_t e_begin, size_t e_end, size_t first_frame, size_t end_frame,
+                    bool b_stem, EventBins &bins);
+    void add_events(const EventBins &bins, size_t first_frame, size_t end_frame,
+                    std::vector<uint32_t> &dose_map, std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
+                    std::vector<float> &stem_map, bool b_stem);
+    void add_frame(size_t e_begin, size_t e_end, size_t p_begin, size_t p_end, std::vector<uint16_t> &frame);
+
+    // Events up to event_window - 1 positions late are still clustered, as they are still binned without clustering
+    void set_cluster_window(int window_ns, int event_window)
+    {
+        cluster_window = window_ns;
+        cluster_late = (std::max)(event_window - 1, 0);
+    };
+    // Fractional bits of the COM sums, 0 for whole pixels
+    int com_bits() { return (cluster_ticks > 0) ? centroid_bits : 0; };
+    // Probe positions a cluster can stay open after its first event
+    size_t cluster_positions() { return (cluster_ticks > 0) ? (cluster_horizon * 25 + dt - 1) / dt + 1 : 0; };
+    void init_interface(const std::string &t3p_path, size_t p_start);
+    void init_interface(SocketConnector *socket);
     void close_interface();
+    bool end_of_stream() { return b_stream_end; };
+    size_t first_position() { return p_start; };
+    size_t events_late() { return n_late.load(std::memory_order_relaxed); };
+    size_t events_dropped() { return n_dropped.load(std::memory_order_relaxed); };
+    // Throughput counters of the reader and binner stages
+    size_t events_read() { return n_read.load(std::memory_order_relaxed); };
+    size_t events_binned() { return n_binned.load(std::memory_order_relaxed); };
 
-    TimepixInterface() : mode(MODE_FILE), nx(256), ny(256), dt(1000){};
+    TimepixInterface() : events(), ev_begin(nullptr), ev_end(nullptr),
+                         pool(), blocks(pool_blocks), free_buffers(pool_blocks), reader(), block_buffer(-1),
+                         n_read(0), n_binned(0), socket(nullptr), b_stream_end(false),
+                         cache(), cache_data(), cache_row(0), cache_x(0), cache_event(0), cache_counts(nullptr),
+                         p_start(0), p_newest(0), n_late(0), n_dropped(0),
+                         cluster_window(0), cluster_late(0), cluster_ticks(0), cluster_horizon(0), clusters(),
+                         dt_mul(0), toa_exact_max(0), n_pixels(0), nx_shift(0),
+                         xy_lut(), stem_lut(), lut_offset(), lut_radius2(),
+                         mode(MODE_FILE), nx(256), ny(256), dt(1000){};
 };
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// High 64 bits of the 128 bit product
+static inline uint64_t mulhi64(uint64_t a, uint64_t b)
+{
+#ifdef _MSC_VER
+    return __umulh(a, b);
+#else
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(a) * b) >> 64);
+#endif
+}
+
+// floor(toa * 25 / dt) without a 64 bit division
+inline size_t TimepixInterface::probe_position_of(uint64_t toa)
+{
+    return (toa < toa_exact_max) ? static_cast<size_t>(mulhi64(toa, dt_mul)) : static_cast<size_t>(toa * 25 / dt);
+}
 #endif // TIMEPIX_INTERFACE_H
\ No newline at end of file
@@ -52,8 +52,8 @@ Camera<TimepixInterface, FRAME_BASED>::Camera(Camera_BASE &cam) { (void)cam; };
 // read_frame_com method wrapper
 template <>
 void Camera<TimepixInterface, EVENT_BASED>::read_frame_com(std::atomic<size_t> &idx, 
-                        std::vector<size_t> &dose_map, 
-                        std::vector<size_t> &sumx_map, std::vector<size_t> &sumy_map, 
+                        std::vector<uint32_t> &dose_map, 
+                        std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map, 
                         std::vector<float> &stem_map, bool b_stem,
                         std::array<float, 2> &offset, std::array<float, 2> &radius,
                         size_t first_frame, size_t end_frame)
@@ -64,8 +64,8 @@ void Camera<TimepixInterface, EVENT_BASED>::read_frame_com(std::atomic<size_t> &
 // read_frame_com method wrapper
 template <> 
 void Camera<TimepixInterface, EVENT_BASED>::read_frame_com_cbed(std::atomic<size_t> &idx, 
-                        std::vector<size_t> &dose_map,
-                        std::vector<size_t> &sumx_map, std::vector<size_t> &sumy_map,
+                        std::vector<uint32_t> &dose_map,
+                        std::vector<uint32_t> &sumx_map, std::vector<uint32_t> &sumy_map,
                         std::vector<float> &stem_map, bool b_stem,
                         std::array<float, 2> &offset, std::array<float, 2> &radius,
                         std::vector<uint16_t> &frame, size_t frame_id,
@@ -78,16 +78,19 @@ void Camera<TimepixInterface, EVENT_BASED>::read_frame_com_cbed(std::atomic<size
 template <>
 void Camera<TimepixInterface, EVENT_BASED>::run(Ricom *ricom)
 {
+    set_cluster_window(ricom->cluster_window, ricom->event_window);
     switch (ricom->mode)
     {
     case RICOM::FILE:
-        TimepixInterface::init_interface(ricom->file_path);
+        TimepixInterface::init_interface(ricom->file_path, static_cast<size_t>(ricom->first_row) * ricom->nx);
         ricom->process_data<TimepixInterface>(this);
         close_interface();
         break;
     case RICOM::TCP:
-        // TimepixInterface::init_interface(ricom->socket);
-        perror("TCP mode not supported for Timepix yet");
+        TimepixInterface::init_interface(&ricom->socket);
+        ricom->process_data<TimepixInterface>(this);
+        close_interface();
+        break;
     }
 };
 template <>
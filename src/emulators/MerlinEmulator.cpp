@@ -0,0 +1,588 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+// Merlin data port emulator: serves a recorded .mib file over TCP with the same
+// framing as the camera ("MPX,<length>," + frame), at a controlled frame rate.
+// Optionally a stand-in for the control port answers SET/GET/CMD commands;
+// the data stream then starts with the STARTACQUISITION command.
+// Example usage:
+//   ./MERLIN_EMULATOR -filename default1.mib -port 6342 -fps 5000 -jitter 20
+//   ./RICOM -ip 127.0.0.1 -port 6342 -nx 64 -ny 64
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <filesystem>
+#include <cstring>
+#include <sstream>
+#include <cstdlib>
+
+#include "SocketConnector.h"
+#include "MibFile.h"
+
+namespace chc = std::chrono;
+
+struct EmulatorSettings
+{
+    std::string file_path;
+    int port;
+    double fps;      // Target frame rate [Hz]
+    double jitter;   // Standard deviation of the frame timing [us]
+    double ramp;     // Factor to increase fps after each block (<=1: constant rate)
+    double max_lag;  // Lag behind schedule that counts as falling behind [ms]
+    size_t n_frames; // Number of frames to send (0: all frames in the file once)
+    int sndbuf_size; // SO_SNDBUF in bytes (0: system default)
+    int com_port;    // Control port (0: none, streaming starts on connection)
+    EmulatorSettings() : file_path(), port(6342), fps(1000), jitter(0), ramp(1),
+                         max_lag(100), n_frames(0), sndbuf_size(0), com_port(0){};
+};
+
+class MerlinEmulator
+{
+public:
+    explicit MerlinEmulator(EmulatorSettings &settings) : s(settings),
+                                                           listen_socket(INVALID_SOCKET),
+                                                           client_socket(INVALID_SOCKET),
+                                                           control_socket(INVALID_SOCKET),
+                                                           frame_size(0), n_file_frames(0),
+                                                           b_started(false){};
+    int run();
+
+private:
+    EmulatorSettings s;
+    SOCKET listen_socket;
+    SOCKET client_socket;
+    SOCKET control_socket;
+    std::ifstream file;
+    std::vector<char> frame;
+    size_t frame_size;
+    size_t n_file_frames;
+
+    // Control port state
+    std::map<std::string, std::string> params;
+    std::mutex params_mutex;
+    std::atomic<bool> b_started;
+    std::thread control_thread;
+
+    bool open_file();
+    SOCKET listen_on(int port);
+    bool accept_client();
+    void serve_control();
+    std::string handle_command(const std::string &msg);
+    static bool send_all(SOCKET sock, const char *buffer, size_t size);
+    static bool recv_all(SOCKET sock, char *buffer, size_t size);
+    bool send_message(const char *buffer, size_t size);
+    std::string acquisition_header();
+    void close_sockets();
+};
+
+// Determine the frame size from the distance between the first two frame headers
+bool MerlinEmulator::open_file()
+{
+    file.open(s.file_path, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cout << "MerlinEmulator: Error opening file " << s.file_path << "!" << std::endl;
+        return false;
+    }
+    size_t file_size = std::filesystem::file_size(s.file_path);
+    std::vector<char> head(16);
+    file.read(&head[0], head.size());
+    if (!file || memcmp(&head[0], "MQ1,", 4) != 0)
+    {
+        std::cout << "MerlinEmulator: " << s.file_path << " is not a .mib file!" << std::endl;
+        return false;
+    }
+    size_t head_size = std::stoul(std::string(&head[11], 5));
+
+    frame_size = mib_frame_size(file, file_size, head_size);
+    n_file_frames = file_size / frame_size;
+    if (s.n_frames == 0)
+    {
+        s.n_frames = n_file_frames;
+    }
+    frame.resize(15 + frame_size);
+    snprintf(&frame[0], 16, "MPX,%010zu,", frame_size);
+    std::cout << "Serving " << s.file_path << ": " << n_file_frames << " frames of " << frame_size
+              << " bytes (header " << head_size << " bytes)" << std::endl;
+    return true;
+}
+
+// Use the .hdr file recorded next to the .mib file, if there is one
+std::string MerlinEmulator::acquisition_header()
+{
+    std::filesystem::path hdr_path = s.file_path;
+    hdr_path.replace_extension(".hdr");
+    std::ifstream hdr(hdr_path, std::ios::in | std::ios::binary);
+    if (hdr.is_open())
+    {
+        return std::string(std::istreambuf_iterator<char>(hdr), std::istreambuf_iterator<char>());
+    }
+    return "HDR,\tFrames in Acquisition (Number):\t" + std::to_string(s.n_frames) + "\nEnd\t";
+}
+
+SOCKET MerlinEmulator::listen_on(int port)
+{
+#ifdef WIN32
+    const char opt = 1;
+#else
+    int opt = 1;
+#endif
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == INVALID_SOCKET)
+    {
+        perror("MerlinEmulator: Error creating socket");
+        return INVALID_SOCKET;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr *)&address, sizeof(address)) == SOCKET_ERROR ||
+        listen(sock, 1) == SOCKET_ERROR)
+    {
+        perror("MerlinEmulator: Error binding socket");
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
+
+bool MerlinEmulator::accept_client()
+{
+    listen_socket = listen_on(s.port);
+    if (listen_socket == INVALID_SOCKET)
+    {
+        return false;
+    }
+    std::cout << "Waiting for connection on port " << s.port << "..." << std::endl;
+    client_socket = accept(listen_socket, NULL, NULL);
+    if (client_socket == INVALID_SOCKET)
+    {
+        perror("MerlinEmulator: Error accepting connection");
+        return false;
+    }
+    if (s.sndbuf_size > 0)
+    {
+        setsockopt(client_socket, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char *>(&s.sndbuf_size), sizeof(s.sndbuf_size));
+    }
+    std::cout << "Client connected." << std::endl;
+    return true;
+}
+
+// Stand-in for the control port, serving one connection after the other
+void MerlinEmulator::serve_control()
+{
+    std::cout << "Control port listening on " << s.com_port << std::endl;
+    while (true)
+    {
+        SOCKET sock = accept(control_socket, NULL, NULL);
+        if (sock == INVALID_SOCKET)
+        {
+            return;
+        }
+        // "MPX,<length>" followed by ",<TYPE>,<NAME>[,<VALUE>]"
+        char head[14];
+        while (recv_all(sock, head, sizeof(head)) && memcmp(head, "MPX,", 4) == 0)
+        {
+            std::string msg(strtoul(std::string(&head[4], 10).c_str(), NULL, 10), '\0');
+            if (msg.empty() || !recv_all(sock, &msg[0], msg.size()))
+            {
+                break;
+            }
+            std::string rsp = handle_command(msg);
+            char rsp_head[16];
+            snprintf(rsp_head, sizeof(rsp_head), "MPX,%010zu", rsp.size());
+            if (!send_all(sock, rsp_head, 14) || !send_all(sock, rsp.data(), rsp.size()))
+            {
+                break;
+            }
+        }
+#ifdef WIN32
+        closesocket(sock);
+#else
+        close(sock);
+#endif
+    }
+}
+
+// Reply ",<TYPE>,<NAME>[,<VALUE>],<STATUS>" with status 0 (success) or 2 (not recognised)
+std::string MerlinEmulator::handle_command(const std::string &msg)
+{
+    static const std::set<std::string> known_params = {
+        "HVBIAS", "THRESHOLD0", "THRESHOLD1", "THRESHOLD2", "THRESHOLD3", "THRESHOLD4", "THRESHOLD5",
+        "THRESHOLD6", "THRESHOLD7", "CONTINUOUSRW", "COUNTERDEPTH", "ACQUISITIONTIME", "ACQUISITIONPERIOD",
+        "NUMFRAMESTOACQUIRE", "FILEENABLE", "RUNHEADLESS", "FILEFORMAT", "TRIGGERSTART", "TRIGGERSTOP",
+        "COLOURMODE", "CHARGESUMMING", "GAIN", "FILEDIRECTORY", "FILENAME", "IMAGESPERFILE", "SOFTWAREVERSION"};
+    static const std::set<std::string> known_cmds = {
+        "STARTACQUISITION", "STOPACQUISITION", "SOFTTRIGGER", "ABORT", "RESET"};
+
+    std::vector<std::string> fields;
+    std::stringstream ss(msg.substr(1));
+    std::string field;
+    while (std::getline(ss, field, ','))
+    {
+        fields.push_back(field);
+    }
+    if (fields.size() < 2)
+    {
+        return msg + ",2";
+    }
+    const std::string &type = fields[0];
+    const std::string &name = fields[1];
+    std::lock_guard<std::mutex> lock(params_mutex);
+    if (type == "SET" && fields.size() > 2 && known_params.count(name))
+    {
+        params[name] = fields[2];
+        std::cout << "SET " << name << " = " << fields[2] << std::endl;
+        return "," + type + "," + name + ",0";
+    }
+    if (type == "GET" && known_params.count(name))
+    {
+        std::string value = (name == "SOFTWAREVERSION") ? "emulator" : params[name];
+        return "," + type + "," + name + "," + value + ",0";
+    }
+    if (type == "CMD" && known_cmds.count(name))
+    {
+        std::cout << "CMD " << name << std::endl;
+        if (name == "STARTACQUISITION")
+        {
+            b_started = true;
+        }
+        return "," + type + "," + name + ",0";
+    }
+    return "," + type + "," + name + ",2";
+}
+
+bool MerlinEmulator::send_all(SOCKET sock, const char *buffer, size_t size)
+{
+    size_t sent = 0;
+    while (sent < size)
+    {
+        int n = send(sock, buffer + sent, static_cast<int>(size - sent), 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+bool MerlinEmulator::recv_all(SOCKET sock, char *buffer, size_t size)
+{
+    size_t received = 0;
+    while (received < size)
+    {
+        int n = recv(sock, buffer + received, static_cast<int>(size - received), 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        received += n;
+    }
+    return true;
+}
+
+bool MerlinEmulator::send_message(const char *buffer, size_t size)
+{
+    char tcp_head[16];
+    snprintf(tcp_head, sizeof(tcp_head), "MPX,%010zu,", size);
+    return send_all(client_socket, tcp_head, 15) && send_all(client_socket, buffer, size);
+}
+
+void MerlinEmulator::close_sockets()
+{
+#ifdef WIN32
+    closesocket(client_socket);
+    closesocket(listen_socket);
+    if (control_socket != INVALID_SOCKET)
+    {
+        closesocket(control_socket);
+    }
+#else
+    close(client_socket);
+    close(listen_socket);
+    if (control_socket != INVALID_SOCKET)
+    {
+        shutdown(control_socket, SHUT_RDWR);
+        close(control_socket);
+    }
+#endif
+    if (control_thread.joinable())
+    {
+        control_thread.join();
+    }
+#ifdef WIN32
+    WSACleanup();
+#endif
+}
+
+int MerlinEmulator::run()
+{
+#ifdef WIN32
+    WSADATA w;
+    if (WSAStartup(0x0202, &w))
+    {
+        return -1;
+    }
+#endif
+    bool b_frames_set = s.n_frames > 0;
+    if (!open_file())
+    {
+        return -1;
+    }
+    if (s.com_port > 0)
+    {
+        control_socket = listen_on(s.com_port);
+        if (control_socket == INVALID_SOCKET)
+        {
+            return -1;
+        }
+        control_thread = std::thread(&MerlinEmulator::serve_control, this);
+    }
+    if (!accept_client())
+    {
+        close_sockets();
+        return -1;
+    }
+
+    // With a control port, the camera only streams after STARTACQUISITION
+    if (s.com_port > 0)
+    {
+        std::cout << "Waiting for STARTACQUISITION..." << std::endl;
+        while (!b_started)
+        {
+            std::this_thread::sleep_for(chc::milliseconds(1));
+        }
+        std::lock_guard<std::mutex> lock(params_mutex);
+        const std::string &value = params["NUMFRAMESTOACQUIRE"];
+        if (!b_frames_set && !value.empty())
+        {
+            // Set by the client, an invalid value keeps the frame count of the file
+            char *end;
+            unsigned long n = strtoul(value.c_str(), &end, 10);
+            if (end == value.c_str() + value.size() && n > 0 && value[0] != '-')
+            {
+                s.n_frames = n;
+            }
+            else
+            {
+                std::cout << "MerlinEmulator: Ignoring invalid NUMFRAMESTOACQUIRE " << value << std::endl;
+            }
+        }
+    }
+    std::string hdr = acquisition_header();
+    if (!send_message(hdr.data(), hdr.size()))
+    {
+        std::cout << "MerlinEmulator: Connection lost while sending the acquisition header." << std::endl;
+        close_sockets();
+        return -1;
+    }
+
+    std::mt19937 rng(42);
+    std::normal_distribution<double> jitter(0.0, s.jitter);
+    double fps = s.fps;
+    double sustained_fps = 0;
+    bool b_behind = false;
+    size_t block = (std::max)(static_cast<size_t>(fps), static_cast<size_t>(1));
+    size_t block_start = 0;
+    double block_lag = 0; // Maximum lag within the current block [ms]
+    double max_lag = 0;
+
+    auto t_start = chc::steady_clock::now();
+    auto t_block = t_start;
+    auto t_report = t_start;
+    double t_due = 0; // Schedule of the next frame, relative to the block start [s]
+    size_t n_sent = 0;
+
+    for (; n_sent < s.n_frames; n_sent++)
+    {
+        // Send time of this frame
+        double t_frame = t_due + ((s.jitter > 0) ? jitter(rng) * 1e-6 : 0.0);
+        auto due = t_block + chc::duration_cast<chc::steady_clock::duration>(chc::duration<double>(t_frame));
+        auto now = chc::steady_clock::now();
+        if (due > now + chc::microseconds(100))
+        {
+            std::this_thread::sleep_until(due);
+        }
+        else
+        {
+            while (chc::steady_clock::now() < due)
+            {
+            }
+        }
+
+        if (n_sent % n_file_frames == 0)
+        {
+            file.clear();
+            file.seekg(0, std::ios::beg);
+        }
+        file.read(&frame[15], frame_size);
+        if (!send_all(client_socket, &frame[0], frame.size()))
+        {
+            std::cout << std::endl
+                      << "MerlinEmulator: Connection closed by client after " << n_sent << " frames." << std::endl;
+            break;
+        }
+
+        // Lag behind the schedule after the frame was accepted by the receiver
+        double lag = chc::duration<double, std::milli>(chc::steady_clock::now() - due).count();
+        block_lag = (std::max)(block_lag, lag);
+        max_lag = (std::max)(max_lag, lag);
+        t_due += 1.0 / fps;
+
+        if (n_sent + 1 - block_start >= block)
+        {
+            if (block_lag < s.max_lag)
+            {
+                sustained_fps = fps;
+                if (s.ramp > 1.0)
+                {
+                    fps *= s.ramp;
+                }
+            }
+            else if (!b_behind)
+            {
+                b_behind = true;
+                std::cout << std::endl
+                          << "Receiver fell behind at " << fps << " Hz (lag " << block_lag << " ms) after "
+                          << n_sent + 1 << " frames." << std::endl;
+                if (s.ramp > 1.0 && sustained_fps > 0)
+                {
+                    fps = sustained_fps;
+                }
+            }
+            // Restart the schedule, so lag does not accumulate between blocks
+            t_block = chc::steady_clock::now();
+            t_due = 0;
+            block_start = n_sent + 1;
+            block = (std::max)(static_cast<size_t>(fps), static_cast<size_t>(1));
+            block_lag = 0;
+        }
+
+        auto t_now = chc::steady_clock::now();
+        if (t_now - t_report > chc::seconds(1))
+        {
+            double t = chc::duration<double>(t_now - t_start).count();
+            std::cout << "\r" << std::fixed << std::setprecision(1) << "t = " << t << " s, frames: " << n_sent + 1
+                      << ", target: " << fps << " Hz, average: " << (n_sent + 1) / t << " Hz, lag: " << block_lag << " ms   " << std::flush;
+            t_report = t_now;
+        }
+    }
+
+    // Last (partial) block
+    if (!b_behind && n_sent > block_start && block_lag < s.max_lag)
+    {
+        sustained_fps = (std::max)(sustained_fps, fps);
+    }
+
+    double t = chc::duration<double>(chc::steady_clock::now() - t_start).count();
+    std::cout << std::endl
+              << "Sent " << n_sent << " frames in " << t << " s (" << n_sent / t << " Hz), maximum lag " << max_lag << " ms." << std::endl;
+    if (sustained_fps > 0)
+    {
+        std::cout << "Highest frame rate sustained by the receiver: " << sustained_fps << " Hz" << std::endl;
+    }
+    else
+    {
+        std::cout << "Receiver did not keep up with " << s.fps << " Hz." << std::endl;
+    }
+    close_sockets();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    EmulatorSettings settings;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 != argc)
+        {
+            // .mib file to serve
+            if (strcmp(argv[i], "-filename") == 0)
+            {
+                settings.file_path = argv[i + 1];
+                i++;
+            }
+            // Data port
+            if (strcmp(argv[i], "-port") == 0)
+            {
+                settings.port = std::stoi(argv[i + 1]);
+                i++;
+            }
+            // Target frame rate in Hz
+            if (strcmp(argv[i], "-fps") == 0)
+            {
+                settings.fps = std::stod(argv[i + 1]);
+                i++;
+            }
+            // Timing jitter (standard deviation) in us
+            if (strcmp(argv[i], "-jitter") == 0)
+            {
+                settings.jitter = std::stod(argv[i + 1]);
+                i++;
+            }
+            // Increase the frame rate by this factor every second, while the receiver keeps up
+            if (strcmp(argv[i], "-ramp") == 0)
+            {
+                settings.ramp = std::stod(argv[i + 1]);
+                i++;
+            }
+            // Lag in ms at which the receiver counts as falling behind
+            if (strcmp(argv[i], "-max_lag") == 0)
+            {
+                settings.max_lag = std::stod(argv[i + 1]);
+                i++;
+            }
+            // Number of frames to send, the file is repeated if necessary
+            if (strcmp(argv[i], "-frames") == 0)
+            {
+                settings.n_frames = std::stoul(argv[i + 1]);
+                i++;
+            }
+            // Socket send buffer size in bytes
+            if (strcmp(argv[i], "-sndbuf") == 0)
+            {
+                settings.sndbuf_size = std::stoi(argv[i + 1]);
+                i++;
+            }
+            // Serve a control port, streaming then starts with STARTACQUISITION
+            if (strcmp(argv[i], "-com_port") == 0)
+            {
+                settings.com_port = std::stoi(argv[i + 1]);
+                i++;
+            }
+        }
+    }
+    if (settings.file_path.empty() || settings.fps <= 0)
+    {
+        std::cout << "Usage: MERLIN_EMULATOR -filename <file.mib> [-port 6342] [-fps 1000] [-jitter 0] "
+                     "[-ramp 1] [-max_lag 100] [-frames 0] [-sndbuf 0] [-com_port 0]"
+                  << std::endl;
+        return -1;
+    }
+    MerlinEmulator emulator(settings);
+    return emulator.run();
+}
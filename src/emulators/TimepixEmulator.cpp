@@ -0,0 +1,332 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+// Timepix event stream emulator: serves a recorded .t3p file over TCP as a stream of
+// raw event records, paced by their time of arrival. With -speed 1 the events are sent
+// in real time, larger values replay the acquisition faster (0: as fast as possible).
+// Example usage:
+//   ./TIMEPIX_EMULATOR -filename ev.t3p -port 6343 -speed 1
+//   ./RICOM -ip 127.0.0.1 -port 6343 -dwell_time 1000 -nx 256 -ny 256
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <csignal>
+
+#include "SocketConnector.h"
+#include "TimepixEvent.h"
+
+namespace chc = std::chrono;
+
+struct EmulatorSettings
+{
+    std::string file_path;
+    int port;
+    double speed;    // Replay speed relative to the recorded ToA (0: unpaced)
+    double batch_us; // Scheduling interval, events within it are sent together [us]
+    int repeat;      // Number of passes through the file
+    int sndbuf_size; // SO_SNDBUF in bytes (0: system default)
+    EmulatorSettings() : file_path(), port(6343), speed(1), batch_us(1000), repeat(1), sndbuf_size(0){};
+};
+
+class TimepixEmulator
+{
+public:
+    explicit TimepixEmulator(EmulatorSettings &settings) : s(settings),
+                                                           listen_socket(INVALID_SOCKET),
+                                                           client_socket(INVALID_SOCKET),
+                                                           n_file_events(0){};
+    int run();
+
+private:
+    static const size_t chunk_events = 1 << 16;
+
+    EmulatorSettings s;
+    SOCKET listen_socket;
+    SOCKET client_socket;
+    std::ifstream file;
+    std::vector<e_event> chunk;
+    size_t n_file_events;
+
+    bool open_file();
+    bool accept_client();
+    static bool send_all(SOCKET sock, const char *buffer, size_t size);
+    void close_sockets();
+};
+
+bool TimepixEmulator::open_file()
+{
+    file.open(s.file_path, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        std::cout << "TimepixEmulator: Error opening file " << s.file_path << "!" << std::endl;
+        return false;
+    }
+    n_file_events = static_cast<size_t>(file.tellg()) / sizeof(e_event);
+    if (n_file_events == 0)
+    {
+        std::cout << "TimepixEmulator: " << s.file_path << " contains no events!" << std::endl;
+        return false;
+    }
+    file.seekg(0, std::ios::beg);
+    chunk.resize(chunk_events);
+    std::cout << "Serving " << s.file_path << ": " << n_file_events << " events" << std::endl;
+    return true;
+}
+
+bool TimepixEmulator::accept_client()
+{
+#ifdef WIN32
+    const char opt = 1;
+#else
+    int opt = 1;
+#endif
+    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_socket == INVALID_SOCKET)
+    {
+        perror("TimepixEmulator: Error creating socket");
+        return false;
+    }
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(s.port);
+    if (bind(listen_socket, (struct sockaddr *)&address, sizeof(address)) == SOCKET_ERROR ||
+        listen(listen_socket, 1) == SOCKET_ERROR)
+    {
+        perror("TimepixEmulator: Error binding socket");
+        return false;
+    }
+    std::cout << "Waiting for connection on port " << s.port << "..." << std::endl;
+    client_socket = accept(listen_socket, NULL, NULL);
+    if (client_socket == INVALID_SOCKET)
+    {
+        perror("TimepixEmulator: Error accepting connection");
+        return false;
+    }
+    if (s.sndbuf_size > 0)
+    {
+        setsockopt(client_socket, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char *>(&s.sndbuf_size), sizeof(s.sndbuf_size));
+    }
+    std::cout << "Client connected." << std::endl;
+    return true;
+}
+
+bool TimepixEmulator::send_all(SOCKET sock, const char *buffer, size_t size)
+{
+    size_t sent = 0;
+    while (sent < size)
+    {
+        int n = send(sock, buffer + sent, static_cast<int>((std::min)(size - sent, static_cast<size_t>(1 << 30))), 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+void TimepixEmulator::close_sockets()
+{
+#ifdef WIN32
+    closesocket(client_socket);
+    closesocket(listen_socket);
+    WSACleanup();
+#else
+    close(client_socket);
+    close(listen_socket);
+#endif
+}
+
+int TimepixEmulator::run()
+{
+#ifdef WIN32
+    WSADATA w;
+    if (WSAStartup(0x0202, &w))
+    {
+        return -1;
+    }
+#endif
+    if (!open_file())
+    {
+        return -1;
+    }
+    if (!accept_client())
+    {
+        close_sockets();
+        return -1;
+    }
+
+    // ToA is counted in 25 ns units, as in TimepixInterface
+    const double ns_per_tick = 25.0;
+    const double batch_ticks = s.batch_us * 1e3 / ns_per_tick * ((s.speed > 0) ? s.speed : 1);
+    uint64_t toa_span = 0;   // Last ToA of the file, following passes are shifted by it
+    uint64_t toa_shift = 0;  // Shift of the current pass
+    uint64_t toa_start = 0;  // ToA at the start of the replay
+    bool b_first = true;
+    double max_lag = 0;      // Largest delay of a batch behind its schedule [ms]
+    size_t n_sent = 0;
+
+    auto t_start = chc::steady_clock::now();
+    auto t_report = t_start;
+    bool b_closed = false;
+
+    for (int pass = 0; pass < s.repeat && !b_closed; pass++)
+    {
+        file.clear();
+        file.seekg(0, std::ios::beg);
+        size_t n_left = n_file_events;
+        while (n_left > 0 && !b_closed)
+        {
+            size_t n = (std::min)(n_left, chunk_events);
+            file.read(reinterpret_cast<char *>(&chunk[0]), n * sizeof(e_event));
+            n_left -= n;
+            for (size_t i = 0; i < n; i++)
+            {
+                if (pass == 0)
+                {
+                    toa_span = (std::max)(toa_span, chunk[i].toa);
+                }
+                chunk[i].toa += toa_shift;
+            }
+            if (b_first)
+            {
+                toa_start = chunk[0].toa;
+                b_first = false;
+            }
+
+            // Send the events in batches, each when its first event is due
+            size_t i_batch = 0;
+            while (i_batch < n)
+            {
+                uint64_t toa_batch = chunk[i_batch].toa;
+                size_t i_end = i_batch + 1;
+                while (i_end < n && static_cast<double>(chunk[i_end].toa) - static_cast<double>(toa_batch) < batch_ticks)
+                {
+                    i_end++;
+                }
+                if (s.speed > 0 && toa_batch > toa_start)
+                {
+                    double t_due = (toa_batch - toa_start) * ns_per_tick * 1e-9 / s.speed;
+                    auto due = t_start + chc::duration_cast<chc::steady_clock::duration>(chc::duration<double>(t_due));
+                    auto now = chc::steady_clock::now();
+                    if (due > now)
+                    {
+                        std::this_thread::sleep_until(due);
+                    }
+                    else
+                    {
+                        max_lag = (std::max)(max_lag, chc::duration<double, std::milli>(now - due).count());
+                    }
+                }
+                if (!send_all(client_socket, reinterpret_cast<const char *>(&chunk[i_batch]), (i_end - i_batch) * sizeof(e_event)))
+                {
+                    std::cout << std::endl
+                              << "TimepixEmulator: Connection closed by client after " << n_sent << " events." << std::endl;
+                    b_closed = true;
+                    break;
+                }
+                n_sent += i_end - i_batch;
+                i_batch = i_end;
+
+                auto t_now = chc::steady_clock::now();
+                if (t_now - t_report > chc::seconds(1))
+                {
+                    double t = chc::duration<double>(t_now - t_start).count();
+                    std::cout << "\r" << std::fixed << std::setprecision(1) << "t = " << t << " s, events: " << n_sent
+                              << ", rate: " << n_sent / t * 1e-6 << " Mev/s, lag: " << max_lag << " ms   " << std::flush;
+                    t_report = t_now;
+                }
+            }
+        }
+        toa_shift += toa_span + 1;
+    }
+
+    double t = chc::duration<double>(chc::steady_clock::now() - t_start).count();
+    std::cout << std::endl
+              << "Sent " << n_sent << " events in " << t << " s (" << n_sent / t * 1e-6 << " Mev/s), maximum lag "
+              << max_lag << " ms." << std::endl;
+    close_sockets();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    EmulatorSettings settings;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 != argc)
+        {
+            // .t3p file to serve
+            if (strcmp(argv[i], "-filename") == 0)
+            {
+                settings.file_path = argv[i + 1];
+                i++;
+            }
+            // Data port
+            if (strcmp(argv[i], "-port") == 0)
+            {
+                settings.port = std::stoi(argv[i + 1]);
+                i++;
+            }
+            // Replay speed, 1: real time as recorded, 0: as fast as possible
+            if (strcmp(argv[i], "-speed") == 0)
+            {
+                settings.speed = std::stod(argv[i + 1]);
+                i++;
+            }
+            // Scheduling interval in us of acquisition time
+            if (strcmp(argv[i], "-batch_us") == 0)
+            {
+                settings.batch_us = std::stod(argv[i + 1]);
+                i++;
+            }
+            // Number of passes through the file, the ToA continues across passes
+            if (strcmp(argv[i], "-repeat") == 0)
+            {
+                settings.repeat = std::stoi(argv[i + 1]);
+                i++;
+            }
+            // Socket send buffer size in bytes
+            if (strcmp(argv[i], "-sndbuf") == 0)
+            {
+                settings.sndbuf_size = std::stoi(argv[i + 1]);
+                i++;
+            }
+        }
+    }
+    if (settings.file_path.empty() || settings.speed < 0 || settings.batch_us <= 0 || settings.repeat < 1)
+    {
+        std::cout << "Usage: TIMEPIX_EMULATOR -filename <file.t3p> [-port 6343] [-speed 1] [-batch_us 1000] "
+                     "[-repeat 1] [-sndbuf 0]"
+                  << std::endl;
+        return -1;
+    }
+#ifndef WIN32
+    // A client closing the connection ends the pass with an error from send(), not the process
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    TimepixEmulator emulator(settings);
+    return emulator.run();
+}
@@ -0,0 +1,146 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+// Converts a .mib recording to the compressed chunked container (.mibz), which RICOM
+// reads like the original file.
+// Example usage:
+//   ./MIB_COMPRESS -filename default1.mib -chunk 64
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <filesystem>
+#include <cstring>
+
+#include "ChunkedFile.h"
+#include "MibFile.h"
+
+namespace chc = std::chrono;
+
+// Element size of the pixel data for the bitshuffle filter, from the data type in the frame header
+static size_t mib_elem_size(const std::string &head)
+{
+    if (head.find(",U08,") != std::string::npos)
+    {
+        return 1;
+    }
+    if (head.find(",U32,") != std::string::npos)
+    {
+        return 4;
+    }
+    // U16 and raw (R64) data with 6 or 12 bit counters
+    return 2;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string file_path;
+    std::string out_path;
+    size_t frames_per_chunk = 256;
+    int level = 3;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 != argc)
+        {
+            // .mib file to convert
+            if (strcmp(argv[i], "-filename") == 0)
+            {
+                file_path = argv[i + 1];
+                i++;
+            }
+            // Output file (default: input file with .mibz extension)
+            if (strcmp(argv[i], "-o") == 0)
+            {
+                out_path = argv[i + 1];
+                i++;
+            }
+            // Frames per chunk, ideally one scan row
+            if (strcmp(argv[i], "-chunk") == 0)
+            {
+                frames_per_chunk = std::stoul(argv[i + 1]);
+                i++;
+            }
+            // zstd compression level
+            if (strcmp(argv[i], "-level") == 0)
+            {
+                level = std::stoi(argv[i + 1]);
+                i++;
+            }
+        }
+    }
+    if (file_path.empty() || frames_per_chunk == 0)
+    {
+        std::cout << "Usage: MIB_COMPRESS -filename <file.mib> [-o <file.mibz>] [-chunk 256] [-level 3]" << std::endl;
+        return -1;
+    }
+    if (out_path.empty())
+    {
+        out_path = std::filesystem::path(file_path).replace_extension(".mibz").string();
+    }
+
+    std::ifstream file(file_path, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cout << "MIB_COMPRESS: Error opening file " << file_path << "!" << std::endl;
+        return -1;
+    }
+    size_t file_size = std::filesystem::file_size(file_path);
+    std::string head(384, '\0');
+    file.read(&head[0], head.size());
+    if (!file || head.compare(0, 4, "MQ1,") != 0)
+    {
+        std::cout << "MIB_COMPRESS: " << file_path << " is not a .mib file!" << std::endl;
+        return -1;
+    }
+    size_t head_size = std::stoul(head.substr(11, 5));
+    size_t frame_size = mib_frame_size(file, file_size, head_size);
+    size_t n_frames = file_size / frame_size;
+
+    ChunkedFileWriter writer;
+    if (!writer.open(out_path, frame_size, head_size, frames_per_chunk, mib_elem_size(head), level))
+    {
+        return -1;
+    }
+    auto t_start = chc::steady_clock::now();
+    std::vector<char> frame(frame_size);
+    for (size_t i = 0; i < n_frames; i++)
+    {
+        file.read(&frame[0], frame_size);
+        if (!file)
+        {
+            std::cout << std::endl
+                      << "MIB_COMPRESS: Error reading frame " << i << " of " << file_path << "!" << std::endl;
+            return -1;
+        }
+        writer.write_frame(&frame[0]);
+        if ((i + 1) % frames_per_chunk == 0 || i + 1 == n_frames)
+        {
+            std::cout << "\r" << i + 1 << " / " << n_frames << " frames" << std::flush;
+        }
+    }
+    if (!writer.close())
+    {
+        std::cout << std::endl
+                  << "MIB_COMPRESS: Error writing " << out_path << "!" << std::endl;
+        return -1;
+    }
+    double t = chc::duration<double>(chc::steady_clock::now() - t_start).count();
+    std::cout << std::endl
+              << std::fixed << std::setprecision(2) << "Wrote " << out_path << ": " << n_frames << " frames, "
+              << file_size / 1048576.0 << " MB -> " << writer.compressed_size() / 1048576.0 << " MB (ratio "
+              << static_cast<double>(file_size) / writer.compressed_size() << ") in " << t << " s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,208 @@
+/* Copyright (C) 2021 Thomas Friedrich, Chu-Ping Yu,
+ * University of Antwerp - All Rights Reserved.
+ * You may use, distribute and modify
+ * this code under the terms of the GPL3 license.
+ * You should have received a copy of the GPL3 license with
+ * this file. If not, please visit:
+ * https://www.gnu.org/licenses/gpl-3.0.en.html
+ *
+ * Authors:
+ *   Thomas Friedrich <thomas.friedrich@uantwerpen.be>
+ *   Chu-Ping Yu <chu-ping.yu@uantwerpen.be>
+ */
+
+// Converts a .t3p recording to the compact event cache (.t3c) for one dwell time, which
+// RICOM reads with a fraction of the I/O. Events are sorted into scan rows by probe position.
+// Example usage:
+//   ./T3P_CACHE -filename ev.t3p -dwell_time 1000 -nx 256
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <filesystem>
+#include <cstring>
+#include <cstdint>
+
+#include "MappedFile.h"
+#include "EventCache.h"
+#include "TimepixEvent.h"
+
+namespace chc = std::chrono;
+
+int main(int argc, char *argv[])
+{
+    std::string file_path;
+    std::string out_path;
+    uint32_t dwell_time = 0;
+    size_t nx = 256;
+    uint32_t cam_nx = 256;
+    uint32_t cam_ny = 256;
+    bool b_tot = false;
+    size_t margin = 2; // Rows kept open for events out of order
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 != argc)
+        {
+            // .t3p file to convert
+            if (strcmp(argv[i], "-filename") == 0)
+            {
+                file_path = argv[i + 1];
+                i++;
+            }
+            // Output file (default: input file with .t3c extension)
+            if (strcmp(argv[i], "-o") == 0)
+            {
+                out_path = argv[i + 1];
+                i++;
+            }
+            // Dwell time in ns
+            if (strcmp(argv[i], "-dwell_time") == 0)
+            {
+                dwell_time = std::stoul(argv[i + 1]);
+                i++;
+            }
+            // Probe positions per scan row
+            if (strcmp(argv[i], "-nx") == 0)
+            {
+                nx = std::stoul(argv[i + 1]);
+                i++;
+            }
+            // Detector size
+            if (strcmp(argv[i], "-cam_nx") == 0)
+            {
+                cam_nx = std::stoul(argv[i + 1]);
+                i++;
+            }
+            if (strcmp(argv[i], "-cam_ny") == 0)
+            {
+                cam_ny = std::stoul(argv[i + 1]);
+                i++;
+            }
+            // Keep the ToT of each event
+            if (strcmp(argv[i], "-tot") == 0)
+            {
+                b_tot = std::stoi(argv[i + 1]) != 0;
+                i++;
+            }
+            // Rows after which late events are dropped
+            if (strcmp(argv[i], "-margin") == 0)
+            {
+                margin = std::stoul(argv[i + 1]);
+                i++;
+            }
+        }
+    }
+    if (file_path.empty() || dwell_time == 0 || nx == 0)
+    {
+        std::cout << "Usage: T3P_CACHE -filename <file.t3p> -dwell_time <ns> [-nx 256] [-o <file.t3c>] "
+                     "[-cam_nx 256] [-cam_ny 256] [-tot 0] [-margin 2]"
+                  << std::endl;
+        return -1;
+    }
+    if (out_path.empty())
+    {
+        out_path = std::filesystem::path(file_path).replace_extension(".t3c").string();
+    }
+
+    MappedFile file;
+    if (!file.open(file_path))
+    {
+        std::cout << "T3P_CACHE: Error opening file " << file_path << "!" << std::endl;
+        return -1;
+    }
+    const e_event *events = reinterpret_cast<const e_event *>(file.data());
+    size_t n_events = file.size() / sizeof(e_event);
+    if (n_events == 0)
+    {
+        std::cout << "T3P_CACHE: " << file_path << " contains no events!" << std::endl;
+        return -1;
+    }
+    EventCacheWriter writer;
+    if (!writer.open(out_path, nx, dwell_time, cam_nx, cam_ny, b_tot))
+    {
+        return -1;
+    }
+
+    // Rows are collected until the stream is margin rows past them
+    const uint32_t n_pixels = cam_nx * cam_ny;
+    const size_t row_last = static_cast<size_t>(events[n_events - 1].toa * 25 / dwell_time) / nx;
+    std::map<size_t, std::vector<EVENT_CACHE::Event>> rows;
+    std::vector<EVENT_CACHE::Event> empty;
+    size_t next_row = 0; // Next row to write
+    size_t n_late = 0;
+    size_t n_invalid = 0;
+    auto t_start = chc::steady_clock::now();
+
+    auto flush_until = [&](size_t row_end)
+    {
+        for (; next_row < row_end; next_row++)
+        {
+            auto it = rows.find(next_row);
+            if (it == rows.end())
+            {
+                writer.write_row(empty);
+            }
+            else
+            {
+                writer.write_row(it->second);
+                rows.erase(it);
+            }
+        }
+    };
+
+    const size_t block = 1 << 20;
+    for (size_t e0 = 0; e0 < n_events; e0 += block)
+    {
+        file.prefetch((e0 + block) * sizeof(e_event), block * sizeof(e_event));
+        size_t e1 = (std::min)(e0 + block, n_events);
+        for (size_t e = e0; e < e1; e++)
+        {
+            size_t p = static_cast<size_t>(events[e].toa * 25 / dwell_time);
+            size_t row = p / nx;
+            // Pixel indices beyond the detector and ToA values beyond the last event are corrupted
+            if (events[e].index >= n_pixels || row > row_last + margin)
+            {
+                n_invalid++;
+                continue;
+            }
+            if (row < next_row)
+            {
+                n_late++;
+                continue;
+            }
+            rows[row].push_back({static_cast<uint32_t>(p - row * nx), events[e].index, events[e].tot});
+            if (row > next_row + margin)
+            {
+                flush_until(row - margin);
+            }
+        }
+        double t = chc::duration<double>(chc::steady_clock::now() - t_start).count();
+        std::cout << "\r" << std::fixed << std::setprecision(1) << "Events: " << e1 * 100.0 / n_events << " %, "
+                  << e1 / t * 1e-6 << " Mev/s   " << std::flush;
+    }
+    if (!rows.empty())
+    {
+        flush_until(rows.rbegin()->first + 1);
+    }
+    if (!writer.close())
+    {
+        std::cout << std::endl
+                  << "T3P_CACHE: Error writing " << out_path << "!" << std::endl;
+        return -1;
+    }
+
+    double t = chc::duration<double>(chc::steady_clock::now() - t_start).count();
+    std::cout << std::endl
+              << "Wrote " << out_path << ": " << next_row << " rows, " << std::setprecision(2)
+              << writer.size() * 1e-6 << " MB (" << static_cast<double>(file.size()) / writer.size()
+              << "x smaller) in " << t << " s" << std::endl;
+    if (n_late > 0 || n_invalid > 0)
+    {
+        std::cout << "Dropped " << n_late << " events more than " << margin << " rows late and "
+                  << n_invalid << " invalid events" << std::endl;
+    }
+    return 0;
+}